@@ -0,0 +1,490 @@
+-- formatgen: compiles .format definitions into straight-line C++ decoders
+--
+-- Runs under plain Lua 5.1 or inside premake4 (see pk2unpack/premake4.lua):
+--	lua formatgen.lua <namespace> <output.hpp> <input.format> [import.format ...]
+--
+-- For every define (and the layout) in the main input, a struct and an
+-- inline decode() over a big-endian byte buffer are emitted, with all field
+-- offsets folded into constants. Imports only provide definitions for
+-- referenced types.
+--
+-- Supported subset:
+--	primitive fields, fixed arrays ("int ids[4]"), rdata<N, pad>, nested fixed
+--	defines, and "operation in" blocks made of "field (=||=|+=) type.in() [<<N];"
+--	statements (see uint40).
+-- Defines with variable-size data (counted or indefinite arrays, strings,
+-- nameless inline operations) get a <Name>Head struct for their fixed-size
+-- prefix instead; the remainder is left to hand-written code.
+
+formatgen={}
+
+local PRIMITIVES={
+	byte={ctype="uint8_t", size=1},
+	char={ctype="char", size=1},
+	bool={ctype="uint8_t", size=1},
+	short={ctype="int16_t", size=2},
+	ushort={ctype="uint16_t", size=2},
+	int={ctype="int32_t", size=4},
+	uint={ctype="uint32_t", size=4},
+	long={ctype="int64_t", size=8},
+	ulong={ctype="uint64_t", size=8},
+	float={ctype="float", size=4},
+	double={ctype="double", size=8},
+	-- 32-bit in BRINK data (see sdmd2 FileInfo)
+	time_t={ctype="uint32_t", size=4},
+}
+
+-- operation reads are combined bitwise, so they load unsigned (no sign extension)
+local UNSIGNED={[1]="uint8_t", [2]="uint16_t", [4]="uint32_t", [8]="uint64_t"}
+
+local MODIFIERS={const=true, real=true, noread=true, abstract=true}
+
+local function trim(s)
+	return (s:gsub("^%s+", ""):gsub("%s+$", ""))
+end
+
+local function parse_number(s)
+	s=trim(s or "")
+	if s:match("^0[xX]%x+$") then
+		return tonumber(s:sub(3), 16)
+	elseif s:match("^%d+$") then
+		return tonumber(s)
+	end
+	return nil
+end
+
+-- split "a, b<c, d>, e" at top-level commas
+local function split_args(s)
+	local args, depth, cur={}, 0, ""
+	for c in s:gmatch(".") do
+		if c=="<" then
+			depth=depth+1
+		elseif c==">" then
+			depth=depth-1
+		end
+		if c=="," and depth==0 then
+			table.insert(args, trim(cur))
+			cur=""
+		else
+			cur=cur..c
+		end
+	end
+	if trim(cur)~="" then
+		table.insert(args, trim(cur))
+	end
+	return args
+end
+
+local function parse_field(line)
+	local field={mods={}}
+	local rest=line
+	while true do
+		local word, after=rest:match("^([%a_][%w_]*)%s*(.*)$")
+		if word and MODIFIERS[word] then
+			field.mods[word]=true
+			rest=after
+		else
+			break
+		end
+	end
+	if rest:match("^ignore[%s']") then
+		return nil
+	end
+	local tname, after=rest:match("^([%a_][%w_]*)(.*)$")
+	if not tname then
+		return nil
+	end
+	field.type=tname
+	rest=after
+	local targs
+	targs, after=rest:match("^%s*(%b<>)(.*)$")
+	if targs then
+		field.targs=split_args(targs:sub(2, -2))
+		rest=after
+	end
+	if rest:match("^%s*%*") then
+		field.pointer=true
+		rest=rest:gsub("^%s*%*", "")
+	end
+	field.name, rest=rest:match("^%s*([%a_][%w_]*)(.*)$")
+	if not field.name then
+		return nil
+	end
+	local count
+	count, after=rest:match("^%s*(%b[])(.*)$")
+	if count then
+		field.array=true
+		field.count=trim(count:sub(2, -2))
+		rest=after
+	end
+	local init=rest:match("^%s*=(.*)$")
+	if init then
+		field.init=trim(init)
+	end
+	return field
+end
+
+-- parse the body of a define/layout into fields and operations, in order
+local function parse_body(body)
+	local items={}
+	local ops={}
+	-- pull out operation blocks first; they span lines
+	body=body:gsub("operation%s*([%a_]*)%s*(%b{})", function(name, block)
+		table.insert(ops, {name=name, code=block:sub(2, -2)})
+		return "\n@op"..#ops.."\n"
+	end)
+	for line in body:gmatch("[^\n]+") do
+		line=trim(line)
+		local opi=line:match("^@op(%d+)$")
+		if opi then
+			table.insert(items, {operation=ops[tonumber(opi)]})
+		elseif line~="" then
+			local field=parse_field(line)
+			if field then
+				table.insert(items, {field=field})
+			end
+		end
+	end
+	return items
+end
+
+-- returns list of defines (in file order) and the layout (if any)
+local function parse_format(text)
+	text=text:gsub("//[^\n]*", "")
+	local defs={}
+	local pos=1
+	while true do
+		local s, e=text:find("%b{}", pos)
+		if not s then
+			break
+		end
+		local header=trim(text:sub(pos, s-1))
+		local body=text:sub(s+1, e-1)
+		pos=e+1
+		local def={items=parse_body(body)}
+		local words=header
+		if words:match("^abstract%s") then
+			def.abstract=true
+			words=trim(words:sub(9))
+		end
+		if words=="layout" then
+			def.name="Layout"
+			def.layout=true
+		else
+			local name, params=words:match("^define%s+([%a_][%w_]*)%s*(.*)$")
+			if not name then
+				error("formatgen: unrecognized block header: "..header)
+			end
+			def.name=name
+			def.template=(params~="")
+		end
+		table.insert(defs, def)
+	end
+	return defs
+end
+
+local Generator={}
+Generator.__index=Generator
+
+local function new_generator(namespace)
+	return setmetatable({namespace=namespace, defs={}, emitted={}, out={}, sizes={}}, Generator)
+end
+
+function Generator:add(defs, main)
+	for _, def in ipairs(defs) do
+		def.main=main
+		if def.layout then
+			if main then
+				self.layout=def
+			end
+		else
+			self.defs[def.name]=def
+		end
+	end
+end
+
+-- compile "operation in" into read steps; nil if it is outside the supported subset
+local function compile_in_operation(code)
+	local steps={}
+	local offset=0
+	for stmt in code:gmatch("[^;]+") do
+		stmt=trim(stmt)
+		if stmt~="" then
+			local lhs, op, tname, shift=stmt:match("^([%a_][%w_]*)%s*([|+]?=)%s*([%a_][%w_]*)%.in%(%)%s*<<%s*(%d+)$")
+			if not lhs then
+				lhs, op, tname=stmt:match("^([%a_][%w_]*)%s*([|+]?=)%s*([%a_][%w_]*)%.in%(%)$")
+			end
+			local prim=tname and PRIMITIVES[tname]
+			if not prim then
+				return nil
+			end
+			table.insert(steps, {lhs=lhs, op=op, prim=prim, offset=offset, shift=tonumber(shift)})
+			offset=offset+prim.size
+		end
+	end
+	return steps, offset
+end
+
+-- info for a field's element type: {size, ctype, prim, def, bytes}; nil if not fixed-size
+function Generator:element(field)
+	if field.pointer then
+		return nil
+	end
+	local prim=PRIMITIVES[field.type]
+	if prim then
+		return {size=prim.size, ctype=prim.ctype, prim=prim}
+	end
+	if field.type=="rdata" and field.targs then
+		local n=parse_number(field.targs[1])
+		if n then
+			return {size=n, ctype="unsigned char", bytes=n}
+		end
+		return nil
+	end
+	local def=self.defs[field.type]
+	if def and not def.template then
+		local size=self:fixed_size(def)
+		if size then
+			return {size=size, ctype=def.name, def=def}
+		end
+	end
+	return nil
+end
+
+-- analyze a define: fields to emit with offsets, the fixed prefix size and whether it is entirely fixed
+function Generator:analyze(def)
+	if def.analysis then
+		return def.analysis
+	end
+	local a={fields={}, size=0, fixed=true}
+	def.analysis=a
+	local in_op
+	for _, item in ipairs(def.items) do
+		if item.operation and item.operation.name=="in" then
+			in_op=item.operation
+		end
+	end
+	if in_op then
+		-- members are filled by the operation; only primitive members are supported
+		local steps, size=compile_in_operation(in_op.code)
+		if not steps then
+			a.fixed=false
+			return a
+		end
+		for _, item in ipairs(def.items) do
+			local f=item.field
+			if f and not f.array and PRIMITIVES[f.type] then
+				table.insert(a.fields, {field=f, elem=self:element(f), computed=true})
+			end
+		end
+		a.steps=steps
+		a.size=size
+		return a
+	end
+	local offset=0
+	for _, item in ipairs(def.items) do
+		if item.operation then
+			-- nameless operations read data of their own
+			if item.operation.name=="" then
+				a.fixed=false
+				break
+			end
+		else
+			local f=item.field
+			if not f.mods.noread and not f.pointer then
+				local elem=self:element(f)
+				local count=1
+				if f.array then
+					count=parse_number(f.count)
+				end
+				if not elem or not count then
+					a.fixed=false
+					break
+				end
+				table.insert(a.fields, {field=f, elem=elem, offset=offset, count=(f.array) and count or nil})
+				offset=offset+elem.size*count
+			end
+		end
+	end
+	a.size=offset
+	return a
+end
+
+function Generator:fixed_size(def)
+	if self.sizes[def.name]==nil then
+		self.sizes[def.name]=false -- guards recursion
+		local a=self:analyze(def)
+		self.sizes[def.name]=(a.fixed) and a.size or false
+	end
+	return self.sizes[def.name] or nil
+end
+
+function Generator:line(s)
+	table.insert(self.out, s)
+end
+
+function Generator:emit(def)
+	if self.emitted[def.name] or def.template or def.abstract then
+		return
+	end
+	self.emitted[def.name]=true
+	local a=self:analyze(def)
+	for _, af in ipairs(a.fields) do
+		if af.elem and af.elem.def then
+			self:emit(af.elem.def)
+		end
+	end
+	if #a.fields==0 then
+		return
+	end
+	local name=(a.fixed) and def.name or def.name.."Head"
+	if not a.fixed then
+		self:line("// fixed-size prefix of "..def.name.."; the rest is variable-size")
+	end
+	self:line("struct "..name.." {")
+	for _, af in ipairs(a.fields) do
+		local f=af.field
+		if af.elem.bytes then
+			self:line("\t"..af.elem.ctype.." "..f.name.."["..af.elem.bytes.."];")
+		elseif af.count then
+			self:line("\t"..af.elem.ctype.." "..f.name.."["..af.count.."];")
+		else
+			self:line("\t"..af.elem.ctype.." "..f.name..";")
+		end
+	end
+	self:line("};")
+	self:line("")
+	self:line("enum {")
+	self:line("\t"..name.."_SIZE="..a.size..(a.steps and "" or ","))
+	if not a.steps then
+		for i, af in ipairs(a.fields) do
+			self:line("\t"..name.."_OFFSET_"..af.field.name.."="..af.offset..((i<#a.fields) and "," or ""))
+		end
+	end
+	self:line("};")
+	self:line("")
+	self:line("inline void decode("..name.."& o, const unsigned char* p) {")
+	if a.steps then
+		for _, st in ipairs(a.steps) do
+			local load="(uint64_t)loadBE<"..UNSIGNED[st.prim.size]..">(p+"..st.offset..")"
+			if st.shift then
+				load=load.."<<"..st.shift
+			end
+			self:line("\to."..st.lhs..st.op..load..";")
+		end
+	else
+		for _, af in ipairs(a.fields) do
+			local f=af.field
+			local target="o."..f.name
+			local at="p+"..af.offset
+			if af.elem.bytes or (af.count and af.elem.size==1 and af.elem.prim) then
+				self:line("\tmemcpy("..target..", "..at..", sizeof("..target.."));")
+			elseif af.count then
+				local elem_at=at.."+i*"..af.elem.size
+				self:line("\tfor (unsigned int i=0; i<"..af.count.."; ++i) {")
+				if af.elem.def then
+					self:line("\t\tdecode("..target.."[i], "..elem_at..");")
+				else
+					self:line("\t\t"..target.."[i]=loadBE<"..af.elem.ctype..">("..elem_at..");")
+				end
+				self:line("\t}")
+			elseif af.elem.def then
+				self:line("\tdecode("..target..", "..at..");")
+			else
+				self:line("\t"..target.."=loadBE<"..af.elem.ctype..">("..at..");")
+			end
+		end
+	end
+	self:line("}")
+	self:line("")
+end
+
+function Generator:generate(source)
+	local guard="_PK2UNPACK_GEN_"..self.namespace:upper().."_HPP_"
+	self:line("// Generated by formats/formatgen.lua from "..source.."; do not edit.")
+	self:line("")
+	self:line("#ifndef "..guard)
+	self:line("#define "..guard)
+	self:line("")
+	self:line("#include <string.h>")
+	self:line("#include <stdint.h>")
+	self:line("#include \"byteorder.hpp\"")
+	self:line("")
+	self:line("namespace PK2Unpack {")
+	self:line("namespace "..self.namespace.." {")
+	self:line("")
+	local names={}
+	for name, def in pairs(self.defs) do
+		if def.main then
+			table.insert(names, def)
+		end
+	end
+	table.sort(names, function(x, y) return x.order<y.order end)
+	for _, def in ipairs(names) do
+		self:emit(def)
+	end
+	if self.layout then
+		self:emit(self.layout)
+	end
+	self:line("} // namespace "..self.namespace)
+	self:line("} // namespace PK2Unpack")
+	self:line("")
+	self:line("#endif // "..guard)
+	return table.concat(self.out, "\n").."\n"
+end
+
+local function read_file(path)
+	local f=io.open(path, "r")
+	if not f then
+		error("formatgen: cannot open "..path)
+	end
+	local text=f:read("*a")
+	f:close()
+	return text
+end
+
+-- generate a header; imports are parsed only for type definitions
+function formatgen.generate(namespace, output, input, imports)
+	local gen=new_generator(namespace)
+	local order=0
+	for _, path in ipairs(imports or {}) do
+		gen:add(parse_format(read_file(path)), false)
+	end
+	local defs=parse_format(read_file(input))
+	for _, def in ipairs(defs) do
+		order=order+1
+		def.order=order
+	end
+	gen:add(defs, true)
+	local text=gen:generate(input:match("[^/]+/[^/]+$") or input)
+	-- only touch the output when it changes, so make does not rebuild everything
+	local f=io.open(output, "r")
+	if f then
+		local old=f:read("*a")
+		f:close()
+		if old==text then
+			return false
+		end
+	end
+	f=io.open(output, "w")
+	if not f then
+		error("formatgen: cannot write "..output)
+	end
+	f:write(text)
+	f:close()
+	return true
+end
+
+if arg and arg[0] and arg[0]:match("formatgen%.lua$") then
+	if #arg<3 then
+		print("usage: lua formatgen.lua <namespace> <output.hpp> <input.format> [import.format ...]")
+		os.exit(1)
+	end
+	local imports={}
+	for i=4, #arg do
+		table.insert(imports, arg[i])
+	end
+	formatgen.generate(arg[1], arg[2], arg[3], imports)
+end
+
+return formatgen
@@ -0,0 +1,480 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+// pk2bench: times the common SDPK2/SDMD2 operations on an archive and saves/compares results
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <duct/filestream.hpp>
+#include "sdpk2.hpp"
+#include "sdmd2.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "async.hpp"
+#include "sidecar.hpp"
+#include "directio.hpp"
+#include "pathindex.hpp"
+#include "pathhash.hpp"
+
+using namespace PK2Unpack;
+
+struct BenchResult {
+	std::string name;
+	double value;
+	const char* unit;
+};
+
+typedef std::vector<BenchResult> BenchResultVec;
+
+// fixed so runs pick the same entries and ranges
+static uint64_t __rng_state=0x853C49E6748FEA9Bull;
+
+static uint64_t bench_rand() {
+	__rng_state^=__rng_state>>12;
+	__rng_state^=__rng_state<<25;
+	__rng_state^=__rng_state>>27;
+	return __rng_state*0x2545F4914F6CDD1Dull;
+}
+
+static double median(std::vector<double>& samples) {
+	std::sort(samples.begin(), samples.end());
+	return samples[samples.size()/2];
+}
+
+class NullHandler : public BlockHandler {
+public:
+	NullHandler() : _bytes(0) {
+	};
+	bool block(unsigned int, const char*, size_t size) {
+		_bytes+=size;
+		return true;
+	};
+	uint64_t _bytes;
+};
+
+class ExtractTask : public ParallelTask {
+public:
+	ExtractTask(const SDPK2& pak, unsigned int threads) : _pak(pak), _streams(threads, (Stream*)NULL), _decoders(threads, (BlockDecoder*)NULL) {
+	};
+	void begin(unsigned int thread) {
+		_streams[thread]=_pak.openDataStream();
+		_decoders[thread]=new BlockDecoder();
+	};
+	void run(size_t index, unsigned int thread) {
+		StreamBlockSource source(_streams[thread]);
+		NullHandler handler;
+		_pak.getEntries()[index].readBlocks(source, _pak, handler, *_decoders[thread]);
+	};
+	void end(unsigned int thread) {
+		SDPK2::closeDataStream(_streams[thread]);
+		delete _decoders[thread];
+	};
+	
+protected:
+	const SDPK2& _pak;
+	std::vector<Stream*> _streams;
+	std::vector<BlockDecoder*> _decoders;
+};
+
+// read up to size bytes from the start of a file (all of it for size==0)
+static bool read_file(const char* path, size_t size, std::vector<unsigned char>& buf) {
+	Stream* s=FileStream::readFile(path);
+	if (!s) {
+		printf("ERROR: Failed to open %s\n", path);
+		return false;
+	}
+	if (size==0 || size>s->size()) {
+		size=s->size();
+	}
+	buf.resize(size);
+	bool ok=(size==0) || s->read(&buf[0], size)==size;
+	s->close();
+	delete s;
+	return ok;
+}
+
+#if defined(PK2UNPACK_ASYNC)
+// co_await resumes once done() has been called count times, on the thread of the last call
+struct AsyncCountdown {
+	size_t remaining;
+	std::coroutine_handle<> waiter;
+
+	AsyncCountdown(size_t count) : remaining(count+1) {
+	};
+	void done() {
+		if (__sync_sub_and_fetch(&remaining, 1)==0) {
+			waiter.resume();
+		}
+	};
+	bool await_ready() const {
+		return false;
+	};
+	// the await is the last count, so whichever of it and done() comes last resumes
+	bool await_suspend(std::coroutine_handle<> handle) {
+		waiter=handle;
+		return __sync_sub_and_fetch(&remaining, 1)!=0;
+	};
+	void await_resume() const {
+	};
+};
+
+static DetachedTask async_read_one(AsyncArchive& archive, const Entry& entry, AsyncCountdown& countdown) {
+	AsyncResult result=co_await archive.readEntry(entry);
+	if (result.err!=READERR_NONE) {
+		printf("ERROR: async read failed: %s\n", getReadErrorName(result.err));
+	}
+	countdown.done();
+}
+
+static AsyncTask<size_t> async_read_all(AsyncArchive& archive, const EntryVec& entries) {
+	AsyncCountdown countdown(entries.size());
+	for (size_t i=0; i<entries.size(); ++i) {
+		async_read_one(archive, entries[i], countdown);
+	}
+	co_await countdown;
+	co_return entries.size();
+}
+#endif
+
+static void add_result(BenchResultVec& results, const char* name, double value, const char* unit) {
+	BenchResult r={name, value, unit};
+	results.push_back(r);
+	printf("%-20s %14.3f %s\n", name, value, unit);
+}
+
+static bool run_benchmarks(const char* pk2_path, const char* md2_path, unsigned int iterations, unsigned int threads, BenchResultVec& results) {
+	std::vector<double> samples;
+	uint64_t t;
+	// header open
+	for (unsigned int i=0; i<iterations; ++i) {
+		SDPK2 pak(pk2_path);
+		t=Stats::now();
+		if (!pak.open()) {
+			return false;
+		}
+		pak.close();
+		samples.push_back((double)(Stats::now()-t)/1e6);
+	}
+	add_result(results, "open", median(samples), "ms");
+	SDPK2 pak(pk2_path);
+	if (!pak.open()) {
+		return false;
+	}
+	const EntryVec& entries=pak.getEntries();
+	uint64_t total=0;
+	for (size_t i=0; i<entries.size(); ++i) {
+		total+=entries[i].getSize();
+	}
+	// findEntry
+	if (!entries.empty()) {
+		const unsigned int lookups=1000;
+		std::vector<MD5Hash> keys;
+		for (unsigned int i=0; i<lookups; ++i) {
+			keys.push_back(entries[bench_rand()%entries.size()].hash());
+		}
+		samples.clear();
+		for (unsigned int i=0; i<iterations; ++i) {
+			t=Stats::now();
+			size_t found=0;
+			for (unsigned int k=0; k<lookups; ++k) {
+				found+=(pak.findEntry(keys[k])!=NULL);
+			}
+			samples.push_back((double)(Stats::now()-t)/lookups);
+			if (found!=lookups) {
+				printf("ERROR: findEntry missed %lu keys\n", (unsigned long)(lookups-found));
+			}
+		}
+		add_result(results, "find_entry", median(samples), "ns");
+	}
+	// header parse from memory (no I/O)
+	std::vector<unsigned char> buf;
+	if (!read_file(pk2_path, pak.getHeaderSize(), buf)) {
+		return false;
+	}
+	samples.clear();
+	for (unsigned int i=0; i<iterations; ++i) {
+		SDPK2 parsed(pk2_path);
+		t=Stats::now();
+		parsed.deserializeInfo(&buf[0], buf.size());
+		samples.push_back((double)(Stats::now()-t)/1e3);
+	}
+	add_result(results, "header_parse", median(samples), "us");
+	// SDMD2 load
+	if (md2_path) {
+		if (!read_file(md2_path, 0, buf)) {
+			return false;
+		}
+		samples.clear();
+		for (unsigned int i=0; i<iterations; ++i) {
+			SDMD2 table(md2_path);
+			BEReader reader((buf.empty()) ? NULL : &buf[0], buf.size());
+			t=Stats::now();
+			table.deserialize(reader);
+			samples.push_back((double)(Stats::now()-t)/1e3);
+		}
+		add_result(results, "sdmd2_parse", median(samples), "us");
+		samples.clear();
+		for (unsigned int i=0; i<iterations; ++i) {
+			SDMD2 table(md2_path);
+			t=Stats::now();
+			if (!table.load()) {
+				return false;
+			}
+			samples.push_back((double)(Stats::now()-t)/1e6);
+		}
+		add_result(results, "sdmd2_load", median(samples), "ms");
+		// path index: build, then look up every path (also after a save/load round trip)
+		SDMD2 table(md2_path);
+		if (!table.load()) {
+			return false;
+		}
+		const EntryInfoSet& info=table.getEntryInfo();
+		std::vector<std::string> paths;
+		std::vector<const FileInfo*> path_files;
+		std::string path;
+		for (size_t i=0; i<info.getData().size(); ++i) {
+			if (PathIndex::resolvePath(info, info.getData()[i], path)) {
+				paths.push_back(path);
+				path_files.push_back(&info.getData()[i]);
+			}
+		}
+		samples.clear();
+		PathHash index;
+		for (unsigned int i=0; i<iterations; ++i) {
+			t=Stats::now();
+			index.build(table, &pak);
+			samples.push_back((double)(Stats::now()-t)/1e6);
+		}
+		add_result(results, "path_hash_build", median(samples), "ms");
+		std::string index_path(md2_path);
+		index_path.append(".pkmh");
+		PathHash loaded;
+		if (!index.save(index_path.c_str()) || !loaded.load(index_path.c_str(), table, &pak)) {
+			return false;
+		}
+		remove(index_path.c_str());
+		PathMatch match;
+		for (unsigned int pass=0; pass<2 && !paths.empty(); ++pass) {
+			const PathHash& hash=(pass==0) ? index : loaded;
+			size_t bad=0;
+			samples.clear();
+			for (unsigned int i=0; i<iterations; ++i) {
+				bad=0;
+				t=Stats::now();
+				for (size_t k=0; k<paths.size(); ++k) {
+					if (!hash.find(paths[k].data(), paths[k].size(), match) || match.file!=path_files[k]) {
+						++bad;
+					}
+				}
+				samples.push_back((double)(Stats::now()-t)/paths.size());
+			}
+			if (bad>0) {
+				printf("ERROR: path index missed %lu of %lu paths%s\n", (unsigned long)bad, (unsigned long)paths.size(), (pass==0) ? "" : " after reloading");
+				return false;
+			}
+			if (pass==0) {
+				add_result(results, "path_hash_find", median(samples), "ns");
+			}
+		}
+	}
+	// full extraction (decode only; no output writes)
+	for (unsigned int pass=0; pass<2; ++pass) {
+		unsigned int n=(pass==0) ? 1 : threads;
+		samples.clear();
+		for (unsigned int i=0; i<iterations; ++i) {
+			ExtractTask task(pak, n);
+			t=Stats::now();
+			parallelFor(entries.size(), n, task);
+			samples.push_back((double)total/((double)(Stats::now()-t)/1e9)/1e6);
+		}
+		std::sort(samples.begin(), samples.end());
+		add_result(results, (pass==0) ? "extract" : "extract_parallel", samples[samples.size()/2], "MB/s");
+	}
+	// whole entries into pooled buffers (single thread)
+	samples.clear();
+	for (unsigned int i=0; i<iterations; ++i) {
+		BlockDecoder decoder;
+		PooledBuffer buf;
+		t=Stats::now();
+		for (size_t k=0; k<entries.size(); ++k) {
+			entries[k].readToBuffer(pak.getStream(), pak, buf, &decoder);
+		}
+		samples.push_back((double)total/((double)(Stats::now()-t)/1e9)/1e6);
+	}
+	add_result(results, "read_to_buffer", median(samples), "MB/s");
+	// the same through O_DIRECT windows; every iteration reads from the device
+	DirectBlockSource direct;
+	if (direct.open(pak.getPath())) {
+		samples.clear();
+		for (unsigned int i=0; i<iterations; ++i) {
+			BlockDecoder decoder;
+			PooledBuffer buf;
+			t=Stats::now();
+			for (size_t k=0; k<entries.size(); ++k) {
+				entries[k].readToBuffer(direct, pak, buf, decoder);
+			}
+			samples.push_back((double)total/((double)(Stats::now()-t)/1e9)/1e6);
+		}
+		add_result(results, "direct_read", median(samples), "MB/s");
+		direct.close();
+	}
+	// whole entries through the zstd sidecar, if the archive has one (single thread)
+	ZstdSidecar sidecar;
+	if (sidecar.open(pak)) {
+		samples.clear();
+		for (unsigned int i=0; i<iterations; ++i) {
+			SidecarDecoder decoder;
+			PooledBuffer buf;
+			t=Stats::now();
+			for (size_t k=0; k<entries.size(); ++k) {
+				if (sidecar.covers(entries[k])) {
+					sidecar.readToBuffer(entries[k], buf, &decoder);
+				}
+			}
+			samples.push_back((double)total/((double)(Stats::now()-t)/1e9)/1e6);
+		}
+		add_result(results, "sidecar_read", median(samples), "MB/s");
+		sidecar.close();
+	}
+#if defined(PK2UNPACK_ASYNC)
+	// all entries outstanding at once, multiplexed over the executors
+	samples.clear();
+	for (unsigned int i=0; i<iterations; ++i) {
+		ThreadPoolExecutor io(2), cpu(threads);
+		AsyncArchive archive(pak, io, cpu);
+		if (!archive.open()) {
+			return false;
+		}
+		t=Stats::now();
+		syncWait(async_read_all(archive, entries));
+		samples.push_back((double)total/((double)(Stats::now()-t)/1e9)/1e6);
+	}
+	add_result(results, "async_read", median(samples), "MB/s");
+#endif
+	// random range reads (up to 4 KiB anywhere in a random non-empty entry)
+	std::vector<size_t> nonempty;
+	for (size_t i=0; i<entries.size(); ++i) {
+		if (entries[i].getSize()>0) {
+			nonempty.push_back(i);
+		}
+	}
+	if (!nonempty.empty()) {
+		const unsigned int reads=1000;
+		char buf[0x1000];
+		BlockDecoder decoder;
+		samples.clear();
+		for (unsigned int i=0; i<iterations; ++i) {
+			t=Stats::now();
+			for (unsigned int k=0; k<reads; ++k) {
+				const Entry& e=entries[nonempty[bench_rand()%nonempty.size()]];
+				uint64_t offset=bench_rand()%e.getSize();
+				uint64_t size=1+bench_rand()%sizeof(buf);
+				if (size>e.getSize()-offset) {
+					size=e.getSize()-offset;
+				}
+				e.readRange(pak.getStream(), pak, offset, size, buf, &decoder);
+			}
+			samples.push_back((double)(Stats::now()-t)/reads/1e3);
+		}
+		add_result(results, "range_read", median(samples), "us");
+	}
+	pak.close();
+	return true;
+}
+
+static bool save_results(const char* path, const BenchResultVec& results) {
+	FILE* f=fopen(path, "w");
+	if (!f) {
+		printf("ERROR: Failed to open %s for writing\n", path);
+		return false;
+	}
+	for (size_t i=0; i<results.size(); ++i) {
+		fprintf(f, "%s\t%.6f\t%s\n", results[i].name.c_str(), results[i].value, results[i].unit);
+	}
+	fclose(f);
+	return true;
+}
+
+static bool compare_results(const char* path, const BenchResultVec& results) {
+	FILE* f=fopen(path, "r");
+	if (!f) {
+		printf("ERROR: Failed to open %s\n", path);
+		return false;
+	}
+	std::map<std::string, double> base;
+	char name[128], unit[16];
+	double value;
+	while (fscanf(f, "%127s %lf %15s", name, &value, unit)==3) {
+		base[name]=value;
+	}
+	fclose(f);
+	printf("\ncompared to %s:\n", path);
+	for (size_t i=0; i<results.size(); ++i) {
+		std::map<std::string, double>::const_iterator it=base.find(results[i].name);
+		if (it==base.end() || it->second==0.0) {
+			continue;
+		}
+		// MB/s is higher-is-better, times are lower-is-better
+		double change=(results[i].value-it->second)/it->second*100.0;
+		bool better=(strcmp(results[i].unit, "MB/s")==0) ? change>0.0 : change<0.0;
+		printf("%-20s %14.3f -> %14.3f %s (%+.1f%%, %s)\n", results[i].name.c_str(), it->second, results[i].value, results[i].unit, change, (better) ? "better" : "worse");
+	}
+	return true;
+}
+
+static void usage() {
+	printf("usage: pk2bench [--iterations=N] [--threads=N] [--output=results.tsv] [--compare=baseline.tsv] <archive.sdpk2> [archive.sdmd2]\n");
+}
+
+int main(int argc, char** argv) {
+	unsigned int iterations=5, threads=0;
+	const char* output=NULL;
+	const char* compare=NULL;
+	const char* pk2_path=NULL;
+	const char* md2_path=NULL;
+	for (int i=1; i<argc; ++i) {
+		const char* arg=argv[i];
+		if (strncmp(arg, "--iterations=", 13)==0) {
+			iterations=strtoul(arg+13, NULL, 10);
+		} else if (strncmp(arg, "--threads=", 10)==0) {
+			threads=strtoul(arg+10, NULL, 10);
+		} else if (strncmp(arg, "--output=", 9)==0) {
+			output=arg+9;
+		} else if (strncmp(arg, "--compare=", 10)==0) {
+			compare=arg+10;
+		} else if (arg[0]!='-' && !pk2_path) {
+			pk2_path=arg;
+		} else if (arg[0]!='-' && !md2_path) {
+			md2_path=arg;
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if (!pk2_path || iterations==0) {
+		usage();
+		return 1;
+	}
+	if (threads==0) {
+		threads=getHardwareThreads();
+	}
+	BenchResultVec results;
+	if (!run_benchmarks(pk2_path, md2_path, iterations, threads, results)) {
+		return 1;
+	}
+	if (output && !save_results(output, results)) {
+		return 1;
+	}
+	if (compare && !compare_results(compare, results)) {
+		return 1;
+	}
+	return 0;
+}
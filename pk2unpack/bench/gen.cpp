@@ -0,0 +1,280 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+// pk2gen: writes a synthetic SDPK2/SDMD2 pair laid out per formats/sdpk2 and formats/sdmd2
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <duct/filestream.hpp>
+#include <duct/endianstream.hpp>
+#include "sdpk2.hpp"
+#include "md5.hpp"
+
+using namespace PK2Unpack;
+
+// xorshift64*; fixed so archives are reproducible across platforms
+class Random {
+public:
+	Random(uint64_t seed) : _state((seed) ? seed : 0x9E3779B97F4A7C15ull) {
+	};
+	uint64_t next() {
+		_state^=_state>>12;
+		_state^=_state<<25;
+		_state^=_state>>27;
+		return _state*0x2545F4914F6CDD1Dull;
+	};
+	// [0, range)
+	uint64_t below(uint64_t range) {
+		return (range==0) ? 0 : next()%range;
+	};
+	double unit() {
+		return (double)(next()>>11)/9007199254740992.0;
+	};
+	
+protected:
+	uint64_t _state;
+};
+
+struct GenOptions {
+	size_t entries;
+	uint64_t seed;
+	uint64_t min_size, max_size;
+	bool log_sizes;
+	double stored;
+	unsigned int dirs;
+	int level;
+};
+
+struct GenEntry {
+	MD5Hash hash;
+	uint64_t size;
+	bool stored;
+	unsigned int dir;
+};
+
+static const char* __words[]={
+	"shader", "texture", "material", "model", "sound", "script", "config", "bind",
+	"player", "weapon", "ammo", "map", "objective", "team", "spawn", "vehicle",
+	"{", "}", "=", ";", "\n", "\t", "0", "1", "0.5", "true", "false", "//"
+};
+#define __word_count (sizeof(__words)/sizeof(__words[0]))
+
+static void fill_data(Random& rng, char* buf, uint64_t size, bool stored) {
+	if (stored) {
+		// incompressible
+		uint64_t i=0;
+		for (; i+8<=size; i+=8) {
+			uint64_t v=rng.next();
+			memcpy(buf+i, &v, 8);
+		}
+		for (; i<size; ++i) {
+			buf[i]=(char)rng.next();
+		}
+	} else {
+		uint64_t i=0;
+		while (i<size) {
+			const char* w=__words[rng.below(__word_count)];
+			size_t len=strlen(w);
+			if (len>size-i) {
+				len=size-i;
+			}
+			memcpy(buf+i, w, len);
+			i+=len;
+			if (i<size) {
+				buf[i++]=' ';
+			}
+		}
+	}
+}
+
+static uint64_t pick_size(Random& rng, const GenOptions& opt) {
+	if (opt.max_size<=opt.min_size) {
+		return opt.min_size;
+	}
+	if (opt.log_sizes) {
+		double lo=log((double)opt.min_size+1.0), hi=log((double)opt.max_size+1.0);
+		uint64_t size=(uint64_t)exp(lo+(hi-lo)*rng.unit())-1;
+		return (size>opt.max_size) ? opt.max_size : size;
+	}
+	return opt.min_size+rng.below(opt.max_size-opt.min_size+1);
+}
+
+static bool write_sdpk2(const char* path, const GenOptions& opt, Random& rng, const std::vector<GenEntry>& gen) {
+	const size_t block_size=0x10000;
+	SDPK2 pak(path);
+	pak.setBlockSize(block_size);
+	pak.setCompressionMethod(COMPMETHOD_ZLIB);
+	EntryVec& entries=pak.getEntries();
+	BlockSizeTable& table=pak.getBlockSizeTable();
+	uint64_t max_size=0, blocks=0;
+	for (size_t i=0; i<gen.size(); ++i) {
+		entries.push_back(Entry(gen[i].hash, 0, gen[i].size, 0));
+		blocks+=(gen[i].size+block_size-1)/block_size;
+		max_size=(gen[i].size>max_size) ? gen[i].size : max_size;
+	}
+	// header size is known up front; reserve it, write the data, then write the header
+	table.resize(blocks, 0);
+	uint64_t offset=pak.getHeaderSize();
+	table.clear();
+	Stream* s=FileStream::writeFile(path);
+	if (!s) {
+		printf("ERROR: Failed to open %s for writing\n", path);
+		return false;
+	}
+	EndianStream es(s, false, DUCT_BIG_ENDIAN);
+	es.seek(offset);
+	char* buf=(char*)malloc((max_size>0) ? max_size : 1);
+	BlockEncoder encoder(opt.level);
+	bool ok=true;
+	uint64_t c_size;
+	for (size_t i=0; i<gen.size() && ok; ++i) {
+		fill_data(rng, buf, gen[i].size, gen[i].stored);
+		entries[i].setBlockSizeIndex(table.size());
+		entries[i].setOffset(offset);
+		ok=encoder.writeBlocks(&es, buf, gen[i].size, block_size, table, &c_size)==READERR_NONE;
+		offset+=c_size;
+	}
+	free(buf);
+	if (ok) {
+		es.seek(0);
+		pak.serializeInfo(&es);
+	} else {
+		printf("ERROR: Failed to write %s\n", path);
+	}
+	es.close();
+	s->close();
+	delete s;
+	return ok;
+}
+
+static void write_cstring(Stream* s, const std::string& str) {
+	s->write(str.c_str(), str.size()+1);
+}
+
+static bool write_sdmd2(const char* path, const GenOptions& opt, const std::vector<GenEntry>& gen) {
+	Stream* s=FileStream::writeFile(path);
+	if (!s) {
+		printf("ERROR: Failed to open %s for writing\n", path);
+		return false;
+	}
+	EndianStream es(s, false, DUCT_BIG_ENDIAN);
+	// names: directories first, then one name per file
+	std::vector<std::string> names;
+	char name[64];
+	for (unsigned int i=0; i<opt.dirs; ++i) {
+		snprintf(name, sizeof(name), "/gen/d%03u", i);
+		names.push_back(name);
+	}
+	for (size_t i=0; i<gen.size(); ++i) {
+		snprintf(name, sizeof(name), "f%07lu.bin", (unsigned long)i);
+		names.push_back(name);
+	}
+	uint32_t name_count=names.size();
+	// ids1 holds the first 1024 name indices, ids2 the rest
+	uint32_t count1=1024, count2=(name_count>count1) ? name_count-count1 : 0;
+	es.writeUInt32(count1);
+	es.writeUInt8(1);
+	for (uint32_t i=0; i<count1; ++i) {
+		es.writeInt32((i<name_count) ? (int32_t)i : -1);
+	}
+	es.writeUInt32(count2);
+	es.writeUInt8(1);
+	for (uint32_t i=0; i<count2; ++i) {
+		es.writeInt32(count1+i);
+	}
+	es.writeInt32(1024);
+	es.writeInt32(1023);
+	es.writeUInt32(name_count);
+	uint32_t pos=0;
+	for (uint32_t i=0; i<name_count; ++i) {
+		es.writeUInt32(pos);
+		pos+=names[i].size()+1;
+	}
+	es.writeUInt32(pos);
+	for (uint32_t i=0; i<name_count; ++i) {
+		write_cstring(&es, names[i]);
+	}
+	es.writeUInt32(gen.size());
+	for (size_t i=0; i<gen.size(); ++i) {
+		es.writeUInt32(gen[i].dir);
+		es.writeUInt32(opt.dirs+i);
+		es.writeInt32(i); // _i1
+		es.writeInt32(0); // _i2
+		es.writeUInt32(1300000000+i); // time_modified
+	}
+	es.close();
+	s->close();
+	delete s;
+	return true;
+}
+
+static void usage() {
+	printf("usage: pk2gen [--entries=N] [--seed=N] [--min-size=N] [--max-size=N] [--sizes=uniform|log]\n"
+		"\t[--stored=RATIO] [--dirs=N] [--level=N] <output prefix>\n"
+		"writes <prefix>.sdpk2 and <prefix>.sdmd2\n");
+}
+
+int main(int argc, char** argv) {
+	GenOptions opt={1000, 1, 0, 0x40000, true, 0.25, 16, Z_DEFAULT_COMPRESSION};
+	const char* prefix=NULL;
+	for (int i=1; i<argc; ++i) {
+		const char* arg=argv[i];
+		if (strncmp(arg, "--entries=", 10)==0) {
+			opt.entries=strtoul(arg+10, NULL, 10);
+		} else if (strncmp(arg, "--seed=", 7)==0) {
+			opt.seed=strtoull(arg+7, NULL, 10);
+		} else if (strncmp(arg, "--min-size=", 11)==0) {
+			opt.min_size=strtoull(arg+11, NULL, 10);
+		} else if (strncmp(arg, "--max-size=", 11)==0) {
+			opt.max_size=strtoull(arg+11, NULL, 10);
+		} else if (strcmp(arg, "--sizes=uniform")==0) {
+			opt.log_sizes=false;
+		} else if (strcmp(arg, "--sizes=log")==0) {
+			opt.log_sizes=true;
+		} else if (strncmp(arg, "--stored=", 9)==0) {
+			opt.stored=atof(arg+9);
+		} else if (strncmp(arg, "--dirs=", 7)==0) {
+			opt.dirs=strtoul(arg+7, NULL, 10);
+		} else if (strncmp(arg, "--level=", 8)==0) {
+			opt.level=atoi(arg+8);
+		} else if (arg[0]!='-' && !prefix) {
+			prefix=arg;
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if (!prefix || opt.dirs==0) {
+		usage();
+		return 1;
+	}
+	Random rng(opt.seed);
+	std::vector<GenEntry> gen(opt.entries);
+	char name[64];
+	for (size_t i=0; i<gen.size(); ++i) {
+		gen[i].size=pick_size(rng, opt);
+		gen[i].stored=rng.unit()<opt.stored;
+		gen[i].dir=rng.below(opt.dirs);
+		// the entry hash is the MD5 of the path write_sdmd2() gives the file
+		int len=snprintf(name, sizeof(name), "/gen/d%03u/f%07lu.bin", gen[i].dir, (unsigned long)i);
+		MD5::compute(name, len, gen[i].hash);
+	}
+	std::string path(prefix);
+	path.append(".sdpk2");
+	if (!write_sdpk2(path.c_str(), opt, rng, gen)) {
+		return 1;
+	}
+	path.assign(prefix);
+	path.append(".sdmd2");
+	if (!write_sdmd2(path.c_str(), opt, gen)) {
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,43 @@
+#!/bin/bash
+# Generates the standard synthetic archives (fixed seeds) and benchmarks them.
+# usage: bench/run.sh [results-name] [baseline-name]
+# Results are saved to bench/results/<results-name>.tsv (default: current git revision).
+
+cd "$(dirname "$0")/.."
+GEN="out/pk2gen"
+BENCH="out/pk2bench"
+if [ ! -x "$GEN" ] || [ ! -x "$BENCH" ]; then
+	echo "build first (./build.sh release)"
+	exit 1
+fi
+
+NAME="$1"
+if [ "$NAME" == "" ]; then
+	NAME=$(git rev-parse --short HEAD)
+fi
+BASELINE="$2"
+
+mkdir -p bench/out bench/results
+
+# name:generator options
+SETS=(
+	"small:--entries=20000 --seed=1 --min-size=0 --max-size=16384 --stored=0.1"
+	"mixed:--entries=4000 --seed=2 --min-size=0 --max-size=1048576 --stored=0.25"
+	"large:--entries=64 --seed=3 --min-size=4194304 --max-size=33554432 --sizes=uniform --stored=0.5"
+)
+
+for set in "${SETS[@]}"; do
+	sname="${set%%:*}"
+	opts="${set#*:}"
+	prefix="bench/out/$sname"
+	if [ ! -f "$prefix.sdpk2" ]; then
+		$GEN $opts "$prefix" || exit 1
+	fi
+	out="bench/results/$NAME-$sname.tsv"
+	args=("--output=$out")
+	if [ "$BASELINE" != "" ] && [ -f "bench/results/$BASELINE-$sname.tsv" ]; then
+		args+=("--compare=bench/results/$BASELINE-$sname.tsv")
+	fi
+	echo "== $sname"
+	$BENCH "${args[@]}" "$prefix.sdpk2" "$prefix.sdmd2" || exit 1
+done
@@ -0,0 +1,69 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_ANALYZE_HPP_
+#define _PK2UNPACK_ANALYZE_HPP_
+
+#include <stdio.h>
+#include <vector>
+#include "sdpk2.hpp"
+
+namespace PK2Unpack {
+
+// compressed size and block kinds of one entry
+struct EntryAnalysis {
+	uint64_t c_size;
+	uint32_t stored;
+	uint32_t deflated;
+};
+
+typedef std::vector<EntryAnalysis> EntryAnalysisVec;
+
+#define ANALYSIS_SIZE_BUCKETS 41
+#define ANALYSIS_BLOCK_BUCKETS 16
+#define ANALYSIS_RATIO_BUCKETS 11
+
+/**
+	Archive space statistics computed from the header alone (entries and comp_block_sizes).
+	No entry data is read or decompressed.
+*/
+class ArchiveAnalysis {
+public:
+	ArchiveAnalysis() {
+		clear();
+	};
+	void clear();
+	/**
+		Compute the statistics for an archive.
+		@returns Nothing.
+		@param pak The archive; only the deserialized header is used.
+	*/
+	void analyze(const SDPK2& pak);
+	const EntryAnalysisVec& getEntries() const {
+		return _entries;
+	};
+	void printText(FILE* out) const;
+	// includes a per-entry list
+	void printJSON(FILE* out, const SDPK2& pak) const;
+	
+protected:
+	EntryAnalysisVec _entries;
+	uint64_t _uc_total, _c_total;
+	uint64_t _stored_blocks, _deflated_blocks;
+	uint64_t _stored_bytes, _table_size, _table_unused;
+	uint64_t _empty_entries, _bad_entries;
+	size_t _block_size;
+	// entry uncompressed size, by floor(log2(size))+1 (0 is empty)
+	uint64_t _size_hist[ANALYSIS_SIZE_BUCKETS];
+	// deflated block compressed size, by block_size/ANALYSIS_BLOCK_BUCKETS steps
+	uint64_t _block_hist[ANALYSIS_BLOCK_BUCKETS];
+	// entry compressed/uncompressed ratio, in 10% steps
+	uint64_t _ratio_hist[ANALYSIS_RATIO_BUCKETS];
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_ANALYZE_HPP_
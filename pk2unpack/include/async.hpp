@@ -0,0 +1,297 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_ASYNC_HPP_
+#define _PK2UNPACK_ASYNC_HPP_
+
+// built with "premake4 --async gmake", which compiles as C++20 and defines PK2UNPACK_ASYNC
+#if defined(PK2UNPACK_ASYNC)
+
+#if !defined(__cpp_impl_coroutine)
+#error "PK2UNPACK_ASYNC requires C++20 coroutines (-std=c++20)"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "sdpk2.hpp"
+#include "bufferpool.hpp"
+
+namespace PK2Unpack {
+
+/**
+	Lazily started coroutine returning T.
+	The body runs when the task is awaited; the awaiter resumes when it finishes.
+*/
+template<typename T>
+class AsyncTask {
+public:
+	struct promise_type {
+		std::optional<T> value;
+		std::coroutine_handle<> continuation;
+
+		AsyncTask get_return_object() {
+			return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this));
+		};
+		std::suspend_always initial_suspend() noexcept {
+			return {};
+		};
+		struct FinalAwaiter {
+			bool await_ready() noexcept {
+				return false;
+			};
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+				std::coroutine_handle<> next=h.promise().continuation;
+				return (next) ? next : std::noop_coroutine();
+			};
+			void await_resume() noexcept {
+			};
+		};
+		FinalAwaiter final_suspend() noexcept {
+			return {};
+		};
+		void return_value(T v) {
+			value.emplace(std::move(v));
+		};
+		void unhandled_exception() {
+			std::terminate();
+		};
+	};
+
+	AsyncTask(AsyncTask&& other) : _handle(other._handle) {
+		other._handle=nullptr;
+	};
+	~AsyncTask() {
+		if (_handle) {
+			_handle.destroy();
+		}
+	};
+	bool await_ready() const {
+		return false;
+	};
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+		_handle.promise().continuation=awaiter;
+		return _handle;
+	};
+	T await_resume() {
+		return std::move(*_handle.promise().value);
+	};
+
+protected:
+	std::coroutine_handle<promise_type> _handle;
+
+	explicit AsyncTask(std::coroutine_handle<promise_type> handle) : _handle(handle) {
+	};
+	AsyncTask(const AsyncTask&);
+	AsyncTask& operator=(const AsyncTask&);
+};
+
+// eagerly started coroutine which frees itself when done; see spawn()
+struct DetachedTask {
+	struct promise_type {
+		DetachedTask get_return_object() {
+			return {};
+		};
+		std::suspend_never initial_suspend() noexcept {
+			return {};
+		};
+		std::suspend_never final_suspend() noexcept {
+			return {};
+		};
+		void return_void() {
+		};
+		void unhandled_exception() {
+			std::terminate();
+		};
+	};
+};
+
+/**
+	Runs resumed coroutines.
+	post() may be called from any thread.
+*/
+class Executor {
+public:
+	virtual ~Executor() {
+	};
+	virtual void post(std::coroutine_handle<> handle)=0;
+
+	struct ScheduleAwaiter {
+		Executor& executor;
+		bool await_ready() const {
+			return false;
+		};
+		void await_suspend(std::coroutine_handle<> handle) {
+			executor.post(handle);
+		};
+		void await_resume() const {
+		};
+	};
+	// co_await executor.schedule() continues the coroutine on the executor
+	ScheduleAwaiter schedule() {
+		return ScheduleAwaiter{*this};
+	};
+};
+
+// fixed set of worker threads sharing one queue
+class ThreadPoolExecutor : public Executor {
+public:
+	// threads=0 means getHardwareThreads()
+	ThreadPoolExecutor(unsigned int threads=0);
+	// finishes the queued work, then joins the threads
+	~ThreadPoolExecutor();
+	void post(std::coroutine_handle<> handle);
+	unsigned int getThreadCount() const {
+		return _threads.size();
+	};
+
+protected:
+	pthread_mutex_t _lock;
+	pthread_cond_t _wake;
+	std::deque<std::coroutine_handle<> > _queue;
+	std::vector<pthread_t> _threads;
+	bool _stop;
+
+	static void* worker(void* arg);
+
+	ThreadPoolExecutor(const ThreadPoolExecutor&);
+	ThreadPoolExecutor& operator=(const ThreadPoolExecutor&);
+};
+
+/**
+	Adapter for an external event loop.
+	post() queues the coroutine and calls wake (from any thread); the loop then calls
+	runPending() on its own thread. For example, wake can write to an eventfd or call uv_async_send().
+*/
+class EventLoopExecutor : public Executor {
+public:
+	typedef void (*WakeFunc)(void* data);
+	EventLoopExecutor(WakeFunc wake, void* data);
+	~EventLoopExecutor();
+	void post(std::coroutine_handle<> handle);
+	// resume the queued coroutines; returns the number resumed
+	size_t runPending();
+
+protected:
+	WakeFunc _wake;
+	void* _data;
+	pthread_mutex_t _lock;
+	std::vector<std::coroutine_handle<> > _queue;
+
+	EventLoopExecutor(const EventLoopExecutor&);
+	EventLoopExecutor& operator=(const EventLoopExecutor&);
+};
+
+// result of an AsyncArchive read
+struct AsyncResult {
+	// ReadError
+	int err;
+	PooledBuffer data;
+};
+
+/**
+	Asynchronous reads from an open SDPK2.
+	Each read reads the compressed data on the I/O executor, inflates it on the CPU executor
+	and resumes the awaiter on the completion executor (or the CPU thread if there is none).
+	Reads are independent, so many can be outstanding over a few threads.
+	The archive's entries must not change while reads are outstanding.
+*/
+class AsyncArchive {
+public:
+	AsyncArchive(const SDPK2& pak, Executor& io, Executor& cpu, Executor* completion=NULL);
+	~AsyncArchive();
+	// open the archive file for reading (separately from pak's stream)
+	bool open();
+	void close();
+	// READERR_NOTFOUND in err and no data if the hash is not in the archive
+	AsyncTask<AsyncResult> readEntry(const MD5Hash& hash);
+	AsyncTask<AsyncResult> readEntry(const Entry& entry);
+	// read size bytes at offset (uncompressed) of an entry
+	AsyncTask<AsyncResult> readRange(const Entry& entry, uint64_t offset, uint64_t size);
+	const Entry* findEntry(const MD5Hash& hash) const;
+
+protected:
+	const SDPK2& _pak;
+	Executor& _io;
+	Executor& _cpu;
+	Executor* _completion;
+	int _fd;
+	// entries sorted by hash
+	std::vector<const Entry*> _index;
+
+	bool readCompressed(uint64_t offset, uint64_t size, PooledBuffer& out) const;
+
+	AsyncArchive(const AsyncArchive&);
+	AsyncArchive& operator=(const AsyncArchive&);
+};
+
+template<typename T>
+DetachedTask __spawn(AsyncTask<T> task) {
+	co_await task;
+}
+
+// start a task without waiting for it; the result is discarded
+template<typename T>
+void spawn(AsyncTask<T>&& task) {
+	__spawn(std::move(task));
+}
+
+// one-shot event for syncWait
+class SyncLatch {
+public:
+	SyncLatch() : _set(false) {
+		pthread_mutex_init(&_lock, NULL);
+		pthread_cond_init(&_cond, NULL);
+	};
+	~SyncLatch() {
+		pthread_cond_destroy(&_cond);
+		pthread_mutex_destroy(&_lock);
+	};
+	void set() {
+		pthread_mutex_lock(&_lock);
+		_set=true;
+		pthread_cond_broadcast(&_cond);
+		pthread_mutex_unlock(&_lock);
+	};
+	void wait() {
+		pthread_mutex_lock(&_lock);
+		while (!_set) {
+			pthread_cond_wait(&_cond, &_lock);
+		}
+		pthread_mutex_unlock(&_lock);
+	};
+
+protected:
+	pthread_mutex_t _lock;
+	pthread_cond_t _cond;
+	bool _set;
+};
+
+template<typename T>
+DetachedTask __sync_run(AsyncTask<T>& task, std::optional<T>& out, SyncLatch& latch) {
+	out.emplace(co_await task);
+	latch.set();
+}
+
+// block the calling thread until task finishes (not from an executor thread the task needs)
+template<typename T>
+T syncWait(AsyncTask<T> task) {
+	std::optional<T> out;
+	SyncLatch latch;
+	__sync_run(task, out, latch);
+	latch.wait();
+	return std::move(*out);
+}
+
+} // namespace PK2Unpack
+
+#endif // defined(PK2UNPACK_ASYNC)
+
+#endif // _PK2UNPACK_ASYNC_HPP_
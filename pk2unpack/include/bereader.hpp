@@ -0,0 +1,85 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_BEREADER_HPP_
+#define _PK2UNPACK_BEREADER_HPP_
+
+#include <stddef.h>
+#include "byteorder.hpp"
+
+namespace PK2Unpack {
+
+/*
+	Non-virtual big-endian reader over a byte span.
+	Reads past the end fail (returning 0/NULL) and set a sticky error, so parsers
+	can check good() once at the end. Use require() to hoist the bounds check
+	out of a loop and the unchecked reads inside it.
+*/
+class BEReader {
+public:
+	BEReader(const void* data, size_t size) : _begin((const unsigned char*)data), _p(_begin), _end(_begin+size), _good(true) {
+	};
+	bool good() const {
+		return _good;
+	};
+	size_t pos() const {
+		return _p-_begin;
+	};
+	size_t remaining() const {
+		return _end-_p;
+	};
+	// true if size more bytes are available; otherwise sets the error
+	bool require(size_t size) {
+		if ((size_t)(_end-_p)<size) {
+			_good=false;
+			_p=_end;
+			return false;
+		}
+		return true;
+	};
+	template<typename T>
+	T read() {
+		return (require(sizeof(T))) ? readUnchecked<T>() : T();
+	};
+	template<typename T>
+	T readUnchecked() {
+		T v=loadBE<T>(_p);
+		_p+=sizeof(T);
+		return v;
+	};
+	// read count elements into out, byte-swapped in bulk
+	template<typename T>
+	bool readArray(T* out, size_t count) {
+		if (count>((size_t)-1)/sizeof(T) || !require(count*sizeof(T))) {
+			return false;
+		}
+		loadArrayBE<T>(out, _p, count);
+		_p+=count*sizeof(T);
+		return true;
+	};
+	// returns a pointer to the next size bytes, or NULL
+	const unsigned char* readBytes(size_t size) {
+		return (require(size)) ? readBytesUnchecked(size) : NULL;
+	};
+	const unsigned char* readBytesUnchecked(size_t size) {
+		const unsigned char* p=_p;
+		_p+=size;
+		return p;
+	};
+	bool skip(size_t size) {
+		return readBytes(size)!=NULL;
+	};
+	
+protected:
+	const unsigned char* _begin;
+	const unsigned char* _p;
+	const unsigned char* _end;
+	bool _good;
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_BEREADER_HPP_
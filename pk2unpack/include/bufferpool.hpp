@@ -0,0 +1,116 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_BUFFERPOOL_HPP_
+#define _PK2UNPACK_BUFFERPOOL_HPP_
+
+#include <stddef.h>
+#include <pthread.h>
+#include <vector>
+
+namespace PK2Unpack {
+
+// smallest and largest pooled size classes (powers of two); larger buffers are not pooled
+#define BUFFERPOOL_MIN_CLASS 6
+#define BUFFERPOOL_MAX_CLASS 26
+#define BUFFERPOOL_CLASSES (BUFFERPOOL_MAX_CLASS-BUFFERPOOL_MIN_CLASS+1)
+
+/**
+	Thread-safe pool of power-of-two sized buffers.
+	Released buffers are kept for reuse up to a total cached size.
+*/
+class BufferPool {
+public:
+	/**
+		Constructor.
+		@param max_cached The most bytes kept in released buffers.
+	*/
+	BufferPool(size_t max_cached=0x4000000);
+	~BufferPool();
+	/**
+		Get a buffer of at least size bytes.
+		@returns The buffer (NULL if allocation failed).
+		@param size The required size.
+		@param capacity Receives the buffer's actual size, which must be passed to release().
+	*/
+	char* acquire(size_t size, size_t& capacity);
+	// return a buffer from acquire()
+	void release(char* buf, size_t capacity);
+	// free all cached buffers
+	void trim();
+	size_t getCachedSize() const {
+		return _cached;
+	};
+	// the pool used by default
+	static BufferPool& global();
+	
+protected:
+	pthread_mutex_t _lock;
+	size_t _max_cached, _cached;
+	std::vector<char*> _free[BUFFERPOOL_CLASSES];
+	
+	BufferPool(const BufferPool&);
+	BufferPool& operator=(const BufferPool&);
+};
+
+/**
+	Owned buffer from a BufferPool; returned to the pool when destroyed or reset.
+	Movable, not copyable.
+*/
+class PooledBuffer {
+public:
+	PooledBuffer() : _pool(NULL), _data(NULL), _size(0), _capacity(0) {
+	};
+	PooledBuffer(PooledBuffer&& other) : _pool(other._pool), _data(other._data), _size(other._size), _capacity(other._capacity) {
+		other._pool=NULL;
+		other._data=NULL;
+		other._size=other._capacity=0;
+	};
+	PooledBuffer& operator=(PooledBuffer&& other) {
+		if (this!=&other) {
+			reset();
+			_pool=other._pool;
+			_data=other._data;
+			_size=other._size;
+			_capacity=other._capacity;
+			other._pool=NULL;
+			other._data=NULL;
+			other._size=other._capacity=0;
+		}
+		return *this;
+	};
+	~PooledBuffer() {
+		reset();
+	};
+	/**
+		Replace the buffer with one of exactly size bytes (contents undefined).
+		@returns false if allocation failed.
+	*/
+	bool allocate(size_t size, BufferPool& pool=BufferPool::global());
+	// return the buffer to its pool
+	void reset();
+	char* data() {
+		return _data;
+	};
+	const char* data() const {
+		return _data;
+	};
+	size_t size() const {
+		return _size;
+	};
+	
+protected:
+	BufferPool* _pool;
+	char* _data;
+	size_t _size, _capacity;
+	
+	PooledBuffer(const PooledBuffer&);
+	PooledBuffer& operator=(const PooledBuffer&);
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_BUFFERPOOL_HPP_
@@ -0,0 +1,98 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_BYTEORDER_HPP_
+#define _PK2UNPACK_BYTEORDER_HPP_
+
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace PK2Unpack {
+
+// unsigned integer of a given byte size, with its byte swap
+template<size_t N> struct ByteOrderUInt;
+template<> struct ByteOrderUInt<1> {
+	typedef uint8_t type;
+	static type swap(type v) {
+		return v;
+	};
+};
+template<> struct ByteOrderUInt<2> {
+	typedef uint16_t type;
+	static type swap(type v) {
+		return __builtin_bswap16(v);
+	};
+};
+template<> struct ByteOrderUInt<4> {
+	typedef uint32_t type;
+	static type swap(type v) {
+		return __builtin_bswap32(v);
+	};
+};
+template<> struct ByteOrderUInt<8> {
+	typedef uint64_t type;
+	static type swap(type v) {
+		return __builtin_bswap64(v);
+	};
+};
+
+/**
+	Load a big-endian value from an unaligned address.
+	Compiles to a load plus bswap on little-endian hosts.
+	@returns The value in host byte order.
+	@param p The address to load from.
+*/
+template<typename T>
+inline T loadBE(const void* p) {
+	typedef ByteOrderUInt<sizeof(T)> U;
+	typename U::type v;
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+	v=U::swap(v);
+#endif
+	T out;
+	memcpy(&out, &v, sizeof(out));
+	return out;
+}
+
+/**
+	Store a value to an unaligned address in big-endian byte order.
+	@returns Nothing.
+	@param p The address to store to.
+	@param value The value in host byte order.
+*/
+template<typename T>
+inline void storeBE(void* p, T value) {
+	typedef ByteOrderUInt<sizeof(T)> U;
+	typename U::type v;
+	memcpy(&v, &value, sizeof(v));
+#if __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+	v=U::swap(v);
+#endif
+	memcpy(p, &v, sizeof(v));
+}
+
+/**
+	Load count big-endian elements of size elem_size (1, 2, 4 or 8) from src to dst.
+	Uses SSSE3 shuffles when the processor supports them.
+	@returns Nothing.
+	@param dst The destination; may not overlap src.
+	@param src The source data.
+	@param count The number of elements.
+	@param elem_size The element size in bytes.
+*/
+void loadArrayBE(void* dst, const void* src, size_t count, size_t elem_size);
+
+// typed loadArrayBE
+template<typename T>
+inline void loadArrayBE(T* dst, const void* src, size_t count) {
+	loadArrayBE((void*)dst, src, count, sizeof(T));
+}
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_BYTEORDER_HPP_
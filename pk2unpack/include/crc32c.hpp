@@ -0,0 +1,61 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_CRC32C_HPP_
+#define _PK2UNPACK_CRC32C_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace PK2Unpack {
+
+/**
+	Incremental CRC32C (Castagnoli) digest.
+	Uses the SSE4.2 crc32 instruction when the CPU supports it, otherwise a slicing-by-8 table.
+*/
+class CRC32C {
+public:
+	CRC32C() : _value(0) {
+	};
+	/**
+		Reset the digest to its initial value.
+		@returns Nothing.
+	*/
+	void reset() {
+		_value=0;
+	};
+	/**
+		Get the digest of all data given so far.
+		@returns The current CRC32C value.
+	*/
+	uint32_t value() const {
+		return _value;
+	};
+	/**
+		Add data to the digest.
+		@returns Nothing.
+		@param data The data to add.
+		@param size Size of the data in bytes.
+	*/
+	void update(const void* data, size_t size) {
+		_value=compute(data, size, _value);
+	};
+	/**
+		Continue a CRC32C over the given data.
+		@returns The new CRC32C value.
+		@param data The data to add.
+		@param size Size of the data in bytes.
+		@param crc The previous CRC32C value (0 to start).
+	*/
+	static uint32_t compute(const void* data, size_t size, uint32_t crc=0);
+
+protected:
+	uint32_t _value;
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_CRC32C_HPP_
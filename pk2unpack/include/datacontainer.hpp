@@ -178,6 +178,7 @@ public:
 		Print the container's data with the given format.
 		@returns 0 if the entire format was printed and covered the entire container, -2 if nothing was printed (no data or no format), -1 if the format was partially printed (insufficient data to complete), or the size left (greater than 0) if the format was printed but did not cover the entire size of the container.
 		@param format The array of format elements. The last element must use FORMATTYPE_NULL.
+		@see StaticDataFormat for formats known at compile time.
 	*/
 	int print(const DataFormat* format) const;
 	
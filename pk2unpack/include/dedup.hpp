@@ -0,0 +1,83 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_DEDUP_HPP_
+#define _PK2UNPACK_DEDUP_HPP_
+
+#include <vector>
+#include "sdpk2.hpp"
+
+namespace PK2Unpack {
+
+// an entry of one of the archives in a DedupIndex
+struct DedupRef {
+	uint32_t archive;
+	uint32_t index;
+};
+
+/**
+	Finds entries with identical contents across a set of archives, without decompressing anything.
+	Entries are grouped by size and compressed size, fingerprinted with a CRC32C of their raw compressed
+	blocks and then confirmed by comparing the block tables and raw blocks byte for byte.
+	Archives with the same block size and compression method store identical data identically,
+	so a raw match means the decompressed contents match.
+*/
+class DedupIndex {
+public:
+	DedupIndex() : _duplicate_bytes(0) {
+	};
+	// the archive must stay open (and unchanged) while the index is used
+	void addArchive(const SDPK2& pak);
+	/**
+		Find the duplicate entries of all added archives.
+		@returns The number of duplicate entries.
+		@param threads Number of reading threads (0 means one per processor).
+	*/
+	size_t build(unsigned int threads);
+	size_t getEntryCount() const {
+		return _refs.size();
+	};
+	const DedupRef& getRef(size_t i) const {
+		return _refs[i];
+	};
+	const Entry& getEntry(size_t i) const {
+		return _paks[_refs[i].archive]->getEntries()[_refs[i].index];
+	};
+	// index of an identical entry to copy from (always a source itself), or -1
+	long getSource(size_t i) const {
+		return _source[i];
+	};
+	// uncompressed bytes of the duplicate entries
+	uint64_t getDuplicateBytes() const {
+		return _duplicate_bytes;
+	};
+
+protected:
+	std::vector<const SDPK2*> _paks;
+	std::vector<DedupRef> _refs;
+	std::vector<long> _source;
+	uint64_t _duplicate_bytes;
+};
+
+enum DedupLinkMode {
+	DEDUP_HARDLINK=0,
+	/* FICLONE; the copy shares extents with the source but is a separate file */
+	DEDUP_REFLINK
+};
+
+/**
+	Make dst a copy of src without writing the data.
+	The requested method is tried first, then the other one.
+	@returns false if neither method works (e.g. src and dst are on different filesystems, or no reflink support).
+	@param src Existing file.
+	@param dst New file; an existing file is replaced, unless it already is src.
+	@param mode DedupLinkMode.
+*/
+bool linkFile(const char* src, const char* dst, int mode);
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_DEDUP_HPP_
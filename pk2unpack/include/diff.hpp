@@ -0,0 +1,82 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_DIFF_HPP_
+#define _PK2UNPACK_DIFF_HPP_
+
+#include <stdio.h>
+#include <vector>
+#include "sdpk2.hpp"
+
+namespace PK2Unpack {
+
+enum DiffStatus {
+	DIFF_UNCHANGED=0,
+	DIFF_ADDED,
+	DIFF_REMOVED,
+	DIFF_CHANGED,
+	DIFF_STATUS_COUNT
+};
+
+struct EntryDiff {
+	// NULL for an added/removed entry
+	const Entry* old_entry;
+	const Entry* new_entry;
+	int status;
+	// indices of the blocks whose compressed data differ (DIFF_CHANGED)
+	std::vector<unsigned int> blocks;
+};
+
+typedef std::vector<EntryDiff> EntryDiffVec;
+
+/**
+	Entry and block differences between two versions of an archive, from their raw compressed data.
+	Entries are matched by hash. A matched pair is unchanged if the sizes, comp_block_sizes slices and
+	compressed bytes are equal; nothing is decompressed. Both archives must use the same block size and
+	compression method, so equal contents mean equal compressed blocks (unless an entry was recompressed,
+	which shows as changed).
+*/
+class ArchiveDiff {
+public:
+	ArchiveDiff() {
+		clear();
+	};
+	void clear();
+	/**
+		Compare two open archives.
+		@returns false if the archives cannot be compared (e.g. different block sizes).
+		@param old_pak The old archive.
+		@param new_pak The new archive.
+		@param threads Number of comparing threads (0 means one per processor).
+	*/
+	bool compare(const SDPK2& old_pak, const SDPK2& new_pak, unsigned int threads);
+	// in hash order
+	const EntryDiffVec& getEntries() const {
+		return _entries;
+	};
+	size_t getCount(int status) const {
+		return _counts[status];
+	};
+	bool hasChanges() const {
+		return _counts[DIFF_ADDED]+_counts[DIFF_REMOVED]+_counts[DIFF_CHANGED]>0;
+	};
+	/*
+		One line per difference, then a summary:
+		"A <hash> <size>", "D <hash> <size>",
+		"M <hash> <old size> <new size> <changed blocks>/<blocks> <block ranges, e.g. 0,4-6>"
+	*/
+	void printText(FILE* out) const;
+	
+protected:
+	EntryDiffVec _entries;
+	size_t _counts[DIFF_STATUS_COUNT];
+	uint64_t _changed_blocks;
+	size_t _block_size;
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_DIFF_HPP_
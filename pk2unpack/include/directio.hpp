@@ -0,0 +1,71 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_DIRECTIO_HPP_
+#define _PK2UNPACK_DIRECTIO_HPP_
+
+#include "sdpk2.hpp"
+
+namespace PK2Unpack {
+
+// offset, length and buffer alignment for O_DIRECT reads
+#define DIRECT_IO_ALIGN 0x1000
+// bytes per read; many 64 KiB blocks at a time
+#define DIRECT_IO_WINDOW 0x400000
+
+/**
+	Archive reads with O_DIRECT, which bypass (and do not evict) the page cache.
+	The file is read in aligned windows into an aligned buffer and blocks are decoded straight
+	from the window. A block which runs past the window refills it from the block's aligned-down
+	offset, so the unaligned ends of an entry's range only cost the rounding.
+	Where the filesystem refuses O_DIRECT, reads fall back to buffered I/O and drop the
+	cached pages again after each window.
+	Nothing is cached across sources, so sources reading neighbouring ranges should set a limit
+	(the end of their range) to keep windows from overlapping.
+*/
+class DirectBlockSource : public BlockSource {
+public:
+	DirectBlockSource(size_t window_size=DIRECT_IO_WINDOW);
+	~DirectBlockSource();
+	bool open(const char* path);
+	void close();
+	// false once reads fell back to buffered I/O
+	bool isDirect() const {
+		return _direct;
+	};
+	// windows stop at end (aligned up) unless a read needs more; 0 for none
+	void setLimit(uint64_t end) {
+		_limit=end;
+	};
+	void seek(uint64_t pos) {
+		_pos=pos;
+	};
+	uint64_t pos() {
+		return _pos;
+	};
+	const char* read(size_t size, char* buf);
+	
+protected:
+	int _fd;
+	bool _direct;
+	char* _window;
+	size_t _capacity;
+	// file range held by _window
+	uint64_t _window_pos;
+	size_t _window_size;
+	uint64_t _pos;
+	uint64_t _limit;
+	
+	// read the window holding [pos, pos+size) (or as much of it as fits)
+	bool fill(uint64_t pos, size_t size);
+	
+	DirectBlockSource(const DirectBlockSource&);
+	DirectBlockSource& operator=(const DirectBlockSource&);
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_DIRECTIO_HPP_
@@ -0,0 +1,119 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_FORMATWRITER_HPP_
+#define _PK2UNPACK_FORMATWRITER_HPP_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+namespace PK2Unpack {
+
+/**
+	Buffered text output.
+	Formats into a fixed buffer and writes it out in large chunks instead of one printf per field.
+*/
+class FormatWriter {
+public:
+	/**
+		Constructor.
+		@param out The file to write to.
+		@param capacity The buffer size; listings use a large buffer so output is written in few calls.
+	*/
+	FormatWriter(FILE* out, size_t capacity=0x1000);
+	/**
+		Destructor; flushes the buffer.
+	*/
+	~FormatWriter() {
+		flush();
+		free(_buf);
+	};
+	/**
+		Write the buffered text to the file.
+		@returns Nothing.
+	*/
+	void flush() {
+		if (_size>0) {
+			fwrite(_buf, 1, _size, _out);
+			_size=0;
+		}
+	};
+	void append(const char* str, size_t size) {
+		if (_size+size>_capacity) {
+			flush();
+			if (size>_capacity) {
+				fwrite(str, 1, size, _out);
+				return;
+			}
+		}
+		memcpy(_buf+_size, str, size);
+		_size+=size;
+	};
+	void append(const char* str) {
+		append(str, strlen(str));
+	};
+	void append(char c) {
+		if (_size==_capacity) {
+			flush();
+		}
+		_buf[_size++]=c;
+	};
+	/**
+		Append count copies of c.
+		@returns Nothing.
+	*/
+	void fill(char c, size_t count);
+	/**
+		Append an unsigned integer, right-aligned to width (like "%*u").
+		@returns Nothing.
+	*/
+	void appendUInt(uint64_t value, unsigned int width=0);
+	/**
+		Append a signed integer, right-aligned to width (like "%*d").
+		@returns Nothing.
+	*/
+	void appendInt(int64_t value, unsigned int width=0);
+	/**
+		Append a byte as two hexadecimal digits.
+		@returns Nothing.
+	*/
+	void appendHex(unsigned char value, bool lower=false) {
+		append(((lower) ? __hex_lower : __hex_upper)+value*2, 2);
+	};
+	/**
+		Append data as hexadecimal digits with no separators (e.g. an MD5 hash).
+		@returns Nothing.
+	*/
+	void appendHex(const unsigned char* data, size_t size, bool lower=false);
+	/**
+		Append a UTC time as ISO 8601 ("2012-05-09T13:45:00Z").
+		The date is cached, so runs of nearby times only format the time of day.
+		@returns Nothing.
+	*/
+	void appendTimeUTC(time_t value);
+	
+protected:
+	// two digits per byte value
+	static const char __hex_upper[513];
+	static const char __hex_lower[513];
+	
+	FILE* _out;
+	char* _buf;
+	size_t _size, _capacity;
+	// appendTimeUTC cache: day number and "YYYY-MM-DDT"
+	int64_t _day;
+	char _date[16];
+	
+	FormatWriter(const FormatWriter&);
+	FormatWriter& operator=(const FormatWriter&);
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_FORMATWRITER_HPP_
@@ -0,0 +1,56 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_GREP_HPP_
+#define _PK2UNPACK_GREP_HPP_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "sdpk2.hpp"
+
+namespace PK2Unpack {
+
+/**
+	Literal substring search.
+	Uses AVX2 or SSE2 to test the first and last pattern bytes 32 or 16 positions at a time,
+	then confirms candidates with memcmp.
+*/
+class SubstringSearch {
+public:
+	SubstringSearch(const std::string& pattern) : _pattern(pattern) {
+	};
+	const std::string& getPattern() const {
+		return _pattern;
+	};
+	/**
+		Find every (possibly overlapping) match in data.
+		@returns Nothing.
+		@param data The data to search.
+		@param size The data size.
+		@param out Receives the match positions, in order.
+	*/
+	void findAll(const char* data, size_t size, std::vector<size_t>& out) const;
+	
+protected:
+	std::string _pattern;
+};
+
+/**
+	Search every entry for the patterns without writing the data anywhere.
+	Entries are decompressed in parallel into reusable per-thread buffers; matches across block
+	boundaries are found. Prints "<hash> <offset> <pattern>" per match in entry order, then a summary line.
+	@returns The number of matches.
+	@param pak The archive.
+	@param patterns The literal patterns (non-empty).
+	@param threads Number of threads (0 means getHardwareThreads()).
+	@param out The output file.
+*/
+size_t grepArchive(const SDPK2& pak, const std::vector<std::string>& patterns, unsigned int threads, FILE* out);
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_GREP_HPP_
@@ -0,0 +1,35 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_HEX_HPP_
+#define _PK2UNPACK_HEX_HPP_
+
+#include <stddef.h>
+
+namespace PK2Unpack {
+
+/**
+	Encode data as lowercase hexadecimal.
+	Uses AVX2 or SSSE3 when the processor supports them.
+	@returns Nothing.
+	@param data The data.
+	@param size The number of bytes to encode.
+	@param out Output for size*2 characters (not NUL-terminated).
+*/
+void hexEncode(const unsigned char* data, size_t size, char* out);
+
+/**
+	Decode hexadecimal (either case) to bytes.
+	@returns false if any of the size*2 characters is not a hex digit; out is then undefined.
+	@param str The characters.
+	@param size The number of bytes to decode.
+	@param out Output for size bytes.
+*/
+bool hexDecode(const char* str, size_t size, unsigned char* out);
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_HEX_HPP_
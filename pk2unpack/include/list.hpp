@@ -0,0 +1,53 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_LIST_HPP_
+#define _PK2UNPACK_LIST_HPP_
+
+#include <stdio.h>
+#include "sdpk2.hpp"
+#include "sdmd2.hpp"
+
+namespace PK2Unpack {
+
+enum ListFormat {
+	LISTFORMAT_UNKNOWN=-1,
+	/* tab-separated with a header row; "text" is the same */
+	LISTFORMAT_TSV=0,
+	/* RFC 4180 CSV with a header row */
+	LISTFORMAT_CSV,
+	/* one object per line in an array */
+	LISTFORMAT_JSON
+};
+
+// LISTFORMAT_UNKNOWN if name is not a list format
+int getListFormat(const char* name);
+
+/**
+	List the archive's entries (hash, size, offset, block_index, blocks).
+	Output is written through one large buffer.
+	@returns Nothing.
+	@param pak The archive; only the header is used.
+	@param format A ListFormat.
+	@param out The output file.
+*/
+void listArchive(const SDPK2& pak, int format, FILE* out);
+
+// listArchive for the given entries, in the given order
+void listEntries(const SDPK2& pak, const Entry* const* entries, size_t count, int format, FILE* out);
+
+/**
+	List the metadata's files (index, dir_index, path, time_modified as UTC ISO 8601).
+	@returns Nothing.
+	@param table The metadata.
+	@param format A ListFormat.
+	@param out The output file.
+*/
+void listTable(const SDMD2& table, int format, FILE* out);
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_LIST_HPP_
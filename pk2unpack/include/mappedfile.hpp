@@ -0,0 +1,42 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_MAPPEDFILE_HPP_
+#define _PK2UNPACK_MAPPEDFILE_HPP_
+
+#include <stddef.h>
+
+namespace PK2Unpack {
+
+// read-only memory map of a whole file
+class MappedFile {
+public:
+	MappedFile() : _data(NULL), _size(0) {
+	};
+	~MappedFile() {
+		close();
+	};
+	// prints an error and returns false on failure; an empty file maps to no data
+	bool open(const char* path);
+	void close();
+	const char* data() const {
+		return _data;
+	};
+	size_t size() const {
+		return _size;
+	};
+	
+protected:
+	const char* _data;
+	size_t _size;
+	
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_MAPPEDFILE_HPP_
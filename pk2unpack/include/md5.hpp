@@ -0,0 +1,62 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_MD5_HPP_
+#define _PK2UNPACK_MD5_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdpk2.hpp"
+
+namespace PK2Unpack {
+
+/**
+	Incremental MD5 digest (RFC 1321).
+	SDPK2 entries are named by the MD5 of their path (see formats/sdpk2).
+*/
+class MD5 {
+public:
+	MD5() {
+		reset();
+	};
+	/**
+		Reset the digest to its initial state.
+		@returns Nothing.
+	*/
+	void reset();
+	/**
+		Add data to the digest.
+		@returns Nothing.
+		@param data The data to add.
+		@param size Size of the data in bytes.
+	*/
+	void update(const void* data, size_t size);
+	/**
+		Finish the digest; reset() before reusing the object.
+		@returns Nothing.
+		@param out The digest of all data given since reset().
+	*/
+	void finish(MD5Hash& out);
+	/**
+		Compute the MD5 of a buffer.
+		@returns Nothing.
+		@param data The data.
+		@param size Size of the data in bytes.
+		@param out The digest.
+	*/
+	static void compute(const void* data, size_t size, MD5Hash& out);
+
+protected:
+	uint32_t _state[4];
+	uint64_t _length;
+	unsigned char _buffer[64];
+
+	void transform(const unsigned char* block);
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_MD5_HPP_
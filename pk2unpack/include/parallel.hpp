@@ -0,0 +1,50 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_PARALLEL_HPP_
+#define _PK2UNPACK_PARALLEL_HPP_
+
+#include <stddef.h>
+
+namespace PK2Unpack {
+
+/**
+	Work item callbacks for parallelFor().
+	Each thread calls begin() once, run() for every index it claims and end() once.
+*/
+class ParallelTask {
+public:
+	virtual ~ParallelTask() {
+	};
+	virtual void begin(unsigned int thread) {
+		(void)thread;
+	};
+	virtual void run(size_t index, unsigned int thread)=0;
+	virtual void end(unsigned int thread) {
+		(void)thread;
+	};
+};
+
+/**
+	Get the number of online processors.
+	@returns The processor count (at least 1).
+*/
+unsigned int getHardwareThreads();
+
+/**
+	Run task for every index in [0, count) on the given number of threads.
+	Indices are claimed one at a time in ascending order, so large items do not hold back the rest.
+	The calling thread is used as thread 0.
+	@returns Nothing.
+	@param count Number of indices.
+	@param threads Number of threads (0 means getHardwareThreads()).
+	@param task The task to run.
+*/
+void parallelFor(size_t count, unsigned int threads, ParallelTask& task);
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_PARALLEL_HPP_
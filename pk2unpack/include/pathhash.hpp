@@ -0,0 +1,83 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_PATHHASH_HPP_
+#define _PK2UNPACK_PATHHASH_HPP_
+
+#include <vector>
+#include "sdpk2.hpp"
+#include "sdmd2.hpp"
+
+namespace PK2Unpack {
+
+// bit array size per remaining key at each level; larger builds faster and looks up in fewer levels
+#define PATHHASH_GAMMA 2.0
+#define PATHHASH_MAX_LEVELS 32
+
+// result of PathHash::find()
+struct PathMatch {
+	const FileInfo* file;
+	// NULL when the archive has no entry for the path (or no archive was given)
+	const Entry* entry;
+	MD5Hash hash;
+};
+
+/**
+	Path lookups over an SDMD2 (and its SDPK2) through a minimal perfect hash.
+	The hash function is BBHash-style: each level is a bit array of PATHHASH_GAMMA bits per key
+	still unplaced, keys which land alone set their bit, and colliding keys move to the next level.
+	A key's slot is the rank of its bit (any keys left after PATHHASH_MAX_LEVELS are kept in a sorted list).
+	The function is keyed on the path's MD5, which is also the SDPK2 entry hash, and takes
+	about 3.5 bits per key (with the rank samples); each slot holds the file and entry indices.
+	Lookups compare the path against the table (and the entry hash), so paths which are not in
+	the table, or an index built for a different table, never match.
+*/
+class PathHash {
+public:
+	PathHash();
+	/**
+		Index every resolvable file path of a table.
+		@returns The number of paths.
+		@param table The loaded table; it must outlive the index.
+		@param pak The archive the table describes (optional); it must outlive the index.
+	*/
+	size_t build(const SDMD2& table, const SDPK2* pak);
+	bool save(const char* path) const;
+	// false if the file can't be read or was built for a different table or archive (or entry order)
+	bool load(const char* path, const SDMD2& table, const SDPK2* pak);
+	// false if path is not in the table
+	bool find(const char* path, size_t length, PathMatch& out) const;
+	size_t getKeyCount() const {
+		return _files.size();
+	};
+	// size of the hash function (not the slots) per key
+	double getBitsPerKey() const;
+	
+protected:
+	const SDMD2* _table;
+	const SDPK2* _pak;
+	// the levels' bit arrays, back to back; level i is bits [_levels[i], _levels[i+1])
+	std::vector<uint64_t> _bits;
+	std::vector<uint64_t> _levels;
+	// set bits before each 512-bit block, then the total (the first fallback slot)
+	std::vector<uint32_t> _ranks;
+	// keys no level placed, sorted; their slots follow the ranked ones
+	std::vector<MD5Hash> _fallback;
+	// per slot
+	std::vector<uint32_t> _files;
+	std::vector<uint32_t> _entries;
+	
+	void buildRanks();
+	// ~0 if no level or fallback key matches (the key is then certainly absent)
+	uint64_t slot(const MD5Hash& hash) const;
+	
+	PathHash(const PathHash&);
+	PathHash& operator=(const PathHash&);
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_PATHHASH_HPP_
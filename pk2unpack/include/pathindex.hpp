@@ -0,0 +1,61 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_PATHINDEX_HPP_
+#define _PK2UNPACK_PATHINDEX_HPP_
+
+#include <string>
+#include <vector>
+#include "sdpk2.hpp"
+#include "sdmd2.hpp"
+
+namespace PK2Unpack {
+
+// an SDMD2 file and its resolved path
+struct PathEntry {
+	// MD5 of path; the SDPK2 entry name
+	MD5Hash hash;
+	// index in the table's FileInfo list
+	uint32_t file;
+	std::string path;
+};
+
+typedef std::vector<PathEntry> PathEntryVec;
+
+/**
+	Maps SDPK2 entry hashes to SDMD2 paths.
+	A file's path is its directory name, "/" and its file name; the entry hash is the MD5 of the path.
+*/
+class PathIndex {
+public:
+	PathIndex() : _table(NULL) {
+	};
+	/**
+		Resolve and hash every file path of a loaded table.
+		@returns The number of paths; files with bad name indices are skipped.
+		@param table The table; it must outlive the index.
+	*/
+	size_t build(const SDMD2& table);
+	// NULL if no path has the hash
+	const PathEntry* find(const MD5Hash& hash) const;
+	const FileInfo& getFileInfo(const PathEntry& entry) const {
+		return _table->getEntryInfo().getData()[entry.file];
+	};
+	// sorted by hash
+	const PathEntryVec& getEntries() const {
+		return _entries;
+	};
+	// false if the file's name indices are out of range
+	static bool resolvePath(const EntryInfoSet& info, const FileInfo& file, std::string& out);
+	
+protected:
+	const SDMD2* _table;
+	PathEntryVec _entries;
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_PATHINDEX_HPP_
@@ -0,0 +1,172 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_PREFETCH_HPP_
+#define _PK2UNPACK_PREFETCH_HPP_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <pthread.h>
+#include "sdpk2.hpp"
+#include "bufferpool.hpp"
+
+namespace PK2Unpack {
+
+// one Entry::readBlocks call: a run of an entry's blocks
+struct AccessRecord {
+	// index in the trace's archive list
+	uint32_t archive;
+	MD5Hash hash;
+	uint32_t first_block;
+	uint32_t block_count;
+};
+
+/**
+	The order in which a consumer reads (archive, entry, block) runs.
+	Recording is thread-safe; reads of archives which were not added are not recorded.
+	Saved as text: "archive <index> <path>" lines, then "<archive> <hash> <first block> <block count>" lines.
+*/
+class AccessTrace {
+public:
+	AccessTrace();
+	~AccessTrace();
+	// returns the archive's index
+	size_t addArchive(const SDPK2& pak);
+	void record(const SDPK2& pak, const Entry& entry, unsigned int first_block, unsigned int block_count);
+	bool save(const char* path) const;
+	bool load(const char* path);
+	const std::vector<std::string>& getArchivePaths() const {
+		return _paths;
+	};
+	const std::vector<AccessRecord>& getRecords() const {
+		return _records;
+	};
+	
+protected:
+	pthread_mutex_t _lock;
+	std::vector<const SDPK2*> _paks;
+	std::vector<std::string> _paths;
+	std::vector<AccessRecord> _records;
+	
+	AccessTrace(const AccessTrace&);
+	AccessTrace& operator=(const AccessTrace&);
+};
+
+// decompressed bytes the prefetcher may hold
+#define PREFETCH_CACHE_SIZE 0x4000000
+// how far ahead of the consumer to stay, in time at the consumer's observed rate
+#define PREFETCH_HORIZON_NS 250000000ull
+#define PREFETCH_MIN_LOOKAHEAD 0x100000
+
+/**
+	Replays an AccessTrace ahead of the consumer on a background thread.
+	Runs further ahead are hinted to the kernel (POSIX_FADV_WILLNEED); nearer ones are decoded
+	into a block cache which Entry::readBlocks takes from. The consumer's reads are matched against
+	the trace to track its position and rate; the prefetcher stays PREFETCH_HORIZON_NS of reading
+	ahead of it (at least PREFETCH_MIN_LOOKAHEAD bytes). The lookahead ceiling doubles when the
+	consumer overtakes the prefetcher and halves when warmed blocks are evicted unused.
+*/
+class TracePrefetcher {
+public:
+	TracePrefetcher(const AccessTrace& trace, size_t cache_size=PREFETCH_CACHE_SIZE);
+	~TracePrefetcher();
+	// the open archive for the trace's archive index; records of archives not set are skipped
+	void setArchive(size_t index, const SDPK2& pak);
+	bool start();
+	void stop();
+	// called by Entry::readBlocks for each read
+	void consumed(const SDPK2& pak, const Entry& entry, unsigned int first_block);
+	// move a warmed block (by archive offset) into out; false if it is not cached
+	bool take(const SDPK2& pak, uint64_t offset, char* out, size_t size);
+	uint64_t getHits() const {
+		return _hits;
+	};
+	uint64_t getMisses() const {
+		return _misses;
+	};
+	uint64_t getEvictions() const {
+		return _evictions;
+	};
+	uint64_t getLookahead() const {
+		return _lookahead;
+	};
+	
+protected:
+	struct Item {
+		uint32_t archive;
+		const SDPK2* pak;
+		const Entry* entry;
+		unsigned int first_block, block_count;
+		// decompressed bytes of the trace up to and including this item
+		uint64_t end;
+	};
+	struct CacheKey {
+		const SDPK2* pak;
+		uint64_t offset;
+		bool operator==(const CacheKey& other) const {
+			return pak==other.pak && offset==other.offset;
+		};
+	};
+	struct CacheKeyHash {
+		size_t operator()(const CacheKey& key) const {
+			return std::hash<uint64_t>()(key.offset^((uint64_t)(uintptr_t)key.pak<<20));
+		};
+	};
+	struct CacheBlock {
+		PooledBuffer data;
+		uint64_t seq;
+	};
+	friend class PrefetchBlockHandler;
+	
+	const AccessTrace& _trace;
+	std::vector<const SDPK2*> _paks;
+	std::vector<Item> _items;
+	pthread_mutex_t _lock;
+	pthread_cond_t _cond;
+	pthread_t _thread;
+	bool _running, _stop;
+	// next item the consumer is expected to read, and the trace bytes before it
+	size_t _consumer;
+	uint64_t _consumer_bytes;
+	// next item the prefetcher decodes
+	size_t _warmed;
+	uint64_t _consumer_time;
+	// consumer rate (bytes/s)
+	double _rate;
+	uint64_t _lookahead, _max_lookahead;
+	std::unordered_map<CacheKey, CacheBlock, CacheKeyHash> _cache;
+	// insertion order; stale once taken (seq mismatch)
+	std::deque<std::pair<CacheKey, uint64_t> > _order;
+	size_t _cache_bytes, _cache_size;
+	uint64_t _seq;
+	uint64_t _hits, _misses, _evictions;
+	
+	static void* run(void* arg);
+	void put(const SDPK2& pak, uint64_t offset, const char* data, size_t size);
+	
+	TracePrefetcher(const TracePrefetcher&);
+	TracePrefetcher& operator=(const TracePrefetcher&);
+};
+
+namespace Prefetch {
+
+// the trace being recorded (--record) and the running prefetcher (--prefetch); NULL when disabled
+// set before TracePrefetcher::start() and cleared after stop(), since its thread reads them
+extern AccessTrace* recording;
+extern TracePrefetcher* replaying;
+
+// the prefetcher Entry::readBlocks should use on this thread (never the prefetcher's own)
+TracePrefetcher* consumer();
+// called by Entry::readBlocks before it reads
+void onRead(const SDPK2& pak, const Entry& entry, unsigned int first_block, unsigned int block_count);
+
+} // namespace Prefetch
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_PREFETCH_HPP_
@@ -0,0 +1,30 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_QUERY_HPP_
+#define _PK2UNPACK_QUERY_HPP_
+
+#include <stdio.h>
+#include "sdpk2.hpp"
+
+namespace PK2Unpack {
+
+/**
+	Look up a list of hashes and list the entries found (see listEntries()).
+	The input has one hash per line; blank lines and lines starting with '#' are ignored.
+	All hashes are decoded in one pass and resolved in one batch.
+	Missing and malformed hashes are reported on stderr.
+	@returns The number of missing or malformed hashes, or -1 if the input could not be read.
+	@param pak The archive.
+	@param path The input file, or "-" for stdin.
+	@param format A ListFormat.
+	@param out The output file.
+*/
+long queryArchive(const SDPK2& pak, const char* path, int format, FILE* out);
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_QUERY_HPP_
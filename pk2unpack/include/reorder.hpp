@@ -0,0 +1,52 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_REORDER_HPP_
+#define _PK2UNPACK_REORDER_HPP_
+
+#include <vector>
+#include "sdpk2.hpp"
+#include "pathindex.hpp"
+#include "prefetch.hpp"
+
+namespace PK2Unpack {
+
+enum ReorderMode {
+	/* first access in an AccessTrace, then the rest */
+	REORDER_TRACE=0,
+	/* SDMD2 path, so each directory's files are contiguous */
+	REORDER_PATH,
+	/* uncompressed size, smallest first */
+	REORDER_SIZE,
+	REORDER_UNKNOWN
+};
+
+// "trace", "dir" or "size"; REORDER_UNKNOWN otherwise
+int getReorderMode(const char* name);
+
+/*
+	Entry indices of an archive in a new order. Entries the order has no opinion on
+	(not in the trace, not in the table) follow in their current data order.
+*/
+void orderByTrace(const SDPK2& pak, const AccessTrace& trace, size_t archive, std::vector<size_t>& order);
+void orderByPath(const SDPK2& pak, const PathIndex& paths, std::vector<size_t>& order);
+void orderBySize(const SDPK2& pak, std::vector<size_t>& order);
+
+/**
+	Write a copy of an archive with the entry records and their data laid out in the given order.
+	Compressed blocks are copied raw; entry offsets, blocksize indices and the comp_block_sizes
+	table are rebuilt. Entries which shared data still do. The copy is written next to out_path
+	and renamed over it once complete, so out_path may be the archive itself.
+	@returns false on a read or write error (out_path is then left alone).
+	@param pak The open archive.
+	@param order Every entry index of pak, once.
+	@param out_path The new archive.
+*/
+bool reorderArchive(const SDPK2& pak, const std::vector<size_t>& order, const char* out_path);
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_REORDER_HPP_
@@ -15,6 +15,8 @@
 #include <duct/stream.hpp>
 #include <duct/endianstream.hpp>
 #include "datacontainer.hpp"
+#include "bereader.hpp"
+#include "formatwriter.hpp"
 
 namespace PK2Unpack {
 
@@ -43,7 +45,7 @@ public:
 		}
 	};
 	
-	void deserialize(Stream* stream);
+	bool deserialize(BEReader& reader);
 	void serialize(Stream* stream) const;
 	void printInfo(const char* name, unsigned int tabcount=0, bool newline=true) const;
 	
@@ -57,9 +59,6 @@ class FileInfo {
 public:
 	FileInfo() : _dir_index(0), _index(0), _time_modified(0) {
 	};
-	FileInfo(Stream* stream) {
-		deserialize(stream);
-	};
 	
 	uint32_t getDirIndex() const {
 		return _dir_index;
@@ -67,9 +66,14 @@ public:
 	uint32_t getIndex() const {
 		return _index;
 	};
+	time_t getTimeModified() const {
+		return _time_modified;
+	};
 	
-	void deserialize(Stream* stream);
+	// decode a 20-byte file record
+	bool deserialize(BEReader& reader);
 	void serialize(Stream* stream) const;
+	void printInfo(FormatWriter& out, unsigned int tabcount=0, bool newline=true) const;
 	void printInfo(unsigned int tabcount=0, bool newline=true) const;
 	
 protected:
@@ -101,6 +105,10 @@ public:
 	const char** getNames() const {
 		return (const char**)_names;
 	};
+	// NULL if index is out of range
+	const char* getName(uint32_t index) const {
+		return (index<_name_count) ? _names[index] : NULL;
+	};
 	size_t getFileCount() const {
 		return _files.size();
 	};
@@ -109,19 +117,22 @@ public:
 	};
 	
 	void release() {
-		_name_count=0;
 		if (_offsets) {
 			free(_offsets);
 			_offsets=NULL;
 		}
 		if (_names) {
+			for (uint32_t i=0; i<_name_count; ++i) {
+				free(_names[i]);
+			}
 			free(_names);
 			_names=NULL;
 			_names_size=0;
 		}
+		_name_count=0;
 	};
 	
-	void deserialize(Stream* stream);
+	bool deserialize(BEReader& reader);
 	void serialize(Stream* stream) const;
 	void printInfo(const char* name, unsigned int tabcount=0, bool newline=true) const;
 	
@@ -145,8 +156,14 @@ public:
 	const char* getPath() {
 		return _path;
 	};
+	const EntryInfoSet& getEntryInfo() const {
+		return _entryinfo;
+	};
 	
-	void deserialize(Stream* stream);
+	// false if the data is truncated
+	bool deserialize(BEReader& reader);
+	// parses the rest of the stream
+	bool deserialize(Stream* stream);
 	bool load();
 	void printInfo(unsigned int tabcount=0, bool newline=true) const;
 	
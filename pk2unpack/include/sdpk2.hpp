@@ -10,9 +10,12 @@
 #include <vector>
 #include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
 #include <duct/stream.hpp>
 #include <duct/endianstream.hpp>
 #include "misc.hpp"
+#include "crc32c.hpp"
+#include "bufferpool.hpp"
 
 namespace PK2Unpack {
 
@@ -49,7 +52,9 @@ public:
 	void clear() {
 		memset(_data, 0x00, 16);
 	};
+	// write the lowercase hex form to out (32 characters, plus NUL if nullterm)
 	void getExisting(char* out=NULL, bool nullterm=true) const;
+	// returns the hex form in a malloc()ed buffer, also stored in out (optional)
 	char* get(char** out=NULL, bool nullterm=true) const;
 	int compare(const MD5Hash& other) const {
 		return memcmp(_data, other._data, 16);
@@ -72,6 +77,185 @@ struct MD5HashCompare {
 	};
 };
 
+// Entry::readBlocks/readToStream result codes
+enum ReadError {
+	READERR_NONE=0,
+	/* compression method is not supported */
+	READERR_COMPMETHOD,
+	/* block index is outside of comp_block_sizes */
+	READERR_BLOCKINDEX,
+	/* compressed block size is larger than uncompressed block size */
+	READERR_BLOCKSIZE,
+	/* archive data ended early */
+	READERR_READ,
+	/* zlib failed to decompress a block */
+	READERR_INFLATE,
+	/* decompressed block length does not match the block size */
+	READERR_LENGTH,
+	/* block handler/output stream failed */
+	READERR_WRITE,
+	/* input position does not match _offset plus the compressed size */
+	READERR_POSITION,
+	/* no entry has the requested hash */
+	READERR_NOTFOUND
+};
+
+const char* getReadErrorName(int err);
+
+// source of compressed entry data for Entry::readBlocks
+class BlockSource {
+public:
+	virtual ~BlockSource() {
+	};
+	virtual void seek(uint64_t pos)=0;
+	virtual uint64_t pos()=0;
+	// read size bytes; data is either placed in buf or returned from elsewhere, NULL on short read
+	virtual const char* read(size_t size, char* buf)=0;
+};
+
+class StreamBlockSource : public BlockSource {
+public:
+	StreamBlockSource(Stream* stream) : _stream(stream) {
+	};
+	void seek(uint64_t pos) {
+		if (_stream->pos()!=pos) {
+			_stream->seek(pos);
+		}
+	};
+	uint64_t pos() {
+		return _stream->pos();
+	};
+	const char* read(size_t size, char* buf) {
+		return (_stream->read(buf, size)==size) ? buf : NULL;
+	};
+	
+protected:
+	Stream* _stream;
+};
+
+// compressed data already in memory; pos is relative to base (the archive offset of data)
+class MemoryBlockSource : public BlockSource {
+public:
+	MemoryBlockSource(const char* data, size_t size, uint64_t base=0) : _data(data), _size(size), _base(base), _pos(base) {
+	};
+	void seek(uint64_t pos) {
+		_pos=pos;
+	};
+	uint64_t pos() {
+		return _pos;
+	};
+	const char* read(size_t size, char*) {
+		if (_pos<_base || _pos-_base>_size || size>_size-(_pos-_base)) {
+			return NULL;
+		}
+		const char* p=_data+(_pos-_base);
+		_pos+=size;
+		return p;
+	};
+	
+protected:
+	const char* _data;
+	size_t _size;
+	uint64_t _base, _pos;
+};
+
+// receives the decompressed blocks of an entry, in order
+class BlockHandler {
+public:
+	virtual ~BlockHandler() {
+	};
+	/*
+		Where to decompress a block, or NULL for the decoder's scratch buffer.
+		If a buffer is given, block() receives it as data when the block is good.
+	*/
+	virtual char* blockBuffer(unsigned int index, size_t size) {
+		(void)index; (void)size;
+		return NULL;
+	};
+	// return false to stop with READERR_WRITE
+	virtual bool block(unsigned int index, const char* data, size_t size)=0;
+	// called for a bad block; return true to skip it and continue with the next block
+	virtual bool error(unsigned int index, int err) {
+		(void)index; (void)err;
+		return false;
+	};
+};
+
+// writes the blocks to a stream; digest (optional) is updated with the data
+class StreamBlockHandler : public BlockHandler {
+public:
+	StreamBlockHandler(Stream* stream, CRC32C* digest=NULL) : _stream(stream), _digest(digest) {
+	};
+	bool block(unsigned int index, const char* data, size_t size);
+	
+protected:
+	Stream* _stream;
+	CRC32C* _digest;
+};
+
+// places the blocks in consecutive block_size slots of out
+class BufferBlockHandler : public BlockHandler {
+public:
+	BufferBlockHandler(size_t block_size, char* out) : _block_size(block_size), _out(out) {
+	};
+	char* blockBuffer(unsigned int index, size_t) {
+		return _out+(uint64_t)index*_block_size;
+	};
+	bool block(unsigned int, const char*, size_t) {
+		// already in place
+		return true;
+	};
+	
+protected:
+	size_t _block_size;
+	char* _out;
+};
+
+// per-thread decompression state and scratch buffers
+class BlockDecoder {
+public:
+	BlockDecoder();
+	~BlockDecoder();
+	char* getInBuffer(size_t size);
+	char* getOutBuffer(size_t size);
+	// inflate a complete compressed block into exactly uc_size bytes
+	int inflateBlock(const char* in, size_t c_size, char* out, size_t uc_size);
+	
+protected:
+	z_stream _strm;
+	char* _in;
+	char* _out;
+	size_t _in_size, _out_size;
+	
+	BlockDecoder(const BlockDecoder&);
+	BlockDecoder& operator=(const BlockDecoder&);
+};
+
+// per-thread compression state for writing entry data
+class BlockEncoder {
+public:
+	BlockEncoder(int level=Z_DEFAULT_COMPRESSION);
+	~BlockEncoder();
+	/*
+		Write data as block_size blocks, appending their comp_block_sizes values to table.
+		Blocks which do not shrink are stored. c_size (optional) receives the number of bytes written.
+	*/
+	int writeBlocks(Stream* out, const char* data, uint64_t size, size_t block_size, std::vector<size_t>& table, uint64_t* c_size=NULL);
+	// as writeBlocks(), appending the compressed data to out
+	void encodeBlocks(const char* data, uint64_t size, size_t block_size, std::vector<size_t>& table, std::vector<char>& out);
+	
+protected:
+	z_stream _strm;
+	char* _out;
+	size_t _out_size;
+	
+	// returns the compressed block (or data if it is stored)
+	const char* encodeBlock(const char* data, size_t uc_blocksize, size_t block_size, size_t& c_blocksize, size_t& table_value);
+	
+	BlockEncoder(const BlockEncoder&);
+	BlockEncoder& operator=(const BlockEncoder&);
+};
+
 class SDPK2; // forward declaration
 
 class Entry {
@@ -81,6 +265,8 @@ public:
 	Entry(Stream* stream) {
 		deserialize(stream);
 	};
+	Entry(const MD5Hash& hash, uint32_t blocksize_index, uint64_t size, uint64_t offset) : _hash(hash), _blocksize_index(blocksize_index), _size(size), _offset(offset) {
+	};
 	MD5Hash hash() {
 		return _hash;
 	};
@@ -90,9 +276,41 @@ public:
 	unsigned int getBlockSizeIndex() const {
 		return _blocksize_index;
 	};
-	int readToStream(Stream* instream, Stream* outstream, const SDPK2& pak) const;
+	void setBlockSizeIndex(uint32_t blocksize_index) {
+		_blocksize_index=blocksize_index;
+	};
+	void setOffset(uint64_t offset) {
+		_offset=offset;
+	};
+	uint64_t getSize() const {
+		return _size;
+	};
+	uint64_t getOffset() const {
+		return _offset;
+	};
+	/*
+		Get the archive offset and compressed size of a run of blocks (clamped to the entry).
+		Returns READERR_BLOCKINDEX if the entry's blocks run past comp_block_sizes.
+	*/
+	int getCompressedRange(const SDPK2& pak, unsigned int first_block, unsigned int block_count, uint64_t& offset, uint64_t& size) const;
+	// block indices are relative to the entry; the default range is all blocks
+	int readBlocks(BlockSource& source, const SDPK2& pak, BlockHandler& handler, BlockDecoder& decoder, unsigned int first_block=0, unsigned int block_count=0xFFFFFFFF) const;
+	// read size bytes at offset (uncompressed) into out, decoding only the blocks which cover the range
+	int readRange(Stream* instream, const SDPK2& pak, uint64_t offset, uint64_t size, char* out, BlockDecoder* decoder=NULL) const;
+	int readRange(BlockSource& source, const SDPK2& pak, uint64_t offset, uint64_t size, char* out, BlockDecoder& decoder) const;
+	// digest (optional) is updated with the decompressed data as it is written
+	// decoder defaults to a shared decoder which is not thread-safe
+	int readToStream(Stream* instream, Stream* outstream, const SDPK2& pak, CRC32C* digest=NULL, BlockDecoder* decoder=NULL) const;
+	int readToStream(BlockSource& source, Stream* outstream, const SDPK2& pak, CRC32C* digest, BlockDecoder& decoder) const;
+	// read the whole entry into a pooled buffer of exactly getSize() bytes; blocks are inflated in place
+	int readToBuffer(Stream* instream, const SDPK2& pak, PooledBuffer& out, BlockDecoder* decoder=NULL, BufferPool& pool=BufferPool::global()) const;
+	int readToBuffer(BlockSource& source, const SDPK2& pak, PooledBuffer& out, BlockDecoder& decoder, BufferPool& pool=BufferPool::global()) const;
 	void deserialize(Stream* stream);
+	// decode a 30-byte entry record
+	void deserialize(const unsigned char* data);
 	void serialize(Stream* stream) const;
+	// encode a 30-byte entry record
+	void serialize(unsigned char* data) const;
 	void printInfo(unsigned int tabcount=0, bool newline=true) const;
 	
 protected:
@@ -119,29 +337,63 @@ public:
 	void setPath(const char* path) {
 		_path=path;
 	};
-	const char* getPath() {
+	const char* getPath() const {
 		return _path;
 	};
+	void setBlockSize(size_t block_size) {
+		_block_size=block_size;
+	};
 	size_t getBlockSize() const {
 		return _block_size;
 	};
+	void setCompressionMethod(CompressionMethod comp_method) {
+		_comp_method=comp_method;
+	};
 	CompressionMethod getCompressionMethod() const {
 		return _comp_method;
 	};
+	BlockSizeTable& getBlockSizeTable() {
+		return _c_blocksize_table;
+	};
 	const BlockSizeTable& getBlockSizeTable() const {
 		return _c_blocksize_table;
 	};
+	EntryVec& getEntries() {
+		return _entries;
+	};
 	const EntryVec& getEntries() const {
 		return _entries;
 	};
+	// header size (offset of the first data byte) for the current entries and block table
+	size_t getHeaderSize() const {
+		return 32+30*_entries.size()+2*_c_blocksize_table.size();
+	};
 	void clear() {
 		clearEntries();
 		_c_blocksize_table.clear();
 	};
 	void clearEntries();
+	// open a separate read stream on the archive (for worker threads)
+	Stream* openDataStream() const;
+	static void closeDataStream(Stream* stream);
 	Entry* findEntry(const MD5Hash& hash);
 	const Entry* findEntry(const MD5Hash& hash) const;
-	void deserializeInfo(Stream* stream);
+	// resolve count hashes in one pass over the sorted entries; out[i] is NULL for a missing hash
+	void findEntries(const MD5Hash* hashes, size_t count, const Entry** out) const;
+	// parse a complete in-memory header; false if it is truncated
+	bool deserializeInfo(const unsigned char* data, size_t size);
+	/*
+		Load only the entry with the given hash from raw archive data (e.g. a MappedFile):
+		the entry records are scanned in place and only the entry's comp_block_sizes slice is copied.
+		The entry is then the only one, with its blocksize index rebased to 0; offsets still refer to data.
+		Returns false if the header is bad or no entry has the hash.
+	*/
+	bool deserializeEntry(const MD5Hash& hash, const unsigned char* data, size_t size);
+	bool deserializeInfo(Stream* stream);
+	// write the header (entries and block table); the stream must be big-endian
+	void serializeInfo(Stream* stream) const;
+	// write the header to memory, zero-padded to header_size if that is larger than getHeaderSize()
+	void serializeInfo(std::vector<unsigned char>& out, size_t header_size=0) const;
 	bool open();
 	void close();
 	void printInfo(unsigned int tabcount=0, bool newline=true) const;
@@ -0,0 +1,98 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_SIDECAR_HPP_
+#define _PK2UNPACK_SIDECAR_HPP_
+
+#include <string>
+#include <vector>
+#include "sdpk2.hpp"
+
+namespace PK2Unpack {
+
+/*
+	Sidecar layout (big-endian), at the archive path plus ".zst":
+	char[4] "PKZS", u32 version (1), u32 block_size, u32 table_count,
+	u64 archive_size, u32 header_crc (CRC32C of the archive header), u32 reserved,
+	then table_count records of {u64 offset, u32 size}, one per comp_block_sizes element,
+	then the frames. Each block is one independent zstd frame of its decompressed data;
+	size 0 means the block has no frame (unused, or bad in the archive).
+*/
+#define SIDECAR_HEAD_SIZE 32
+#define SIDECAR_RECORD_SIZE 12
+
+// per-thread zstd state and scratch buffer for ZstdSidecar
+class SidecarDecoder {
+public:
+	SidecarDecoder();
+	~SidecarDecoder();
+	char* getInBuffer(size_t size);
+	char* getOutBuffer(size_t size);
+	// decompress one frame into exactly uc_size bytes; returns a ReadError
+	int decodeFrame(const char* in, size_t c_size, char* out, size_t uc_size);
+	
+protected:
+	// ZSTD_DCtx
+	void* _ctx;
+	std::vector<char> _in, _out;
+	
+	SidecarDecoder(const SidecarDecoder&);
+	SidecarDecoder& operator=(const SidecarDecoder&);
+};
+
+/**
+	Decoded copy of an archive's blocks as zstd frames, for faster repeated reads.
+	The archive stays authoritative: a sidecar is only used if its archive size and header CRC
+	still match, and entries with missing frames are read from the archive.
+	Requires a build with zstd ("premake4 --zstd gmake"); otherwise open() and transcode() fail.
+*/
+class ZstdSidecar {
+public:
+	ZstdSidecar() : _pak(NULL), _fd(-1) {
+	};
+	~ZstdSidecar() {
+		close();
+	};
+	static std::string getPath(const SDPK2& pak);
+	/**
+		Open the sidecar of an open archive.
+		@returns false if there is no sidecar (quietly), or if it is stale or unreadable.
+	*/
+	bool open(const SDPK2& pak);
+	void close();
+	bool isOpen() const {
+		return _fd>=0;
+	};
+	// whether every block of entry has a frame
+	bool covers(const Entry& entry) const;
+	// as Entry::readBlocks() over all blocks; decoder defaults to one per thread
+	int readBlocks(const Entry& entry, BlockHandler& handler, SidecarDecoder* decoder=NULL) const;
+	int readToStream(const Entry& entry, Stream* outstream, CRC32C* digest=NULL, SidecarDecoder* decoder=NULL) const;
+	// frames are decoded straight into out
+	int readToBuffer(const Entry& entry, PooledBuffer& out, SidecarDecoder* decoder=NULL, BufferPool& pool=BufferPool::global()) const;
+	/**
+		Write the sidecar for an open archive, decoding and recompressing the entries in parallel.
+		The file is written under a temporary name and renamed when complete.
+		@returns false on error.
+		@param pak The open archive.
+		@param level zstd compression level.
+		@param threads Number of threads (0 means one per processor).
+	*/
+	static bool transcode(const SDPK2& pak, int level, unsigned int threads);
+	
+protected:
+	const SDPK2* _pak;
+	int _fd;
+	std::vector<uint64_t> _offsets;
+	std::vector<uint32_t> _sizes;
+	
+	ZstdSidecar(const ZstdSidecar&);
+	ZstdSidecar& operator=(const ZstdSidecar&);
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_SIDECAR_HPP_
@@ -0,0 +1,212 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_STATICFORMAT_HPP_
+#define _PK2UNPACK_STATICFORMAT_HPP_
+
+#include <string.h>
+#include <duct/config.hpp>
+#include "byteorder.hpp"
+#include "formatwriter.hpp"
+#include "datacontainer.hpp"
+
+namespace PK2Unpack {
+
+/**
+	Compile-time DataFormat element.
+	The type switch in print() folds away, leaving a fixed decode-and-format routine per field.
+	Output matches DataContainer::print() for the same DataFormat.
+*/
+template<unsigned int Type, size_t MaxSize=0, int Endian=0>
+struct DataField {
+	static const unsigned int type=Type;
+	static const size_t maxsize=MaxSize;
+	static const int endian=Endian;
+	
+	static_assert(Type!=FORMATTYPE_NULL, "FORMATTYPE_NULL is implied by the end of the field list");
+	static_assert(Type!=FORMATTYPE_SLONG && Type!=FORMATTYPE_ULONG && Type!=FORMATTYPE_DOUBLE, "format type is not supported by DataContainer::print");
+	
+	// false if the data ran out (DataContainer::print returns -1)
+	static bool print(const char* data, size_t size, size_t& pos, FormatWriter& out) {
+		const bool swap=!Endian || Endian!=DUCT_BYTEORDER;
+		switch (Type) {
+		case FORMATTYPE_SBYTE:
+			out.appendInt((signed char)data[pos++]);
+			out.append('b');
+			break;
+		case FORMATTYPE_UBYTE:
+			out.appendUInt((unsigned char)data[pos++]);
+			out.append("ub", 2);
+			break;
+		case FORMATTYPE_CHAR:
+			out.append('\'');
+			out.append(data[pos++]);
+			out.append('\'');
+			break;
+		case FORMATTYPE_SSHORT:
+		case FORMATTYPE_USHORT: {
+			if (pos+2>size) {
+				out.append("err", 3);
+				return false;
+			}
+			uint16_t value;
+			memcpy(&value, data+pos, 2);
+			if (swap) {
+				value=ByteOrderUInt<2>::swap(value);
+			}
+			if (Type==FORMATTYPE_SSHORT) {
+				out.appendInt((int16_t)value, 6);
+				out.append('s');
+			} else {
+				out.appendUInt(value, 5);
+				out.append("us", 2);
+			}
+			pos+=2;
+			} break;
+		case FORMATTYPE_SINT:
+		case FORMATTYPE_UINT: {
+			if (pos+4>size) {
+				out.append("err", 3);
+				return false;
+			}
+			uint32_t value;
+			memcpy(&value, data+pos, 4);
+			if (swap) {
+				value=ByteOrderUInt<4>::swap(value);
+			}
+			if (Type==FORMATTYPE_SINT) {
+				out.appendInt((int32_t)value, 11);
+				out.append('i');
+			} else {
+				out.appendUInt(value, 10);
+				out.append("ui", 2);
+			}
+			pos+=4;
+			} break;
+		case FORMATTYPE_FLOAT:
+			// not implemented by DataContainer either
+			break;
+		case FORMATTYPE_STRING_NULLTERM: {
+			size_t limit=size-pos;
+			if (MaxSize>0 && MaxSize<limit) {
+				limit=MaxSize;
+			}
+			size_t length=strnlen(data+pos, limit);
+			out.append("nz", 2);
+			out.append(data+pos, length);
+			pos+=length;
+			} break;
+		case FORMATTYPE_STRING:
+			if (pos+MaxSize>size) {
+				return false;
+			}
+			out.append(data+pos, MaxSize);
+			pos+=MaxSize;
+			break;
+		case FORMATTYPE_HEX:
+		case FORMATTYPE_HEX_SPACELESS:
+		case FORMATTYPE_HEX_LOWER:
+		case FORMATTYPE_HEX_LOWER_SPACELESS: {
+			const bool lower=Type==FORMATTYPE_HEX_LOWER || Type==FORMATTYPE_HEX_LOWER_SPACELESS;
+			const bool nsp=Type==FORMATTYPE_HEX_SPACELESS || Type==FORMATTYPE_HEX_LOWER_SPACELESS;
+			size_t count=(MaxSize!=0) ? MaxSize : size-pos;
+			size_t i=0;
+			while (i++<count && pos!=size) {
+				out.appendHex((unsigned char)data[pos++], lower);
+				if (!nsp && i!=count) {
+					out.append(' ');
+				}
+			}
+			} break;
+		case FORMATTYPE_SKIP:
+			pos+=MaxSize;
+			out.append('>');
+			out.appendUInt(MaxSize);
+			break;
+		case FORMATTYPE_SET:
+			pos=MaxSize;
+			out.append('#');
+			out.appendUInt(MaxSize);
+			break;
+		}
+		return true;
+	};
+};
+
+template<typename... Fields>
+struct __DataFieldList;
+
+template<>
+struct __DataFieldList<> {
+	static bool print(const char*, size_t, size_t&, FormatWriter&) {
+		return true;
+	};
+};
+
+template<typename Field, typename... Rest>
+struct __DataFieldList<Field, Rest...> {
+	static bool print(const char* data, size_t size, size_t& pos, FormatWriter& out) {
+		if (pos==size && Field::type!=FORMATTYPE_SET) {
+			return false;
+		}
+		if (!Field::print(data, size, pos, out)) {
+			return false;
+		}
+		if (sizeof...(Rest)>0) {
+			out.append(", ", 2);
+		}
+		return __DataFieldList<Rest...>::print(data, size, pos, out);
+	};
+};
+
+/**
+	Compile-time DataFormat sequence.
+	For example:
+	@code
+	typedef StaticDataFormat<DataField<FORMATTYPE_UINT, 0, DUCT_BIG_ENDIAN>, DataField<FORMATTYPE_HEX> > Fmt;
+	Fmt::print(container, writer);
+	@endcode
+	Fmt::runtime() gives the equivalent DataFormat array for DataContainer::print().
+*/
+template<typename... Fields>
+struct StaticDataFormat {
+	static_assert(sizeof...(Fields)>0, "empty format");
+	
+	/**
+		Print the container's data.
+		@returns The same as DataContainer::print().
+		@param dc The container.
+		@param out The output.
+	*/
+	static int print(const DataContainer& dc, FormatWriter& out) {
+		const char* data=(const char*)dc.getData();
+		size_t size=dc.getSize();
+		if (!data || size==0) {
+			out.append("(nil)", 5);
+			return -2;
+		}
+		size_t pos=0;
+		if (!__DataFieldList<Fields...>::print(data, size, pos, out)) {
+			return -1;
+		}
+		return (pos==size) ? 0 : size-pos;
+	};
+	/**
+		Get the equivalent runtime format.
+		@returns A FORMATTYPE_NULL-terminated array.
+	*/
+	static const DataFormat* runtime() {
+		static const DataFormat format[]={
+			{Fields::type, Fields::maxsize, Fields::endian}...,
+			{FORMATTYPE_NULL, 0, 0}
+		};
+		return format;
+	};
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_STATICFORMAT_HPP_
@@ -0,0 +1,98 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_STATS_HPP_
+#define _PK2UNPACK_STATS_HPP_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+namespace PK2Unpack {
+
+enum StatCounter {
+	STAT_ENTRIES=0,
+	STAT_BYTES_READ,
+	STAT_BYTES_INFLATED,
+	STAT_BYTES_WRITTEN,
+	STAT_BLOCKS_STORED,
+	STAT_BLOCKS_DEFLATED,
+	STAT_COUNTER_COUNT
+};
+
+enum StatTimer {
+	/* archive open/close */
+	STAT_TIME_OPEN=0,
+	/* header deserialization */
+	STAT_TIME_HEADER,
+	/* compressed data reads */
+	STAT_TIME_READ,
+	STAT_TIME_INFLATE,
+	STAT_TIME_WRITE,
+	/* output file open/close */
+	STAT_TIME_OUTPUT,
+	STAT_TIME_CLOSE,
+	STAT_TIMER_COUNT
+};
+
+/**
+	Per-thread counters.
+	Each thread owns one set; sets are only merged by Stats::print().
+*/
+struct ThreadStats {
+	uint64_t counters[STAT_COUNTER_COUNT];
+	uint64_t timers[STAT_TIMER_COUNT];
+	ThreadStats* next;
+};
+
+namespace Stats {
+
+// whether counters are collected (--stats); checked before any other work
+extern bool enabled;
+
+// get the calling thread's counters (created on first use)
+ThreadStats* local();
+
+inline uint64_t now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+inline void add(StatCounter counter, uint64_t value) {
+	if (__builtin_expect(enabled, 0)) {
+		local()->counters[counter]+=value;
+	}
+}
+
+// merge all thread counters and print them as text or JSON
+void print(FILE* out, bool json);
+
+} // namespace Stats
+
+// adds the time until destruction (or stop()) to a timer
+class StatScope {
+public:
+	StatScope(StatTimer timer) : _timer(timer), _start((__builtin_expect(Stats::enabled, 0)) ? Stats::now() : 0) {
+	};
+	~StatScope() {
+		stop();
+	};
+	void stop() {
+		if (_start!=0) {
+			Stats::local()->timers[_timer]+=Stats::now()-_start;
+			_start=0;
+		}
+	};
+	
+protected:
+	StatTimer _timer;
+	uint64_t _start;
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_STATS_HPP_
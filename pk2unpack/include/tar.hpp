@@ -0,0 +1,72 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_TAR_HPP_
+#define _PK2UNPACK_TAR_HPP_
+
+#include <time.h>
+#include <string>
+#include "sdpk2.hpp"
+#include "pathindex.hpp"
+
+namespace PK2Unpack {
+
+#define TAR_RECORD_SIZE 512
+
+/**
+	Buffered POSIX (ustar) tar writer.
+	Headers and data share one large buffer which is written with write(2), so many small
+	files cost a few large sequential writes. Names over 100 bytes (or sizes over 8 GiB)
+	get a pax extended header.
+*/
+class TarWriter {
+public:
+	TarWriter(int fd, size_t buffer_size=0x400000);
+	// flushes, but does not close fd
+	~TarWriter();
+	// write a regular file header; exactly size bytes must follow through write(), then endFile()
+	bool beginFile(const std::string& name, uint64_t size, time_t mtime);
+	bool write(const void* data, size_t size);
+	// zero-fill whatever is left of the file's data and pad it to a record
+	bool endFile();
+	// write the end-of-archive records and flush
+	bool finish();
+	bool flush();
+	bool failed() const {
+		return _failed;
+	};
+	
+protected:
+	int _fd;
+	char* _buffer;
+	size_t _size, _capacity;
+	uint64_t _file_size, _file_written;
+	bool _failed;
+	
+	bool append(const void* data, size_t size);
+	bool header(const char* name, uint64_t size, time_t mtime, char type);
+	
+	TarWriter(const TarWriter&);
+	TarWriter& operator=(const TarWriter&);
+};
+
+/**
+	Write every entry of an archive to one tar stream, in entry order.
+	Entries are decoded ahead on worker threads while the calling thread writes.
+	Names are the resolved SDMD2 paths (without the leading "/") when paths has the entry, otherwise the hash;
+	mtimes are the files' time_modified, otherwise the archive file's.
+	@returns The number of entries which failed to decode; they are reported on stderr and left out
+	(or zero-filled, for very large entries whose header was already written).
+	@param pak The open archive.
+	@param paths Path index for names (optional).
+	@param threads Number of decoding threads (0 means one per processor).
+	@param fd The output.
+*/
+size_t tarArchive(const SDPK2& pak, const PathIndex* paths, unsigned int threads, int fd);
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_TAR_HPP_
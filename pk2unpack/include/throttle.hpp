@@ -0,0 +1,128 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_THROTTLE_HPP_
+#define _PK2UNPACK_THROTTLE_HPP_
+
+#include <stdint.h>
+#include <pthread.h>
+
+namespace PK2Unpack {
+
+/**
+	Byte rate limit shared by any number of threads.
+	The bucket holds up to 100 ms of the rate (at least 1 MiB); a take() larger than that
+	is allowed when the bucket is full and paid back before the next one.
+*/
+class TokenBucket {
+public:
+	TokenBucket();
+	~TokenBucket();
+	// bytes per second; 0 means unlimited
+	void setRate(uint64_t rate);
+	uint64_t getRate() const {
+		return _rate;
+	};
+	// wait until n bytes may pass
+	void take(uint64_t n);
+
+protected:
+	pthread_mutex_t _lock;
+	uint64_t _rate;
+	double _burst;
+	double _tokens;
+	uint64_t _last;
+
+	void refill(uint64_t now);
+
+	TokenBucket(const TokenBucket&);
+	TokenBucket& operator=(const TokenBucket&);
+};
+
+// limit on the number of threads inside acquire()/release() at once
+class ThreadLimit {
+public:
+	ThreadLimit();
+	~ThreadLimit();
+	// 0 means unlimited; threads already inside are not interrupted
+	void setLimit(unsigned int limit);
+	unsigned int getLimit() const {
+		return _limit;
+	};
+	void acquire();
+	void release();
+
+protected:
+	pthread_mutex_t _lock;
+	pthread_cond_t _cond;
+	unsigned int _limit;
+	unsigned int _active;
+
+	ThreadLimit(const ThreadLimit&);
+	ThreadLimit& operator=(const ThreadLimit&);
+};
+
+// limits set with --max-read/--max-write/--max-inflate
+struct ThrottleLimits {
+	// bytes per second (0 for unlimited)
+	uint64_t read;
+	uint64_t write;
+	// concurrent block inflates (0 for unlimited)
+	unsigned int inflate;
+};
+
+namespace Throttle {
+
+// whether any limit or a control file is set; checked before any other work
+extern bool enabled;
+// compressed reads in Entry::readBlocks
+extern TokenBucket read;
+// StreamBlockHandler and TarWriter writes
+extern TokenBucket write;
+// decoder.inflateBlock() calls in Entry::readBlocks
+extern ThreadLimit inflate;
+
+/**
+	Apply the limits and enable throttling if any is set or control_path is given.
+	The control file holds "read=<MB/s>", "write=<MB/s>" and "inflate=<threads>" lines (0 for
+	unlimited, '#' starts a comment); keys it sets override limits. It is read now, again on
+	SIGHUP and whenever its modification time changes.
+	@returns false if the control file can not be parsed.
+*/
+bool start(const ThrottleLimits& limits, const char* control_path);
+// reload the control file if it is due; called by waiting threads
+void poll();
+// MB/s (MiB) to bytes per second; false if str is not a non-negative number
+bool parseRate(const char* str, uint64_t& value);
+// a thread count; false if str is not a non-negative integer
+bool parseThreads(const char* str, unsigned int& value);
+
+} // namespace Throttle
+
+// holds an inflate slot until destruction, if throttling is enabled
+class InflateSlot {
+public:
+	InflateSlot() : _held(__builtin_expect(Throttle::enabled, 0)) {
+		if (_held) {
+			Throttle::inflate.acquire();
+		}
+	};
+	~InflateSlot() {
+		if (_held) {
+			Throttle::inflate.release();
+		}
+	};
+
+protected:
+	bool _held;
+
+	InflateSlot(const InflateSlot&);
+	InflateSlot& operator=(const InflateSlot&);
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_THROTTLE_HPP_
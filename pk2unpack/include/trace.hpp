@@ -0,0 +1,85 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_TRACE_HPP_
+#define _PK2UNPACK_TRACE_HPP_
+
+#include <stdint.h>
+#include "stats.hpp"
+
+namespace PK2Unpack {
+
+// a completed span; name must be a string literal
+struct TraceEvent {
+	const char* name;
+	uint64_t start;
+	uint64_t duration;
+	uint64_t arg;
+};
+
+// number of spans kept per thread; older spans are overwritten
+#define TRACE_RING_SIZE 0x20000
+
+/**
+	Per-thread span ring buffer.
+*/
+struct ThreadTrace {
+	TraceEvent events[TRACE_RING_SIZE];
+	uint64_t count;
+	unsigned int tid;
+	ThreadTrace* next;
+};
+
+namespace Trace {
+
+// whether spans are recorded (--trace)
+extern bool enabled;
+
+// get the calling thread's ring buffer (created on first use)
+ThreadTrace* local();
+
+inline void record(const char* name, uint64_t start, uint64_t end, uint64_t arg) {
+	ThreadTrace* t=local();
+	TraceEvent& e=t->events[t->count++&(TRACE_RING_SIZE-1)];
+	e.name=name;
+	e.start=start;
+	e.duration=end-start;
+	e.arg=arg;
+}
+
+/**
+	Write all recorded spans as Chrome/Perfetto trace event JSON.
+	@returns false if the file could not be opened.
+	@param path The output path.
+*/
+bool write(const char* path);
+
+} // namespace Trace
+
+// records a span from construction until destruction (or stop())
+class TraceScope {
+public:
+	TraceScope(const char* name, uint64_t arg=0) : _name(name), _arg(arg), _start((__builtin_expect(Trace::enabled, 0)) ? Stats::now() : 0) {
+	};
+	~TraceScope() {
+		stop();
+	};
+	void stop() {
+		if (_start!=0) {
+			Trace::record(_name, _start, Stats::now(), _arg);
+			_start=0;
+		}
+	};
+	
+protected:
+	const char* _name;
+	uint64_t _arg;
+	uint64_t _start;
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_TRACE_HPP_
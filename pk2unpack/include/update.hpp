@@ -0,0 +1,74 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_UPDATE_HPP_
+#define _PK2UNPACK_UPDATE_HPP_
+
+#include <vector>
+#include "sdpk2.hpp"
+
+namespace PK2Unpack {
+
+/**
+	Adds and replaces entries of an existing archive without rewriting it.
+	New entry data is compressed and appended to the end of the file; commit() then rewrites
+	only the header (entries and comp_block_sizes, rebuilt compactly).
+	The space between the end of the header and the first entry data is slack for the header to grow into.
+	When the header outgrows it, the entries at the front of the data are copied (raw) to the end of
+	the file to make room, with extra slack for later updates.
+	Replaced and relocated data is left in place as dead space.
+*/
+class ArchiveUpdate {
+public:
+	ArchiveUpdate(SDPK2& pak, int level=Z_DEFAULT_COMPRESSION);
+	~ArchiveUpdate();
+	// open the archive file for writing; pak must be open
+	bool open();
+	/**
+		Set the contents of an entry, replacing the entry with the same hash or adding a new one.
+		The data is appended to the archive file immediately; the entry changes on commit().
+		@returns false if the data could not be written.
+	*/
+	bool setEntry(const MD5Hash& hash, const char* data, uint64_t size);
+	/**
+		Write the new header (relocating entry data if it does not fit) and update pak.
+		@returns false on a write error; the old header is only replaced after all data is written.
+	*/
+	bool commit();
+	void close();
+	uint64_t getAppendedBytes() const {
+		return _appended;
+	};
+	size_t getRelocatedCount() const {
+		return _relocated;
+	};
+	
+protected:
+	struct Pending {
+		Entry entry;
+		// comp_block_sizes values of the appended blocks
+		std::vector<size_t> table;
+	};
+	
+	SDPK2& _pak;
+	BlockEncoder _encoder;
+	int _fd;
+	uint64_t _end;
+	uint64_t _appended;
+	size_t _relocated;
+	std::vector<Pending> _pending;
+	std::vector<char> _buffer;
+	
+	bool append(const char* data, size_t size);
+	bool copyToEnd(uint64_t offset, uint64_t size);
+	
+	ArchiveUpdate(const ArchiveUpdate&);
+	ArchiveUpdate& operator=(const ArchiveUpdate&);
+};
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_UPDATE_HPP_
@@ -0,0 +1,36 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#ifndef _PK2UNPACK_VERIFY_HPP_
+#define _PK2UNPACK_VERIFY_HPP_
+
+#include <stdio.h>
+#include <vector>
+#include "sdpk2.hpp"
+
+namespace PK2Unpack {
+
+struct BlockFault {
+	unsigned int block;
+	int err;
+};
+
+typedef std::vector<BlockFault> BlockFaultVec;
+
+/**
+	Decode every entry of an archive into scratch buffers and report bad blocks.
+	Nothing is written except the report, one line per bad block:
+	"<hash> <block index> <error name>", followed by a "# entries:N bad_entries:N bad_blocks:N bytes:N" summary.
+	@returns The number of bad entries.
+	@param pak The open archive.
+	@param threads Number of decoding threads (0 means one per processor).
+	@param out The report stream.
+*/
+size_t verifyArchive(const SDPK2& pak, unsigned int threads, FILE* out);
+
+} // namespace PK2Unpack
+
+#endif // _PK2UNPACK_VERIFY_HPP_
@@ -7,37 +7,86 @@ local execpath=outpath..name
 if _ACTION == "clean" then
 	os.rmdir(outpath)
 	os.remove("pk2unpack")
+	os.rmdir("bench/out")
+	os.rmdir("include/gen")
+elseif _ACTION then
+	-- decoders generated from the format docs; see ../formats/formatgen.lua
+	dofile("../formats/formatgen.lua")
+	os.mkdir("include/gen")
+	local common={"../formats/common/common.format"}
+	formatgen.generate("SDPK2Format", "include/gen/sdpk2_format.hpp", "../formats/sdpk2/sdpk2.format", common)
+	formatgen.generate("SDMD2Format", "include/gen/sdmd2_format.hpp", "../formats/sdmd2/sdmd2.format", common)
 end
 
+newoption {
+	trigger="async",
+	description="Build the C++20 coroutine read API (include/async.hpp)"
+}
+
+newoption {
+	trigger="zstd",
+	description="Build zstd sidecar support (--transcode; include/sidecar.hpp)"
+}
+
 solution("pk2unpack")
 	configurations { "debug", "release" }
 
-local proj=project(name)
-proj.language="C++"
-proj.kind="ConsoleApp"
+-- settings shared by pk2unpack and the bench tools
+-- main_file replaces src/main.cpp when given
+local function setup_project(name, main_file)
+	local proj=project(name)
+	proj.language="C++"
+	proj.kind="ConsoleApp"
 
-configuration {"debug"}
-	targetdir(outpath)
-	objdir(outpath)
-	defines {"DEBUG", "_DEBUG"}
-	flags {"Symbols", "ExtraWarnings"}
+	configuration {"debug"}
+		targetdir(outpath)
+		objdir(outpath..name.."/")
+		defines {"DEBUG", "_DEBUG"}
+		flags {"Symbols", "ExtraWarnings"}
 
-configuration {"release"}
-	targetdir(outpath)
-	objdir(outpath)
-	defines{"NDEBUG", "RELEASE"}
-	flags {"Optimize", "ExtraWarnings"}
+	configuration {"release"}
+		targetdir(outpath)
+		objdir(outpath..name.."/")
+		defines{"NDEBUG", "RELEASE"}
+		flags {"Optimize", "ExtraWarnings"}
 
-configuration {"gmake"}
-	links {"z", "duct", "icui18n", "icudata", "icuio", "icuuc"}
-	postbuildcommands {"cp "..execpath.." ../"..name}
+	configuration {"gmake"}
+		-- variadic templates (staticformat.hpp), std::to_chars (formatwriter.cpp)
+		if _OPTIONS["async"] then
+			buildoptions {"-std=c++20"}
+			defines {"PK2UNPACK_ASYNC"}
+		else
+			buildoptions {"-std=c++17"}
+		end
+		links {"z", "pthread", "duct", "icui18n", "icudata", "icuio", "icuuc"}
+		if _OPTIONS["zstd"] then
+			defines {"PK2UNPACK_ZSTD"}
+			links {"zstd"}
+		end
 
-configuration {"linux"}
-	defines{"PLATFORM_CHECKED", "UNIX_BUILD"}
+	configuration {"linux"}
+		defines{"PLATFORM_CHECKED", "UNIX_BUILD"}
 
-configuration {}
+	configuration {}
 
-files {"include/*.hpp", "src/*.cpp"}
-includedirs {
-	"include/"
-}
+	files {"include/*.hpp", "include/gen/*.hpp", "src/*.cpp"}
+	if main_file then
+		files {main_file}
+		excludes {"src/main.cpp"}
+	end
+	includedirs {
+		"include/"
+	}
+	return proj
+end
+
+setup_project(name)
+	configuration {"gmake"}
+		postbuildcommands {"cp "..execpath.." ../"..name}
+	configuration {}
+
+-- synthetic archive generator; see bench/run.sh
+setup_project("pk2gen", "bench/gen.cpp")
+
+-- benchmarks over an archive; see bench/run.sh
+setup_project("pk2bench", "bench/bench.cpp")
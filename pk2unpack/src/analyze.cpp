@@ -0,0 +1,158 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <string.h>
+#include "analyze.hpp"
+
+namespace PK2Unpack {
+
+// class ArchiveAnalysis implementation
+
+void ArchiveAnalysis::clear() {
+	_entries.clear();
+	_uc_total=_c_total=0;
+	_stored_blocks=_deflated_blocks=0;
+	_stored_bytes=_table_size=_table_unused=0;
+	_empty_entries=_bad_entries=0;
+	_block_size=0;
+	memset(_size_hist, 0, sizeof(_size_hist));
+	memset(_block_hist, 0, sizeof(_block_hist));
+	memset(_ratio_hist, 0, sizeof(_ratio_hist));
+}
+
+static inline unsigned int __size_bucket(uint64_t size) {
+	unsigned int b=(size==0) ? 0 : 64-__builtin_clzll(size);
+	return (b<ANALYSIS_SIZE_BUCKETS) ? b : ANALYSIS_SIZE_BUCKETS-1;
+}
+
+void ArchiveAnalysis::analyze(const SDPK2& pak) {
+	clear();
+	const EntryVec& entries=pak.getEntries();
+	const BlockSizeTable& table=pak.getBlockSizeTable();
+	const size_t* tdata=table.empty() ? NULL : &table[0];
+	_block_size=pak.getBlockSize();
+	_table_size=table.size();
+	_entries.resize(entries.size());
+	if (_block_size==0) {
+		return;
+	}
+	size_t block_step=(_block_size+ANALYSIS_BLOCK_BUCKETS-1)/ANALYSIS_BLOCK_BUCKETS;
+	uint64_t referenced=0;
+	for (size_t i=0; i<entries.size(); ++i) {
+		const Entry& e=entries[i];
+		EntryAnalysis& ea=_entries[i];
+		uint64_t size=e.getSize();
+		size_t first=e.getBlockSizeIndex();
+		size_t count=(size+_block_size-1)/_block_size;
+		ea.c_size=0;
+		ea.stored=ea.deflated=0;
+		_size_hist[__size_bucket(size)]++;
+		_uc_total+=size;
+		if (size==0) {
+			_empty_entries++;
+			continue;
+		}
+		if (first>=table.size() || count>table.size()-first) {
+			_bad_entries++;
+			continue;
+		}
+		referenced+=count;
+		// tight loop over the entry's slice of the block table; vectorizes
+		const size_t* slice=tdata+first;
+		uint64_t sum=0;
+		uint32_t zeros=0;
+		for (size_t k=0; k<count; ++k) {
+			sum+=slice[k];
+			zeros+=(slice[k]==0);
+		}
+		size_t last_uc=size-(count-1)*_block_size;
+		// a last block the size of its remaining data is stored (see Entry::readBlocks)
+		uint32_t stored_last=(slice[count-1]!=0 && slice[count-1]==last_uc);
+		ea.c_size=sum+(uint64_t)zeros*_block_size;
+		ea.stored=zeros+stored_last;
+		ea.deflated=count-ea.stored;
+		_stored_bytes+=(uint64_t)zeros*_block_size+((stored_last) ? last_uc : 0);
+		for (size_t k=0; k<count; ++k) {
+			size_t c=slice[k];
+			if (c!=0 && !(stored_last && k+1==count)) {
+				size_t b=c/block_step;
+				_block_hist[(b<ANALYSIS_BLOCK_BUCKETS) ? b : ANALYSIS_BLOCK_BUCKETS-1]++;
+			}
+		}
+		_c_total+=ea.c_size;
+		_stored_blocks+=ea.stored;
+		_deflated_blocks+=ea.deflated;
+		size_t r=(size_t)((ea.c_size*10)/size);
+		_ratio_hist[(r<ANALYSIS_RATIO_BUCKETS) ? r : ANALYSIS_RATIO_BUCKETS-1]++;
+	}
+	_table_unused=(referenced<_table_size) ? _table_size-referenced : 0;
+}
+
+static double __percent(uint64_t part, uint64_t whole) {
+	return (whole==0) ? 0.0 : (100.0*(double)part)/(double)whole;
+}
+
+void ArchiveAnalysis::printText(FILE* out) const {
+	uint64_t blocks=_stored_blocks+_deflated_blocks;
+	fprintf(out, "entries: %lu (empty: %lu, bad block range: %lu)\n", (unsigned long)_entries.size(), (unsigned long)_empty_entries, (unsigned long)_bad_entries);
+	fprintf(out, "uncompressed: %lu bytes\n", (unsigned long)_uc_total);
+	fprintf(out, "compressed: %lu bytes (%.2f%%)\n", (unsigned long)_c_total, __percent(_c_total, _uc_total));
+	fprintf(out, "blocks: %lu (size: %lu, table: %lu, unreferenced: %lu)\n", (unsigned long)blocks, (unsigned long)_block_size, (unsigned long)_table_size, (unsigned long)_table_unused);
+	fprintf(out, "\tstored: %lu (%.2f%%, %lu bytes)\n", (unsigned long)_stored_blocks, __percent(_stored_blocks, blocks), (unsigned long)_stored_bytes);
+	fprintf(out, "\tdeflated: %lu (%.2f%%)\n", (unsigned long)_deflated_blocks, __percent(_deflated_blocks, blocks));
+	fprintf(out, "entry sizes:\n");
+	for (unsigned int i=0; i<ANALYSIS_SIZE_BUCKETS; ++i) {
+		if (_size_hist[i]==0) {
+			continue;
+		} else if (i==0) {
+			fprintf(out, "\t%12s : %lu\n", "0", (unsigned long)_size_hist[i]);
+		} else {
+			fprintf(out, "\t< %10lu : %lu\n", (unsigned long)(1ull<<i), (unsigned long)_size_hist[i]);
+		}
+	}
+	size_t block_step=(_block_size+ANALYSIS_BLOCK_BUCKETS-1)/ANALYSIS_BLOCK_BUCKETS;
+	fprintf(out, "deflated block sizes:\n");
+	for (unsigned int i=0; i<ANALYSIS_BLOCK_BUCKETS; ++i) {
+		fprintf(out, "\t< %10lu : %lu\n", (unsigned long)((i+1)*block_step), (unsigned long)_block_hist[i]);
+	}
+	fprintf(out, "entry ratios:\n");
+	for (unsigned int i=0; i<ANALYSIS_RATIO_BUCKETS; ++i) {
+		fprintf(out, "\t%s%3u%% : %lu\n", (i+1<ANALYSIS_RATIO_BUCKETS) ? "< " : ">=", (i+1<ANALYSIS_RATIO_BUCKETS) ? (i+1)*10 : 100, (unsigned long)_ratio_hist[i]);
+	}
+}
+
+static void __print_json_array(FILE* out, const uint64_t* values, unsigned int count) {
+	fputc('[', out);
+	for (unsigned int i=0; i<count; ++i) {
+		fprintf(out, (i==0) ? "%lu" : ",%lu", (unsigned long)values[i]);
+	}
+	fputc(']', out);
+}
+
+void ArchiveAnalysis::printJSON(FILE* out, const SDPK2& pak) const {
+	fprintf(out, "{\"entry_count\":%lu,\"empty_entries\":%lu,\"bad_entries\":%lu,", (unsigned long)_entries.size(), (unsigned long)_empty_entries, (unsigned long)_bad_entries);
+	fprintf(out, "\"uncompressed_bytes\":%lu,\"compressed_bytes\":%lu,", (unsigned long)_uc_total, (unsigned long)_c_total);
+	fprintf(out, "\"block_size\":%lu,\"table_size\":%lu,\"table_unreferenced\":%lu,", (unsigned long)_block_size, (unsigned long)_table_size, (unsigned long)_table_unused);
+	fprintf(out, "\"stored_blocks\":%lu,\"stored_bytes\":%lu,\"deflated_blocks\":%lu,", (unsigned long)_stored_blocks, (unsigned long)_stored_bytes, (unsigned long)_deflated_blocks);
+	fprintf(out, "\"size_histogram_log2\":");
+	__print_json_array(out, _size_hist, ANALYSIS_SIZE_BUCKETS);
+	fprintf(out, ",\"block_histogram\":");
+	__print_json_array(out, _block_hist, ANALYSIS_BLOCK_BUCKETS);
+	fprintf(out, ",\"ratio_histogram\":");
+	__print_json_array(out, _ratio_hist, ANALYSIS_RATIO_BUCKETS);
+	fprintf(out, ",\"entries\":[");
+	const EntryVec& entries=pak.getEntries();
+	char hash_str[32];
+	for (size_t i=0; i<_entries.size() && i<entries.size(); ++i) {
+		const EntryAnalysis& ea=_entries[i];
+		entries[i].hash().getExisting(hash_str, false);
+		fprintf(out, "%s\n{\"hash\":\"%.*s\",\"size\":%lu,\"compressed\":%lu,\"stored\":%u,\"deflated\":%u}", (i==0) ? "" : ",", 32, hash_str,
+			(unsigned long)entries[i].getSize(), (unsigned long)ea.c_size, ea.stored, ea.deflated);
+	}
+	fprintf(out, "]}\n");
+}
+
+} // namespace PK2Unpack
@@ -0,0 +1,242 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include "async.hpp"
+
+#if defined(PK2UNPACK_ASYNC)
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include "parallel.hpp"
+
+namespace PK2Unpack {
+
+// class ThreadPoolExecutor implementation
+
+ThreadPoolExecutor::ThreadPoolExecutor(unsigned int threads) : _stop(false) {
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_wake, NULL);
+	if (threads==0) {
+		threads=getHardwareThreads();
+	}
+	for (unsigned int i=0; i<threads; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, worker, this)==0) {
+			_threads.push_back(thread);
+		}
+	}
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor() {
+	pthread_mutex_lock(&_lock);
+	_stop=true;
+	pthread_cond_broadcast(&_wake);
+	pthread_mutex_unlock(&_lock);
+	for (size_t i=0; i<_threads.size(); ++i) {
+		pthread_join(_threads[i], NULL);
+	}
+	pthread_cond_destroy(&_wake);
+	pthread_mutex_destroy(&_lock);
+}
+
+void ThreadPoolExecutor::post(std::coroutine_handle<> handle) {
+	pthread_mutex_lock(&_lock);
+	_queue.push_back(handle);
+	pthread_cond_signal(&_wake);
+	pthread_mutex_unlock(&_lock);
+}
+
+void* ThreadPoolExecutor::worker(void* arg) {
+	ThreadPoolExecutor* ex=(ThreadPoolExecutor*)arg;
+	pthread_mutex_lock(&ex->_lock);
+	while (true) {
+		while (ex->_queue.empty() && !ex->_stop) {
+			pthread_cond_wait(&ex->_wake, &ex->_lock);
+		}
+		if (ex->_queue.empty()) {
+			break;
+		}
+		std::coroutine_handle<> handle=ex->_queue.front();
+		ex->_queue.pop_front();
+		pthread_mutex_unlock(&ex->_lock);
+		handle.resume();
+		pthread_mutex_lock(&ex->_lock);
+	}
+	pthread_mutex_unlock(&ex->_lock);
+	return NULL;
+}
+
+// class EventLoopExecutor implementation
+
+EventLoopExecutor::EventLoopExecutor(WakeFunc wake, void* data) : _wake(wake), _data(data) {
+	pthread_mutex_init(&_lock, NULL);
+}
+
+EventLoopExecutor::~EventLoopExecutor() {
+	pthread_mutex_destroy(&_lock);
+}
+
+void EventLoopExecutor::post(std::coroutine_handle<> handle) {
+	pthread_mutex_lock(&_lock);
+	bool was_empty=_queue.empty();
+	_queue.push_back(handle);
+	pthread_mutex_unlock(&_lock);
+	// one wake per batch; the loop drains everything in runPending()
+	if (was_empty && _wake) {
+		_wake(_data);
+	}
+}
+
+size_t EventLoopExecutor::runPending() {
+	std::vector<std::coroutine_handle<> > batch;
+	pthread_mutex_lock(&_lock);
+	batch.swap(_queue);
+	pthread_mutex_unlock(&_lock);
+	for (size_t i=0; i<batch.size(); ++i) {
+		batch[i].resume();
+	}
+	return batch.size();
+}
+
+// class AsyncArchive implementation
+
+static bool __entry_hash_less(const Entry* x, const Entry* y) {
+	return x->hash().compare(y->hash())<0;
+}
+
+// one decoder per CPU executor thread
+static BlockDecoder& __thread_decoder() {
+	static thread_local BlockDecoder decoder;
+	return decoder;
+}
+
+AsyncArchive::AsyncArchive(const SDPK2& pak, Executor& io, Executor& cpu, Executor* completion) : _pak(pak), _io(io), _cpu(cpu), _completion(completion), _fd(-1) {
+	const EntryVec& entries=_pak.getEntries();
+	_index.resize(entries.size());
+	for (size_t i=0; i<entries.size(); ++i) {
+		_index[i]=&entries[i];
+	}
+	std::stable_sort(_index.begin(), _index.end(), __entry_hash_less);
+}
+
+AsyncArchive::~AsyncArchive() {
+	close();
+}
+
+bool AsyncArchive::open() {
+	if (_fd<0) {
+		_fd=::open(_pak.getPath(), O_RDONLY);
+		if (_fd<0) {
+			printf("ERROR: Failed to open SDPK2 file: %s\n", _pak.getPath());
+			return false;
+		}
+	}
+	return true;
+}
+
+void AsyncArchive::close() {
+	if (_fd>=0) {
+		::close(_fd);
+		_fd=-1;
+	}
+}
+
+const Entry* AsyncArchive::findEntry(const MD5Hash& hash) const {
+	Entry key(hash, 0, 0, 0);
+	std::vector<const Entry*>::const_iterator it=std::lower_bound(_index.begin(), _index.end(), &key, __entry_hash_less);
+	return (it!=_index.end() && (*it)->hash().compare(hash)==0) ? *it : NULL;
+}
+
+bool AsyncArchive::readCompressed(uint64_t offset, uint64_t size, PooledBuffer& out) const {
+	if (!out.allocate(size)) {
+		return false;
+	}
+	uint64_t done=0;
+	while (done<size) {
+		ssize_t n=pread(_fd, out.data()+done, size-done, offset+done);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<=0) {
+			return false;
+		}
+		done+=n;
+	}
+	return true;
+}
+
+AsyncTask<AsyncResult> AsyncArchive::readEntry(const MD5Hash& hash) {
+	const Entry* entry=findEntry(hash);
+	if (!entry) {
+		AsyncResult result;
+		result.err=READERR_NOTFOUND;
+		co_return result;
+	}
+	co_return co_await readEntry(*entry);
+}
+
+AsyncTask<AsyncResult> AsyncArchive::readEntry(const Entry& entry) {
+	AsyncResult result;
+	PooledBuffer raw;
+	uint64_t start, c_size;
+	co_await _io.schedule();
+	result.err=entry.getCompressedRange(_pak, 0, 0xFFFFFFFF, start, c_size);
+	if (result.err==READERR_NONE && !readCompressed(start, c_size, raw)) {
+		result.err=READERR_READ;
+	}
+	if (result.err==READERR_NONE) {
+		co_await _cpu.schedule();
+		MemoryBlockSource source(raw.data(), c_size, start);
+		result.err=entry.readToBuffer(source, _pak, result.data, __thread_decoder());
+		raw.reset();
+	}
+	if (_completion) {
+		co_await _completion->schedule();
+	}
+	co_return result;
+}
+
+AsyncTask<AsyncResult> AsyncArchive::readRange(const Entry& entry, uint64_t offset, uint64_t size) {
+	AsyncResult result;
+	result.err=READERR_NONE;
+	if (offset>entry.getSize() || size>entry.getSize()-offset) {
+		result.err=READERR_LENGTH;
+	} else if (size>0) {
+		PooledBuffer raw;
+		uint64_t start, c_size;
+		size_t block_size=_pak.getBlockSize();
+		unsigned int first=offset/block_size;
+		unsigned int last=(offset+size-1)/block_size;
+		co_await _io.schedule();
+		result.err=entry.getCompressedRange(_pak, first, last-first+1, start, c_size);
+		if (result.err==READERR_NONE && !readCompressed(start, c_size, raw)) {
+			result.err=READERR_READ;
+		}
+		if (result.err==READERR_NONE) {
+			co_await _cpu.schedule();
+			if (!result.data.allocate(size)) {
+				result.err=READERR_WRITE;
+			} else {
+				MemoryBlockSource source(raw.data(), c_size, start);
+				result.err=entry.readRange(source, _pak, offset, size, result.data.data(), __thread_decoder());
+			}
+			raw.reset();
+		}
+	}
+	if (result.err!=READERR_NONE) {
+		result.data.reset();
+	}
+	if (_completion) {
+		co_await _completion->schedule();
+	}
+	co_return result;
+}
+
+} // namespace PK2Unpack
+
+#endif // defined(PK2UNPACK_ASYNC)
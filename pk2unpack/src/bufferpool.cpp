@@ -0,0 +1,108 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdlib.h>
+#include "bufferpool.hpp"
+
+namespace PK2Unpack {
+
+// class BufferPool implementation
+
+static unsigned int __size_class(size_t size) {
+	unsigned int c=BUFFERPOOL_MIN_CLASS;
+	while (c<64 && ((size_t)1<<c)<size) {
+		++c;
+	}
+	return c;
+}
+
+BufferPool::BufferPool(size_t max_cached) : _max_cached(max_cached), _cached(0) {
+	pthread_mutex_init(&_lock, NULL);
+}
+
+BufferPool::~BufferPool() {
+	trim();
+	pthread_mutex_destroy(&_lock);
+}
+
+char* BufferPool::acquire(size_t size, size_t& capacity) {
+	unsigned int c=__size_class(size);
+	if (c>BUFFERPOOL_MAX_CLASS) {
+		capacity=size;
+		return (char*)malloc((size>0) ? size : 1);
+	}
+	capacity=(size_t)1<<c;
+	std::vector<char*>& list=_free[c-BUFFERPOOL_MIN_CLASS];
+	pthread_mutex_lock(&_lock);
+	if (!list.empty()) {
+		char* buf=list.back();
+		list.pop_back();
+		_cached-=capacity;
+		pthread_mutex_unlock(&_lock);
+		return buf;
+	}
+	pthread_mutex_unlock(&_lock);
+	return (char*)malloc(capacity);
+}
+
+void BufferPool::release(char* buf, size_t capacity) {
+	if (!buf) {
+		return;
+	}
+	unsigned int c=__size_class(capacity);
+	if (c<=BUFFERPOOL_MAX_CLASS && ((size_t)1<<c)==capacity) {
+		pthread_mutex_lock(&_lock);
+		if (_cached+capacity<=_max_cached) {
+			_free[c-BUFFERPOOL_MIN_CLASS].push_back(buf);
+			_cached+=capacity;
+			buf=NULL;
+		}
+		pthread_mutex_unlock(&_lock);
+	}
+	free(buf);
+}
+
+void BufferPool::trim() {
+	pthread_mutex_lock(&_lock);
+	for (unsigned int i=0; i<BUFFERPOOL_CLASSES; ++i) {
+		for (size_t k=0; k<_free[i].size(); ++k) {
+			free(_free[i][k]);
+		}
+		_free[i].clear();
+	}
+	_cached=0;
+	pthread_mutex_unlock(&_lock);
+}
+
+BufferPool& BufferPool::global() {
+	static BufferPool pool;
+	return pool;
+}
+
+// class PooledBuffer implementation
+
+bool PooledBuffer::allocate(size_t size, BufferPool& pool) {
+	reset();
+	_data=pool.acquire(size, _capacity);
+	if (!_data) {
+		_capacity=0;
+		return false;
+	}
+	_pool=&pool;
+	_size=size;
+	return true;
+}
+
+void PooledBuffer::reset() {
+	if (_pool) {
+		_pool->release(_data, _capacity);
+	}
+	_pool=NULL;
+	_data=NULL;
+	_size=_capacity=0;
+}
+
+} // namespace PK2Unpack
@@ -0,0 +1,78 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include "byteorder.hpp"
+
+#if defined(__x86_64__)
+#include <tmmintrin.h>
+#endif
+
+namespace PK2Unpack {
+
+template<typename T>
+static void __load_array_sw(T* dst, const unsigned char* src, size_t count) {
+	for (size_t i=0; i<count; ++i) {
+		dst[i]=loadBE<T>(src+i*sizeof(T));
+	}
+}
+
+#if defined(__x86_64__)
+static const bool __byteorder_ssse3=__builtin_cpu_supports("ssse3");
+
+// reverses the bytes of each elem_size element in a 16-byte lane
+__attribute__((target("ssse3")))
+static size_t __load_array_ssse3(unsigned char* dst, const unsigned char* src, size_t size, size_t elem_size) {
+	unsigned char order[16];
+	for (unsigned int i=0; i<16; ++i) {
+		order[i]=(unsigned char)((i/elem_size)*elem_size+(elem_size-1-i%elem_size));
+	}
+	__m128i mask=_mm_loadu_si128((const __m128i*)order);
+	size_t i=0;
+	for (; i+64<=size; i+=64) {
+		__m128i a=_mm_loadu_si128((const __m128i*)(src+i));
+		__m128i b=_mm_loadu_si128((const __m128i*)(src+i+16));
+		__m128i c=_mm_loadu_si128((const __m128i*)(src+i+32));
+		__m128i d=_mm_loadu_si128((const __m128i*)(src+i+48));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_shuffle_epi8(a, mask));
+		_mm_storeu_si128((__m128i*)(dst+i+16), _mm_shuffle_epi8(b, mask));
+		_mm_storeu_si128((__m128i*)(dst+i+32), _mm_shuffle_epi8(c, mask));
+		_mm_storeu_si128((__m128i*)(dst+i+48), _mm_shuffle_epi8(d, mask));
+	}
+	for (; i+16<=size; i+=16) {
+		__m128i a=_mm_loadu_si128((const __m128i*)(src+i));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_shuffle_epi8(a, mask));
+	}
+	return i;
+}
+#endif
+
+void loadArrayBE(void* dst, const void* src, size_t count, size_t elem_size) {
+	unsigned char* d=(unsigned char*)dst;
+	const unsigned char* s=(const unsigned char*)src;
+	if (elem_size==1) {
+		memcpy(d, s, count);
+		return;
+	}
+#if __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+#if defined(__x86_64__)
+	if (__byteorder_ssse3) {
+		size_t done=__load_array_ssse3(d, s, count*elem_size, elem_size);
+		d+=done;
+		s+=done;
+		count-=done/elem_size;
+	}
+#endif
+	switch (elem_size) {
+	case 2: __load_array_sw((uint16_t*)d, s, count); break;
+	case 4: __load_array_sw((uint32_t*)d, s, count); break;
+	case 8: __load_array_sw((uint64_t*)d, s, count); break;
+	}
+#else
+	memcpy(d, s, count*elem_size);
+#endif
+}
+
+} // namespace PK2Unpack
@@ -0,0 +1,96 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <string.h>
+#include "crc32c.hpp"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace PK2Unpack {
+
+// class CRC32C implementation
+
+#define __crc32c_poly 0x82F63B78
+
+static uint32_t __crc32c_table[8][256];
+
+static bool __crc32c_init() {
+	for (unsigned int i=0; i<256; ++i) {
+		uint32_t crc=i;
+		for (unsigned int k=0; k<8; ++k) {
+			crc=(crc&1) ? (crc>>1)^__crc32c_poly : crc>>1;
+		}
+		__crc32c_table[0][i]=crc;
+	}
+	for (unsigned int i=0; i<256; ++i) {
+		uint32_t crc=__crc32c_table[0][i];
+		for (unsigned int t=1; t<8; ++t) {
+			crc=__crc32c_table[0][crc&0xFF]^(crc>>8);
+			__crc32c_table[t][i]=crc;
+		}
+	}
+#if defined(__x86_64__)
+	return __builtin_cpu_supports("sse4.2");
+#else
+	return false;
+#endif
+}
+
+// initialized before main(), so worker threads never race on the tables
+static const bool __crc32c_hw=__crc32c_init();
+
+static uint32_t __crc32c_sw(uint32_t crc, const unsigned char* p, size_t size) {
+	while (size>=8) {
+		uint32_t lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p+4, 4);
+		lo^=crc;
+		crc=__crc32c_table[7][lo&0xFF]^__crc32c_table[6][(lo>>8)&0xFF]
+			^__crc32c_table[5][(lo>>16)&0xFF]^__crc32c_table[4][lo>>24]
+			^__crc32c_table[3][hi&0xFF]^__crc32c_table[2][(hi>>8)&0xFF]
+			^__crc32c_table[1][(hi>>16)&0xFF]^__crc32c_table[0][hi>>24];
+		p+=8;
+		size-=8;
+	}
+	while (size--) {
+		crc=__crc32c_table[0][(crc^*p++)&0xFF]^(crc>>8);
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t __crc32c_sse42(uint32_t crc, const unsigned char* p, size_t size) {
+	uint64_t crc64=crc;
+	while (size>=8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		crc64=_mm_crc32_u64(crc64, v);
+		p+=8;
+		size-=8;
+	}
+	crc=(uint32_t)crc64;
+	while (size--) {
+		crc=_mm_crc32_u8(crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+uint32_t CRC32C::compute(const void* data, size_t size, uint32_t crc) {
+	const unsigned char* p=(const unsigned char*)data;
+	crc=~crc;
+#if defined(__x86_64__)
+	if (__crc32c_hw) {
+		return ~__crc32c_sse42(crc, p, size);
+	}
+#endif
+	return ~__crc32c_sw(crc, p, size);
+}
+
+} // namespace PK2Unpack
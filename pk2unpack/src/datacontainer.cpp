@@ -52,7 +52,8 @@ bool DataContainer::print_float(const DataFormat& f, size_t& pos) const {
 
 bool DataContainer::print_string(const DataFormat& f, size_t& pos) const {
 	if (f.type==FORMATTYPE_STRING_NULLTERM) {
-		size_t size=strnlen(_data+pos, (f.maxsize>0) ? f.maxsize : _size-pos);
+		size_t limit=(f.maxsize>0 && f.maxsize<_size-pos) ? f.maxsize : _size-pos;
+		size_t size=strnlen(_data+pos, limit);
 		if (size==_size && _data[_size-1]!=0x00) {
 			printf("nz%.*s", (unsigned int)size, _data+pos);
 		} else {
@@ -63,7 +64,7 @@ bool DataContainer::print_string(const DataFormat& f, size_t& pos) const {
 		if (pos+f.maxsize>_size) {
 			return false;
 		}
-		printf("%.*s", (unsigned int)f.maxsize, _data);
+		printf("%.*s", (unsigned int)f.maxsize, _data+pos);
 		pos+=f.maxsize;
 	}
 	return true;
@@ -75,7 +76,7 @@ const char* __hex_fmt_lower="%02x%.*s";
 void DataContainer::print_hex(const DataFormat& f, size_t& pos) const {
 	const char* fmt=(f.type==FORMATTYPE_HEX || f.type==FORMATTYPE_HEX_SPACELESS) ? __hex_fmt_normal : __hex_fmt_lower;
 	bool nsp=f.type==FORMATTYPE_HEX_SPACELESS || f.type==FORMATTYPE_HEX_LOWER_SPACELESS;
-	size_t count=(f.maxsize!=0) ? pos+f.maxsize : _size-pos;
+	size_t count=(f.maxsize!=0) ? f.maxsize : _size-pos;
 	size_t i=0;
 	while (i++<count && pos!=_size) {
 		printf(fmt, (unsigned char)_data[pos++], (nsp || i==count) ? 0 : 1, " ");
@@ -110,7 +111,7 @@ int DataContainer::print(const DataFormat* format) const {
 				printf("%db", _data[pos++]);
 				break;
 			case FORMATTYPE_UBYTE:
-				printf("%uub", _data[pos++]);
+				printf("%uub", (unsigned char)_data[pos++]);
 				break;
 			case FORMATTYPE_CHAR:
 				printf("'%c'", _data[pos++]);
@@ -150,6 +151,7 @@ int DataContainer::print(const DataFormat* format) const {
 			case FORMATTYPE_SET:
 				pos=f.maxsize;
 				printf("#%lu", f.maxsize);
+				break;
 			default:
 				debug_assertp(false, this, "unhandled format type");
 				break;
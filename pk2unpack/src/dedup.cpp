@@ -0,0 +1,317 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <linux/fs.h>
+#include "parallel.hpp"
+#include "crc32c.hpp"
+#include "dedup.hpp"
+
+namespace PK2Unpack {
+
+#define DEDUP_CHUNK_SIZE 0x10000
+
+struct __DedupInfo {
+	uint64_t size;
+	uint64_t c_offset, c_size;
+	size_t block_size;
+	int comp_method;
+	uint32_t crc;
+	size_t ref;
+};
+
+// orders by everything but the fingerprint, then by ref
+struct __DedupShapeLess {
+	bool operator()(const __DedupInfo& x, const __DedupInfo& y) const {
+		if (x.size!=y.size) {
+			return x.size<y.size;
+		} else if (x.c_size!=y.c_size) {
+			return x.c_size<y.c_size;
+		} else if (x.block_size!=y.block_size) {
+			return x.block_size<y.block_size;
+		} else if (x.comp_method!=y.comp_method) {
+			return x.comp_method<y.comp_method;
+		}
+		return x.ref<y.ref;
+	};
+	static bool same(const __DedupInfo& x, const __DedupInfo& y) {
+		return x.size==y.size && x.c_size==y.c_size && x.block_size==y.block_size && x.comp_method==y.comp_method;
+	};
+};
+
+struct __DedupFingerprintLess {
+	bool operator()(const __DedupInfo& x, const __DedupInfo& y) const {
+		if (!__DedupShapeLess::same(x, y)) {
+			return __DedupShapeLess()(x, y);
+		} else if (x.crc!=y.crc) {
+			return x.crc<y.crc;
+		}
+		return x.ref<y.ref;
+	};
+};
+
+// per-thread read streams, opened on first use
+class DedupStreams {
+public:
+	DedupStreams(const std::vector<const SDPK2*>& paks) : _paks(paks), _streams(paks.size(), (Stream*)NULL), _buffer(new char[DEDUP_CHUNK_SIZE*2]) {
+	};
+	~DedupStreams() {
+		for (size_t i=0; i<_streams.size(); ++i) {
+			SDPK2::closeDataStream(_streams[i]);
+		}
+		delete[] _buffer;
+	};
+	Stream* get(uint32_t archive) {
+		if (!_streams[archive]) {
+			_streams[archive]=_paks[archive]->openDataStream();
+		}
+		return _streams[archive];
+	};
+	// read size bytes at offset into the first (0) or second (1) chunk buffer
+	const char* read(uint32_t archive, uint64_t offset, size_t size, unsigned int which) {
+		Stream* stream=get(archive);
+		char* buf=_buffer+which*DEDUP_CHUNK_SIZE;
+		if (!stream) {
+			return NULL;
+		}
+		if (stream->pos()!=offset) {
+			stream->seek(offset);
+		}
+		return (stream->read(buf, size)==size) ? buf : NULL;
+	};
+
+protected:
+	const std::vector<const SDPK2*>& _paks;
+	std::vector<Stream*> _streams;
+	char* _buffer;
+
+	DedupStreams(const DedupStreams&);
+	DedupStreams& operator=(const DedupStreams&);
+};
+
+class DedupFingerprintTask : public ParallelTask {
+public:
+	DedupFingerprintTask(const std::vector<const SDPK2*>& paks, const std::vector<DedupRef>& refs, std::vector<__DedupInfo>& infos, unsigned int threads)
+		: _paks(paks), _refs(refs), _infos(infos), _streams(threads, (DedupStreams*)NULL) {
+	};
+	void begin(unsigned int thread) {
+		_streams[thread]=new DedupStreams(_paks);
+	};
+	void run(size_t index, unsigned int thread) {
+		__DedupInfo& info=_infos[index];
+		uint32_t archive=_refs[info.ref].archive;
+		uint32_t crc=0;
+		for (uint64_t done=0; done<info.c_size; ) {
+			size_t n=(info.c_size-done<DEDUP_CHUNK_SIZE) ? (size_t)(info.c_size-done) : DEDUP_CHUNK_SIZE;
+			const char* data=_streams[thread]->read(archive, info.c_offset+done, n, 0);
+			if (!data) {
+				// unreadable entries never match; they are extracted (and fail) on their own
+				crc=0;
+				info.c_size=0;
+				break;
+			}
+			crc=CRC32C::compute(data, n, crc);
+			done+=n;
+		}
+		info.crc=crc;
+	};
+	void end(unsigned int thread) {
+		delete _streams[thread];
+		_streams[thread]=NULL;
+	};
+
+protected:
+	const std::vector<const SDPK2*>& _paks;
+	const std::vector<DedupRef>& _refs;
+	std::vector<__DedupInfo>& _infos;
+	std::vector<DedupStreams*> _streams;
+};
+
+// confirms each run of equal fingerprints against the run's first entries
+class DedupConfirmTask : public ParallelTask {
+public:
+	DedupConfirmTask(const std::vector<const SDPK2*>& paks, const std::vector<DedupRef>& refs, const std::vector<__DedupInfo>& infos, const std::vector<size_t>& runs, std::vector<long>& source, unsigned int threads)
+		: _paks(paks), _refs(refs), _infos(infos), _runs(runs), _source(source), _streams(threads, (DedupStreams*)NULL) {
+	};
+	void begin(unsigned int thread) {
+		_streams[thread]=new DedupStreams(_paks);
+	};
+	void run(size_t index, unsigned int thread) {
+		std::vector<size_t> sources;
+		for (size_t i=_runs[index*2]; i<_runs[index*2+1]; ++i) {
+			size_t k=0;
+			for (; k<sources.size(); ++k) {
+				if (same(_infos[sources[k]], _infos[i], *_streams[thread])) {
+					_source[_infos[i].ref]=_infos[sources[k]].ref;
+					break;
+				}
+			}
+			if (k==sources.size()) {
+				sources.push_back(i);
+			}
+		}
+	};
+	void end(unsigned int thread) {
+		delete _streams[thread];
+		_streams[thread]=NULL;
+	};
+
+protected:
+	const std::vector<const SDPK2*>& _paks;
+	const std::vector<DedupRef>& _refs;
+	const std::vector<__DedupInfo>& _infos;
+	// [start, end) pairs of runs in _infos
+	const std::vector<size_t>& _runs;
+	std::vector<long>& _source;
+	std::vector<DedupStreams*> _streams;
+
+	bool same(const __DedupInfo& x, const __DedupInfo& y, DedupStreams& streams) const {
+		const DedupRef& xr=_refs[x.ref];
+		const DedupRef& yr=_refs[y.ref];
+		const SDPK2& xp=*_paks[xr.archive];
+		const SDPK2& yp=*_paks[yr.archive];
+		const Entry& xe=xp.getEntries()[xr.index];
+		const Entry& ye=yp.getEntries()[yr.index];
+		// same block boundaries and kinds; getCompressedRange() checked the slices are in range
+		size_t count=(x.size+x.block_size-1)/x.block_size;
+		if (!std::equal(xp.getBlockSizeTable().begin()+xe.getBlockSizeIndex(), xp.getBlockSizeTable().begin()+xe.getBlockSizeIndex()+count,
+			yp.getBlockSizeTable().begin()+ye.getBlockSizeIndex())) {
+			return false;
+		}
+		for (uint64_t done=0; done<x.c_size; ) {
+			size_t n=(x.c_size-done<DEDUP_CHUNK_SIZE) ? (size_t)(x.c_size-done) : DEDUP_CHUNK_SIZE;
+			const char* xd=streams.read(xr.archive, x.c_offset+done, n, 0);
+			const char* yd=streams.read(yr.archive, y.c_offset+done, n, 1);
+			if (!xd || !yd || memcmp(xd, yd, n)!=0) {
+				return false;
+			}
+			done+=n;
+		}
+		return true;
+	};
+};
+
+// class DedupIndex implementation
+
+void DedupIndex::addArchive(const SDPK2& pak) {
+	DedupRef ref;
+	ref.archive=_paks.size();
+	_paks.push_back(&pak);
+	for (size_t i=0; i<pak.getEntries().size(); ++i) {
+		ref.index=i;
+		_refs.push_back(ref);
+	}
+}
+
+size_t DedupIndex::build(unsigned int threads) {
+	if (threads==0) {
+		threads=getHardwareThreads();
+	}
+	_source.assign(_refs.size(), -1);
+	_duplicate_bytes=0;
+	// shape of every non-empty entry; the fingerprint is filled in later
+	std::vector<__DedupInfo> infos;
+	infos.reserve(_refs.size());
+	for (size_t i=0; i<_refs.size(); ++i) {
+		const SDPK2& pak=*_paks[_refs[i].archive];
+		const Entry& entry=getEntry(i);
+		__DedupInfo info;
+		if (entry.getSize()==0 || pak.getBlockSize()==0
+			|| entry.getCompressedRange(pak, 0, 0xFFFFFFFF, info.c_offset, info.c_size)!=READERR_NONE) {
+			continue;
+		}
+		info.size=entry.getSize();
+		info.block_size=pak.getBlockSize();
+		info.comp_method=pak.getCompressionMethod();
+		info.crc=0;
+		info.ref=i;
+		infos.push_back(info);
+	}
+	// only entries which share their shape with another entry need a fingerprint
+	std::sort(infos.begin(), infos.end(), __DedupShapeLess());
+	size_t kept=0;
+	for (size_t i=0; i<infos.size(); ) {
+		size_t end=i+1;
+		while (end<infos.size() && __DedupShapeLess::same(infos[i], infos[end])) {
+			++end;
+		}
+		if (end-i>1) {
+			for (; i<end; ++i) {
+				infos[kept++]=infos[i];
+			}
+		}
+		i=end;
+	}
+	infos.resize(kept);
+	DedupFingerprintTask fingerprint(_paks, _refs, infos, threads);
+	parallelFor(infos.size(), threads, fingerprint);
+	std::sort(infos.begin(), infos.end(), __DedupFingerprintLess());
+	// [start, end) pairs of the runs of equal fingerprints
+	std::vector<size_t> runs;
+	for (size_t i=0; i<infos.size(); ) {
+		size_t end=i+1;
+		while (end<infos.size() && __DedupShapeLess::same(infos[i], infos[end]) && infos[i].crc==infos[end].crc) {
+			++end;
+		}
+		if (end-i>1 && infos[i].c_size!=0) {
+			runs.push_back(i);
+			runs.push_back(end);
+		}
+		i=end;
+	}
+	DedupConfirmTask confirm(_paks, _refs, infos, runs, _source, threads);
+	parallelFor(runs.size()/2, threads, confirm);
+	size_t duplicates=0;
+	for (size_t i=0; i<_source.size(); ++i) {
+		if (_source[i]>=0) {
+			++duplicates;
+			_duplicate_bytes+=getEntry(i).getSize();
+		}
+	}
+	return duplicates;
+}
+
+bool linkFile(const char* src, const char* dst, int mode) {
+	// dst already is src (or a hard link to it); unlinking it would delete the source
+	struct stat src_st, dst_st;
+	if (stat(src, &src_st)==0 && stat(dst, &dst_st)==0 && src_st.st_dev==dst_st.st_dev && src_st.st_ino==dst_st.st_ino) {
+		return true;
+	}
+	for (unsigned int attempt=0; attempt<2; ++attempt, mode=(mode==DEDUP_HARDLINK) ? DEDUP_REFLINK : DEDUP_HARDLINK) {
+		unlink(dst);
+		if (mode==DEDUP_HARDLINK) {
+			if (link(src, dst)==0) {
+				return true;
+			}
+		} else {
+			int in=open(src, O_RDONLY);
+			if (in<0) {
+				continue;
+			}
+			int out=open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+			bool ok=(out>=0 && ioctl(out, FICLONE, in)==0);
+			if (out>=0) {
+				close(out);
+				if (!ok) {
+					unlink(dst);
+				}
+			}
+			close(in);
+			if (ok) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+} // namespace PK2Unpack
@@ -0,0 +1,241 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <string.h>
+#include <algorithm>
+#include "parallel.hpp"
+#include "mappedfile.hpp"
+#include "diff.hpp"
+
+namespace PK2Unpack {
+
+// walks the compressed blocks of an entry in a mapped archive
+class DiffBlockCursor {
+public:
+	DiffBlockCursor(const SDPK2& pak, const Entry& entry, const MappedFile& map)
+		: _table(pak.getBlockSizeTable()), _block_size(pak.getBlockSize()), _map(map),
+		_b_index(entry.getBlockSizeIndex()), _offset(entry.getOffset()), _remaining(entry.getSize()),
+		_value(0), _c_size(0), _uc_size(0) {
+	};
+	// false at the end of the entry
+	bool next() {
+		if (_remaining==0) {
+			return false;
+		}
+		_offset+=_c_size;
+		if (_b_index<_table.size()) {
+			_value=_table[_b_index];
+			_c_size=(_value==0) ? _block_size : _value;
+		} else {
+			// past the block table; never equal to a good block
+			_value=(size_t)-1;
+			_c_size=0;
+		}
+		_uc_size=(_remaining<_block_size) ? _remaining : _block_size;
+		_remaining-=_uc_size;
+		++_b_index;
+		return true;
+	};
+	size_t value() const {
+		return _value;
+	};
+	size_t getUncompressedSize() const {
+		return _uc_size;
+	};
+	// NULL if the block is not within the file
+	const char* data() const {
+		if (_value==(size_t)-1 || _offset>_map.size() || _c_size>_map.size()-_offset) {
+			return NULL;
+		}
+		return _map.data()+_offset;
+	};
+	size_t getCompressedSize() const {
+		return _c_size;
+	};
+	
+protected:
+	const BlockSizeTable& _table;
+	size_t _block_size;
+	const MappedFile& _map;
+	size_t _b_index;
+	uint64_t _offset, _remaining;
+	size_t _value, _c_size, _uc_size;
+};
+
+class DiffTask : public ParallelTask {
+public:
+	DiffTask(const SDPK2& old_pak, const SDPK2& new_pak, const MappedFile& old_map, const MappedFile& new_map, EntryDiffVec& entries)
+		: _old_pak(old_pak), _new_pak(new_pak), _old_map(old_map), _new_map(new_map), _entries(entries) {
+	};
+	void run(size_t index, unsigned int) {
+		EntryDiff& diff=_entries[index];
+		if (diff.status!=DIFF_UNCHANGED) {
+			return;
+		}
+		const Entry& o=*diff.old_entry;
+		const Entry& n=*diff.new_entry;
+		uint64_t o_start, o_size, n_start, n_size;
+		// common case: same size, same block table slice and one memcmp over the whole entry
+		if (o.getSize()==n.getSize()
+			&& o.getCompressedRange(_old_pak, 0, 0xFFFFFFFF, o_start, o_size)==READERR_NONE
+			&& n.getCompressedRange(_new_pak, 0, 0xFFFFFFFF, n_start, n_size)==READERR_NONE
+			&& o_size==n_size
+			&& o_start<=_old_map.size() && o_size<=_old_map.size()-o_start
+			&& n_start<=_new_map.size() && n_size<=_new_map.size()-n_start) {
+			size_t count=(o.getSize()+_old_pak.getBlockSize()-1)/_old_pak.getBlockSize();
+			const BlockSizeTable& ot=_old_pak.getBlockSizeTable();
+			const BlockSizeTable& nt=_new_pak.getBlockSizeTable();
+			if (std::equal(ot.begin()+o.getBlockSizeIndex(), ot.begin()+o.getBlockSizeIndex()+count, nt.begin()+n.getBlockSizeIndex())
+				&& memcmp(_old_map.data()+o_start, _new_map.data()+n_start, o_size)==0) {
+				return;
+			}
+		}
+		// find the differing blocks
+		DiffBlockCursor oc(_old_pak, o, _old_map), nc(_new_pak, n, _new_map);
+		unsigned int block=0;
+		while (true) {
+			bool o_more=oc.next(), n_more=nc.next();
+			if (!o_more && !n_more) {
+				break;
+			}
+			bool same=o_more && n_more
+				&& oc.getUncompressedSize()==nc.getUncompressedSize()
+				&& oc.value()==nc.value()
+				&& oc.data() && nc.data()
+				&& memcmp(oc.data(), nc.data(), oc.getCompressedSize())==0;
+			if (!same) {
+				diff.blocks.push_back(block);
+			}
+			++block;
+		}
+		// the whole-entry check failed, so this is changed even if no single block differs (e.g. a bad block table)
+		diff.status=DIFF_CHANGED;
+	};
+	
+protected:
+	const SDPK2& _old_pak;
+	const SDPK2& _new_pak;
+	const MappedFile& _old_map;
+	const MappedFile& _new_map;
+	EntryDiffVec& _entries;
+};
+
+static bool __entry_hash_less(const Entry* x, const Entry* y) {
+	return x->hash().compare(y->hash())<0;
+}
+
+static void __sorted_entries(const SDPK2& pak, std::vector<const Entry*>& out) {
+	const EntryVec& entries=pak.getEntries();
+	out.resize(entries.size());
+	for (size_t i=0; i<entries.size(); ++i) {
+		out[i]=&entries[i];
+	}
+	std::stable_sort(out.begin(), out.end(), __entry_hash_less);
+}
+
+// class ArchiveDiff implementation
+
+void ArchiveDiff::clear() {
+	_entries.clear();
+	memset(_counts, 0, sizeof(_counts));
+	_changed_blocks=0;
+	_block_size=0;
+}
+
+bool ArchiveDiff::compare(const SDPK2& old_pak, const SDPK2& new_pak, unsigned int threads) {
+	clear();
+	if (old_pak.getBlockSize()!=new_pak.getBlockSize() || old_pak.getCompressionMethod()!=new_pak.getCompressionMethod()) {
+		printf("ERROR: archives use different block sizes or compression methods (%lu, %lu); raw blocks cannot be compared\n",
+			(unsigned long)old_pak.getBlockSize(), (unsigned long)new_pak.getBlockSize());
+		return false;
+	}
+	if (old_pak.getBlockSize()==0) {
+		printf("ERROR: block size is 0\n");
+		return false;
+	}
+	_block_size=old_pak.getBlockSize();
+	MappedFile old_map, new_map;
+	if (!old_map.open(old_pak.getPath()) || !new_map.open(new_pak.getPath())) {
+		return false;
+	}
+	std::vector<const Entry*> old_sorted, new_sorted;
+	__sorted_entries(old_pak, old_sorted);
+	__sorted_entries(new_pak, new_sorted);
+	_entries.reserve(std::max(old_sorted.size(), new_sorted.size()));
+	size_t o=0, n=0;
+	while (o<old_sorted.size() || n<new_sorted.size()) {
+		EntryDiff diff;
+		diff.old_entry=NULL;
+		diff.new_entry=NULL;
+		int c=(o==old_sorted.size()) ? 1 : (n==new_sorted.size()) ? -1 : old_sorted[o]->hash().compare(new_sorted[n]->hash());
+		if (c<0) {
+			diff.old_entry=old_sorted[o++];
+			diff.status=DIFF_REMOVED;
+		} else if (c>0) {
+			diff.new_entry=new_sorted[n++];
+			diff.status=DIFF_ADDED;
+		} else {
+			diff.old_entry=old_sorted[o++];
+			diff.new_entry=new_sorted[n++];
+			// DiffTask changes this to DIFF_CHANGED
+			diff.status=DIFF_UNCHANGED;
+		}
+		_entries.push_back(diff);
+	}
+	DiffTask task(old_pak, new_pak, old_map, new_map, _entries);
+	parallelFor(_entries.size(), threads, task);
+	for (size_t i=0; i<_entries.size(); ++i) {
+		_counts[_entries[i].status]++;
+		_changed_blocks+=_entries[i].blocks.size();
+	}
+	return true;
+}
+
+static void __print_blocks(FILE* out, const std::vector<unsigned int>& blocks) {
+	for (size_t i=0; i<blocks.size(); ) {
+		size_t end=i+1;
+		while (end<blocks.size() && blocks[end]==blocks[end-1]+1) {
+			++end;
+		}
+		fprintf(out, (i==0) ? "%u" : ",%u", blocks[i]);
+		if (end-i>1) {
+			fprintf(out, "-%u", blocks[end-1]);
+		}
+		i=end;
+	}
+}
+
+void ArchiveDiff::printText(FILE* out) const {
+	char hash_str[32];
+	for (size_t i=0; i<_entries.size(); ++i) {
+		const EntryDiff& diff=_entries[i];
+		switch (diff.status) {
+			case DIFF_ADDED:
+				diff.new_entry->hash().getExisting(hash_str, false);
+				fprintf(out, "A %.*s %lu\n", 32, hash_str, (unsigned long)diff.new_entry->getSize());
+				break;
+			case DIFF_REMOVED:
+				diff.old_entry->hash().getExisting(hash_str, false);
+				fprintf(out, "D %.*s %lu\n", 32, hash_str, (unsigned long)diff.old_entry->getSize());
+				break;
+			case DIFF_CHANGED: {
+				uint64_t size=std::max(diff.old_entry->getSize(), diff.new_entry->getSize());
+				diff.new_entry->hash().getExisting(hash_str, false);
+				fprintf(out, "M %.*s %lu %lu %lu/%lu ", 32, hash_str, (unsigned long)diff.old_entry->getSize(), (unsigned long)diff.new_entry->getSize(),
+					(unsigned long)diff.blocks.size(), (unsigned long)((size+_block_size-1)/_block_size));
+				__print_blocks(out, diff.blocks);
+				fputc('\n', out);
+				} break;
+			default:
+				break;
+		}
+	}
+	fprintf(out, "# added:%lu removed:%lu changed:%lu unchanged:%lu changed_blocks:%lu block_size:%lu\n",
+		(unsigned long)_counts[DIFF_ADDED], (unsigned long)_counts[DIFF_REMOVED], (unsigned long)_counts[DIFF_CHANGED],
+		(unsigned long)_counts[DIFF_UNCHANGED], (unsigned long)_changed_blocks, (unsigned long)_block_size);
+}
+
+} // namespace PK2Unpack
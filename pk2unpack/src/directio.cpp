@@ -0,0 +1,133 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <duct/debug.hpp>
+#include "directio.hpp"
+
+namespace PK2Unpack {
+
+// class DirectBlockSource implementation
+
+DirectBlockSource::DirectBlockSource(size_t window_size)
+	: _fd(-1), _direct(false), _window(NULL), _capacity((window_size+DIRECT_IO_ALIGN-1)&~(size_t)(DIRECT_IO_ALIGN-1)), _window_pos(0), _window_size(0), _pos(0), _limit(0) {
+	void* p=NULL;
+	if (posix_memalign(&p, DIRECT_IO_ALIGN, _capacity)==0) {
+		_window=(char*)p;
+	}
+	debug_assertp(_window, this, "failed to allocate window");
+}
+
+DirectBlockSource::~DirectBlockSource() {
+	close();
+	free(_window);
+}
+
+bool DirectBlockSource::open(const char* path) {
+	close();
+	_fd=::open(path, O_RDONLY|O_DIRECT);
+	_direct=(_fd>=0);
+	if (_fd<0 && errno==EINVAL) {
+		_fd=::open(path, O_RDONLY);
+	}
+	if (_fd<0) {
+		printf("ERROR: Failed to open SDPK2 file: %s\n", path);
+		return false;
+	}
+	if (!_direct) {
+		printf("WARNING: O_DIRECT is not supported for %s; using buffered reads\n", path);
+	}
+	return true;
+}
+
+void DirectBlockSource::close() {
+	if (_fd>=0) {
+		::close(_fd);
+		_fd=-1;
+	}
+	_window_pos=0;
+	_window_size=0;
+}
+
+bool DirectBlockSource::fill(uint64_t pos, size_t size) {
+	uint64_t start=pos&~(uint64_t)(DIRECT_IO_ALIGN-1);
+	size_t want=_capacity;
+	if (_limit!=0) {
+		uint64_t end=(_limit>pos+size) ? _limit : pos+size;
+		end=(end+DIRECT_IO_ALIGN-1)&~(uint64_t)(DIRECT_IO_ALIGN-1);
+		if (end-start<want) {
+			want=end-start;
+		}
+	}
+	size_t done=0;
+	_window_pos=start;
+	_window_size=0;
+	while (done<want) {
+		ssize_t n=pread(_fd, _window+done, want-done, start+done);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<0 && errno==EINVAL && _direct) {
+			// the device wants a larger alignment (or the filesystem changed its mind)
+			printf("WARNING: O_DIRECT read failed; using buffered reads\n");
+			fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL)&~O_DIRECT);
+			_direct=false;
+			continue;
+		} else if (n<0) {
+			return false;
+		} else if (n==0) {
+			break;
+		}
+		done+=n;
+		// a short O_DIRECT read ends at EOF; the next offset would be unaligned
+		if (_direct && (n&(DIRECT_IO_ALIGN-1))!=0) {
+			break;
+		}
+	}
+	if (!_direct) {
+		posix_fadvise(_fd, start, done, POSIX_FADV_DONTNEED);
+	}
+	_window_size=done;
+	return true;
+}
+
+const char* DirectBlockSource::read(size_t size, char* buf) {
+	if (_pos>=_window_pos && _pos+size<=_window_pos+_window_size) {
+		const char* p=_window+(_pos-_window_pos);
+		_pos+=size;
+		return p;
+	}
+	// fits one window from its aligned start
+	if ((_pos&(DIRECT_IO_ALIGN-1))+size<=_capacity) {
+		if (!fill(_pos, size) || _pos+size>_window_pos+_window_size) {
+			return NULL;
+		}
+		const char* p=_window+(_pos-_window_pos);
+		_pos+=size;
+		return p;
+	}
+	// larger than a window; copy it out piecewise
+	for (size_t done=0; done<size; ) {
+		if (_pos<_window_pos || _pos>=_window_pos+_window_size) {
+			if (!fill(_pos, size-done) || _pos>=_window_pos+_window_size) {
+				return NULL;
+			}
+		}
+		size_t n=_window_pos+_window_size-_pos;
+		if (n>size-done) {
+			n=size-done;
+		}
+		memcpy(buf+done, _window+(_pos-_window_pos), n);
+		done+=n;
+		_pos+=n;
+	}
+	return buf;
+}
+
+} // namespace PK2Unpack
@@ -0,0 +1,114 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <charconv>
+#include <duct/debug.hpp>
+#include "formatwriter.hpp"
+#include "hex.hpp"
+
+namespace PK2Unpack {
+
+// class FormatWriter implementation
+
+const char FormatWriter::__hex_upper[513]=
+	"000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+	"202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+	"404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+	"606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+	"808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+	"A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+	"C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+	"E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+const char FormatWriter::__hex_lower[513]=
+	"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+FormatWriter::FormatWriter(FILE* out, size_t capacity) : _out(out), _size(0), _capacity((capacity>=64) ? capacity : 64), _day(-1) {
+	_buf=(char*)malloc(_capacity);
+	debug_assertp(_buf, this, "failed to allocate buffer");
+}
+
+void FormatWriter::fill(char c, size_t count) {
+	while (count--) {
+		append(c);
+	}
+}
+
+void FormatWriter::appendUInt(uint64_t value, unsigned int width) {
+	char digits[24];
+	char* end=std::to_chars(digits, digits+sizeof(digits), value).ptr;
+	size_t n=end-digits;
+	if (width>n) {
+		fill(' ', width-n);
+	}
+	append(digits, n);
+}
+
+void FormatWriter::appendInt(int64_t value, unsigned int width) {
+	char digits[24];
+	char* end=std::to_chars(digits, digits+sizeof(digits), value).ptr;
+	size_t n=end-digits;
+	if (width>n) {
+		fill(' ', width-n);
+	}
+	append(digits, n);
+}
+
+void FormatWriter::appendHex(const unsigned char* data, size_t size, bool lower) {
+	const char* table=(lower) ? __hex_lower : __hex_upper;
+	while (size>0) {
+		if (_size+2>_capacity) {
+			flush();
+		}
+		// as many bytes as fit in the buffer
+		size_t n=(_capacity-_size)/2;
+		if (n>size) {
+			n=size;
+		}
+		char* p=_buf+_size;
+		if (lower) {
+			hexEncode(data, n, p);
+		} else {
+			for (size_t i=0; i<n; ++i) {
+				memcpy(p+i*2, table+data[i]*2, 2);
+			}
+		}
+		_size+=n*2;
+		data+=n;
+		size-=n;
+	}
+}
+
+void FormatWriter::appendTimeUTC(time_t value) {
+	int64_t day=(int64_t)value/86400;
+	int64_t secs=(int64_t)value%86400;
+	if (secs<0) {
+		secs+=86400;
+		--day;
+	}
+	if (day!=_day) {
+		struct tm ts;
+		time_t midnight=(time_t)(day*86400);
+		gmtime_r(&midnight, &ts);
+		strftime(_date, sizeof(_date), "%Y-%m-%dT", &ts);
+		_day=day;
+	}
+	char t[9];
+	unsigned int h=secs/3600, m=(secs/60)%60, s=secs%60;
+	t[0]=(char)('0'+h/10); t[1]=(char)('0'+h%10); t[2]=':';
+	t[3]=(char)('0'+m/10); t[4]=(char)('0'+m%10); t[5]=':';
+	t[6]=(char)('0'+s/10); t[7]=(char)('0'+s%10); t[8]='Z';
+	append(_date);
+	append(t, 9);
+}
+
+} // namespace PK2Unpack
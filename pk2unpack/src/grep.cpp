@@ -0,0 +1,256 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <string.h>
+#include "parallel.hpp"
+#include "trace.hpp"
+#include "grep.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace PK2Unpack {
+
+// class SubstringSearch implementation
+
+#if defined(__x86_64__)
+static const bool __grep_avx2=__builtin_cpu_supports("avx2");
+
+// searches from i; returns the position the next (narrower) search should continue from
+__attribute__((target("avx2")))
+static size_t __find_avx2(const char* data, size_t size, size_t i, const char* p, size_t len, std::vector<size_t>& out) {
+	const __m256i first=_mm256_set1_epi8(p[0]);
+	const __m256i last=_mm256_set1_epi8(p[len-1]);
+	for (; i+len-1+32<=size; i+=32) {
+		__m256i a=_mm256_loadu_si256((const __m256i*)(data+i));
+		__m256i b=_mm256_loadu_si256((const __m256i*)(data+i+len-1));
+		uint32_t mask=(uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+		while (mask) {
+			unsigned int bit=__builtin_ctz(mask);
+			if (memcmp(data+i+bit+1, p+1, len-2)==0) {
+				out.push_back(i+bit);
+			}
+			mask&=mask-1;
+		}
+	}
+	return i;
+}
+#endif
+
+#if defined(__SSE2__)
+static size_t __find_sse2(const char* data, size_t size, size_t i, const char* p, size_t len, std::vector<size_t>& out) {
+	const __m128i first=_mm_set1_epi8(p[0]);
+	const __m128i last=_mm_set1_epi8(p[len-1]);
+	for (; i+len-1+16<=size; i+=16) {
+		__m128i a=_mm_loadu_si128((const __m128i*)(data+i));
+		__m128i b=_mm_loadu_si128((const __m128i*)(data+i+len-1));
+		unsigned int mask=(unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		while (mask) {
+			unsigned int bit=__builtin_ctz(mask);
+			if (memcmp(data+i+bit+1, p+1, len-2)==0) {
+				out.push_back(i+bit);
+			}
+			mask&=mask-1;
+		}
+	}
+	return i;
+}
+#endif
+
+void SubstringSearch::findAll(const char* data, size_t size, std::vector<size_t>& out) const {
+	const char* p=_pattern.data();
+	size_t len=_pattern.size();
+	if (len==0 || len>size) {
+		return;
+	}
+	size_t i=0;
+	if (len==1) {
+		const char* m;
+		while (i<size && (m=(const char*)memchr(data+i, p[0], size-i))!=NULL) {
+			out.push_back(m-data);
+			i=m-data+1;
+		}
+		return;
+	}
+#if defined(__x86_64__)
+	if (__grep_avx2) {
+		i=__find_avx2(data, size, i, p, len, out);
+	}
+#endif
+#if defined(__SSE2__)
+	i=__find_sse2(data, size, i, p, len, out);
+#endif
+	for (; i+len<=size; ++i) {
+		if (data[i]==p[0] && memcmp(data+i+1, p+1, len-1)==0) {
+			out.push_back(i);
+		}
+	}
+}
+
+struct GrepMatch {
+	uint64_t offset;
+	unsigned int pattern;
+};
+
+typedef std::vector<GrepMatch> GrepMatchVec;
+
+/*
+	Searches each block with the last (longest pattern - 1) bytes of the previous block in front,
+	so matches which span a block boundary are found once.
+*/
+class GrepHandler : public BlockHandler {
+public:
+	GrepHandler(const std::vector<SubstringSearch>& searches, size_t carry_max, std::vector<char>& window, std::vector<size_t>& hits, size_t block_size, GrepMatchVec& matches)
+		: _searches(searches), _carry_max(carry_max), _window(window), _hits(hits), _block_size(block_size), _matches(matches), _carry(0), _failed(false) {
+	};
+	bool block(unsigned int index, const char* data, size_t size) {
+		uint64_t pos=(uint64_t)index*_block_size;
+		if (_window.size()<_carry+size) {
+			_window.resize(_carry+size);
+		}
+		memcpy(&_window[0]+_carry, data, size);
+		size_t window_size=_carry+size;
+		for (unsigned int p=0; p<_searches.size(); ++p) {
+			_hits.clear();
+			_searches[p].findAll(&_window[0], window_size, _hits);
+			size_t len=_searches[p].getPattern().size();
+			for (size_t k=0; k<_hits.size(); ++k) {
+				// matches entirely inside the carry were found with the previous block
+				if (_hits[k]+len>_carry) {
+					GrepMatch m={pos-_carry+_hits[k], p};
+					_matches.push_back(m);
+				}
+			}
+		}
+		// keep the tail for the next block
+		size_t keep=(window_size<_carry_max) ? window_size : _carry_max;
+		memmove(&_window[0], &_window[0]+window_size-keep, keep);
+		_carry=keep;
+		return true;
+	};
+	bool error(unsigned int, int) {
+		_failed=true;
+		return false;
+	};
+	bool failed() const {
+		return _failed;
+	};
+	
+protected:
+	const std::vector<SubstringSearch>& _searches;
+	size_t _carry_max;
+	std::vector<char>& _window;
+	std::vector<size_t>& _hits;
+	size_t _block_size;
+	GrepMatchVec& _matches;
+	size_t _carry;
+	bool _failed;
+};
+
+class GrepTask : public ParallelTask {
+public:
+	GrepTask(const SDPK2& pak, const std::vector<SubstringSearch>& searches, unsigned int threads)
+		: _pak(pak), _searches(searches), _carry_max(0), _streams(threads, (Stream*)NULL), _decoders(threads, (BlockDecoder*)NULL),
+		_windows(threads), _hits(threads), _bytes(threads, 0), _matches(pak.getEntries().size()), _failed(pak.getEntries().size(), false) {
+		for (size_t i=0; i<searches.size(); ++i) {
+			if (searches[i].getPattern().size()-1>_carry_max) {
+				_carry_max=searches[i].getPattern().size()-1;
+			}
+		}
+	};
+	void begin(unsigned int thread) {
+		_streams[thread]=_pak.openDataStream();
+		_decoders[thread]=new BlockDecoder();
+	};
+	void run(size_t index, unsigned int thread) {
+		if (!_streams[thread]) {
+			_failed[index]=true;
+			return;
+		}
+		const Entry& entry=_pak.getEntries()[index];
+		TraceScope entry_trace("entry", entry.getSize());
+		StreamBlockSource source(_streams[thread]);
+		GrepHandler handler(_searches, _carry_max, _windows[thread], _hits[thread], _pak.getBlockSize(), _matches[index]);
+		entry.readBlocks(source, _pak, handler, *_decoders[thread]);
+		_failed[index]=handler.failed();
+		_bytes[thread]+=entry.getSize();
+	};
+	void end(unsigned int thread) {
+		SDPK2::closeDataStream(_streams[thread]);
+		_streams[thread]=NULL;
+		delete _decoders[thread];
+		_decoders[thread]=NULL;
+	};
+	const std::vector<GrepMatchVec>& getMatches() const {
+		return _matches;
+	};
+	bool failed(size_t index) const {
+		return _failed[index];
+	};
+	uint64_t getBytes() const {
+		uint64_t total=0;
+		for (size_t i=0; i<_bytes.size(); ++i) {
+			total+=_bytes[i];
+		}
+		return total;
+	};
+	
+protected:
+	const SDPK2& _pak;
+	const std::vector<SubstringSearch>& _searches;
+	size_t _carry_max;
+	std::vector<Stream*> _streams;
+	std::vector<BlockDecoder*> _decoders;
+	// reused across entries
+	std::vector<std::vector<char> > _windows;
+	std::vector<std::vector<size_t> > _hits;
+	std::vector<uint64_t> _bytes;
+	std::vector<GrepMatchVec> _matches;
+	// not vector<bool>; threads write neighbouring elements
+	std::vector<char> _failed;
+};
+
+size_t grepArchive(const SDPK2& pak, const std::vector<std::string>& patterns, unsigned int threads, FILE* out) {
+	if (threads==0) {
+		threads=getHardwareThreads();
+	}
+	std::vector<SubstringSearch> searches;
+	for (size_t i=0; i<patterns.size(); ++i) {
+		if (!patterns[i].empty()) {
+			searches.push_back(SubstringSearch(patterns[i]));
+		}
+	}
+	const EntryVec& entries=pak.getEntries();
+	if (searches.empty()) {
+		return 0;
+	}
+	GrepTask task(pak, searches, threads);
+	parallelFor(entries.size(), threads, task);
+	const std::vector<GrepMatchVec>& matches=task.getMatches();
+	size_t matched_entries=0, total=0, bad_entries=0;
+	char hash_str[32];
+	for (size_t i=0; i<matches.size(); ++i) {
+		const GrepMatchVec& mv=matches[i];
+		entries[i].hash().getExisting(hash_str, false);
+		if (task.failed(i)) {
+			++bad_entries;
+			fprintf(stderr, "%.*s: failed to decompress; searched up to the bad block\n", 32, hash_str);
+		}
+		if (mv.empty()) {
+			continue;
+		}
+		++matched_entries;
+		total+=mv.size();
+		for (size_t k=0; k<mv.size(); ++k) {
+			fprintf(out, "%.*s %lu %s\n", 32, hash_str, (unsigned long)mv[k].offset, searches[mv[k].pattern].getPattern().c_str());
+		}
+	}
+	fprintf(out, "# entries:%lu matched_entries:%lu matches:%lu bad_entries:%lu bytes:%lu\n", (unsigned long)entries.size(), (unsigned long)matched_entries, (unsigned long)total, (unsigned long)bad_entries, (unsigned long)task.getBytes());
+	return total;
+}
+
+} // namespace PK2Unpack
@@ -0,0 +1,183 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include "hex.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace PK2Unpack {
+
+static const char __hex_digits[]="0123456789abcdef";
+
+// nibble value of each character, 0xFF if not a hex digit
+static unsigned char __hex_values[256];
+
+static int __hex_init() {
+	for (unsigned int i=0; i<256; ++i) {
+		__hex_values[i]=0xFF;
+	}
+	for (unsigned int i=0; i<10; ++i) {
+		__hex_values['0'+i]=(unsigned char)i;
+	}
+	for (unsigned int i=0; i<6; ++i) {
+		__hex_values['a'+i]=__hex_values['A'+i]=(unsigned char)(10+i);
+	}
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		return 2;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+// 2 for AVX2, 1 for SSSE3, 0 for scalar only
+static const int __hex_simd=__hex_init();
+
+static void __hex_encode_sw(const unsigned char* data, size_t size, char* out) {
+	for (size_t i=0; i<size; ++i) {
+		out[i*2]=__hex_digits[data[i]>>4];
+		out[i*2+1]=__hex_digits[data[i]&0x0F];
+	}
+}
+
+static bool __hex_decode_sw(const char* str, size_t size, unsigned char* out) {
+	unsigned char bad=0;
+	for (size_t i=0; i<size; ++i) {
+		unsigned char hi=__hex_values[(unsigned char)str[i*2]];
+		unsigned char lo=__hex_values[(unsigned char)str[i*2+1]];
+		bad|=hi|lo;
+		out[i]=(unsigned char)((hi<<4)|(lo&0x0F));
+	}
+	return (bad&0xF0)==0;
+}
+
+#if defined(__x86_64__)
+// returns the number of bytes encoded (a multiple of 16)
+__attribute__((target("ssse3")))
+static size_t __hex_encode_ssse3(const unsigned char* data, size_t size, char* out) {
+	const __m128i lut=_mm_loadu_si128((const __m128i*)__hex_digits);
+	const __m128i mask=_mm_set1_epi8(0x0F);
+	size_t i=0;
+	for (; i+16<=size; i+=16) {
+		__m128i v=_mm_loadu_si128((const __m128i*)(data+i));
+		__m128i hi=_mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+		__m128i lo=_mm_shuffle_epi8(lut, _mm_and_si128(v, mask));
+		_mm_storeu_si128((__m128i*)(out+i*2), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i*)(out+i*2+16), _mm_unpackhi_epi8(hi, lo));
+	}
+	return i;
+}
+
+// nibble values of 16 characters; clears valid if any is not a hex digit
+__attribute__((target("ssse3")))
+static inline __m128i __hex_nibbles_ssse3(__m128i c, __m128i& valid) {
+	__m128i digit=_mm_sub_epi8(c, _mm_set1_epi8('0'));
+	__m128i is_digit=_mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	__m128i alpha=_mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	__m128i is_alpha=_mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+	valid=_mm_and_si128(valid, _mm_or_si128(is_digit, is_alpha));
+	return _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+}
+
+// returns the number of bytes decoded (a multiple of 16), or (size_t)-1 on a bad character
+__attribute__((target("ssse3")))
+static size_t __hex_decode_ssse3(const char* str, size_t size, unsigned char* out) {
+	// multiply-add pairs into hi*16+lo
+	const __m128i weights=_mm_set1_epi16(0x0110);
+	__m128i valid=_mm_set1_epi8(-1);
+	size_t i=0;
+	for (; i+16<=size; i+=16) {
+		__m128i a=__hex_nibbles_ssse3(_mm_loadu_si128((const __m128i*)(str+i*2)), valid);
+		__m128i b=__hex_nibbles_ssse3(_mm_loadu_si128((const __m128i*)(str+i*2+16)), valid);
+		__m128i bytes=_mm_packus_epi16(_mm_maddubs_epi16(a, weights), _mm_maddubs_epi16(b, weights));
+		_mm_storeu_si128((__m128i*)(out+i), bytes);
+	}
+	return (_mm_movemask_epi8(valid)==0xFFFF) ? i : (size_t)-1;
+}
+
+__attribute__((target("avx2")))
+static size_t __hex_encode_avx2(const unsigned char* data, size_t size, char* out) {
+	const __m256i lut=_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)__hex_digits));
+	const __m256i mask=_mm256_set1_epi8(0x0F);
+	size_t i=0;
+	for (; i+32<=size; i+=32) {
+		__m256i v=_mm256_loadu_si256((const __m256i*)(data+i));
+		__m256i hi=_mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+		__m256i lo=_mm256_shuffle_epi8(lut, _mm256_and_si256(v, mask));
+		// unpack works per 128-bit lane; put the lanes back in order
+		__m256i a=_mm256_unpacklo_epi8(hi, lo);
+		__m256i b=_mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256((__m256i*)(out+i*2), _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i*)(out+i*2+32), _mm256_permute2x128_si256(a, b, 0x31));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i __hex_nibbles_avx2(__m256i c, __m256i& valid) {
+	__m256i digit=_mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+	__m256i is_digit=_mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+	__m256i alpha=_mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	__m256i is_alpha=_mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+	valid=_mm256_and_si256(valid, _mm256_or_si256(is_digit, is_alpha));
+	return _mm256_or_si256(_mm256_and_si256(is_digit, digit), _mm256_and_si256(is_alpha, _mm256_add_epi8(alpha, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static size_t __hex_decode_avx2(const char* str, size_t size, unsigned char* out) {
+	const __m256i weights=_mm256_set1_epi16(0x0110);
+	__m256i valid=_mm256_set1_epi8(-1);
+	size_t i=0;
+	for (; i+32<=size; i+=32) {
+		__m256i a=__hex_nibbles_avx2(_mm256_loadu_si256((const __m256i*)(str+i*2)), valid);
+		__m256i b=__hex_nibbles_avx2(_mm256_loadu_si256((const __m256i*)(str+i*2+32)), valid);
+		__m256i bytes=_mm256_packus_epi16(_mm256_maddubs_epi16(a, weights), _mm256_maddubs_epi16(b, weights));
+		// packus interleaves the lanes of a and b
+		_mm256_storeu_si256((__m256i*)(out+i), _mm256_permute4x64_epi64(bytes, 0xD8));
+	}
+	return (_mm256_movemask_epi8(valid)==-1) ? i : (size_t)-1;
+}
+#endif
+
+void hexEncode(const unsigned char* data, size_t size, char* out) {
+	size_t done=0;
+#if defined(__x86_64__)
+	if (__hex_simd>=2) {
+		done=__hex_encode_avx2(data, size, out);
+	}
+	if (__hex_simd>=1) {
+		done+=__hex_encode_ssse3(data+done, size-done, out+done*2);
+	}
+#endif
+	__hex_encode_sw(data+done, size-done, out+done*2);
+}
+
+bool hexDecode(const char* str, size_t size, unsigned char* out) {
+	size_t done=0, n=0;
+#if defined(__x86_64__)
+	if (__hex_simd>=2) {
+		n=__hex_decode_avx2(str, size, out);
+		if (n==(size_t)-1) {
+			return false;
+		}
+		done=n;
+	}
+	if (__hex_simd>=1) {
+		n=__hex_decode_ssse3(str+done*2, size-done, out+done);
+		if (n==(size_t)-1) {
+			return false;
+		}
+		done+=n;
+	}
+#endif
+	return __hex_decode_sw(str+done*2, size-done, out+done);
+}
+
+} // namespace PK2Unpack
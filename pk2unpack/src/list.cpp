@@ -0,0 +1,191 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <string.h>
+#include <string>
+#include "list.hpp"
+#include "formatwriter.hpp"
+
+namespace PK2Unpack {
+
+#define __list_buffer_size 0x100000
+
+int getListFormat(const char* name) {
+	if (strcmp(name, "tsv")==0 || strcmp(name, "text")==0) {
+		return LISTFORMAT_TSV;
+	} else if (strcmp(name, "csv")==0) {
+		return LISTFORMAT_CSV;
+	} else if (strcmp(name, "json")==0) {
+		return LISTFORMAT_JSON;
+	}
+	return LISTFORMAT_UNKNOWN;
+}
+
+static void __list_string(FormatWriter& out, int format, const char* str) {
+	if (format==LISTFORMAT_JSON) {
+		out.append('"');
+		for (const unsigned char* p=(const unsigned char*)str; *p; ++p) {
+			if (*p=='"' || *p=='\\') {
+				out.append('\\');
+				out.append((char)*p);
+			} else if (*p<0x20) {
+				out.append("\\u00", 4);
+				out.appendHex(*p, true);
+			} else {
+				out.append((char)*p);
+			}
+		}
+		out.append('"');
+	} else if (format==LISTFORMAT_CSV) {
+		if (!strpbrk(str, ",\"\r\n")) {
+			out.append(str);
+			return;
+		}
+		out.append('"');
+		for (const char* p=str; *p; ++p) {
+			if (*p=='"') {
+				out.append('"');
+			}
+			out.append(*p);
+		}
+		out.append('"');
+	} else {
+		for (const char* p=str; *p; ++p) {
+			switch (*p) {
+			case '\t': out.append("\\t", 2); break;
+			case '\n': out.append("\\n", 2); break;
+			case '\r': out.append("\\r", 2); break;
+			case '\\': out.append("\\\\", 2); break;
+			default: out.append(*p); break;
+			}
+		}
+	}
+}
+
+// writes the header row or the opening bracket
+static void __list_begin(FormatWriter& out, int format, const char* const* columns) {
+	if (format==LISTFORMAT_JSON) {
+		out.append("[\n", 2);
+		return;
+	}
+	char sep=(format==LISTFORMAT_CSV) ? ',' : '\t';
+	for (unsigned int i=0; columns[i]; ++i) {
+		if (i>0) {
+			out.append(sep);
+		}
+		out.append(columns[i]);
+	}
+	out.append('\n');
+}
+
+static void __list_field(FormatWriter& out, int format, const char* const* columns, unsigned int column) {
+	if (format==LISTFORMAT_JSON) {
+		out.append((column==0) ? "{\"" : ",\"");
+		out.append(columns[column]);
+		out.append("\":", 2);
+	} else if (column>0) {
+		out.append((format==LISTFORMAT_CSV) ? ',' : '\t');
+	}
+}
+
+static void __list_row_end(FormatWriter& out, int format, bool last) {
+	if (format==LISTFORMAT_JSON) {
+		out.append((last) ? "}\n" : "},\n");
+	} else {
+		out.append('\n');
+	}
+}
+
+static void __list_end(FormatWriter& out, int format) {
+	if (format==LISTFORMAT_JSON) {
+		out.append("]\n", 2);
+	}
+}
+
+static const char* const __archive_columns[]={
+	"hash", "size", "offset", "block_index", "blocks", NULL
+};
+
+static void __list_entry(FormatWriter& w, int format, const Entry& e, size_t block_size, bool last) {
+	const char* const* columns=__archive_columns;
+	__list_field(w, format, columns, 0);
+	if (format==LISTFORMAT_JSON) {
+		w.append('"');
+	}
+	w.appendHex(e.hash().data(), 16, true);
+	if (format==LISTFORMAT_JSON) {
+		w.append('"');
+	}
+	__list_field(w, format, columns, 1);
+	w.appendUInt(e.getSize());
+	__list_field(w, format, columns, 2);
+	w.appendUInt(e.getOffset());
+	__list_field(w, format, columns, 3);
+	w.appendUInt(e.getBlockSizeIndex());
+	__list_field(w, format, columns, 4);
+	w.appendUInt((block_size>0) ? (e.getSize()+block_size-1)/block_size : 0);
+	__list_row_end(w, format, last);
+}
+
+void listArchive(const SDPK2& pak, int format, FILE* out) {
+	FormatWriter w(out, __list_buffer_size);
+	const EntryVec& entries=pak.getEntries();
+	__list_begin(w, format, __archive_columns);
+	for (size_t i=0; i<entries.size(); ++i) {
+		__list_entry(w, format, entries[i], pak.getBlockSize(), i+1==entries.size());
+	}
+	__list_end(w, format);
+}
+
+void listEntries(const SDPK2& pak, const Entry* const* entries, size_t count, int format, FILE* out) {
+	FormatWriter w(out, __list_buffer_size);
+	__list_begin(w, format, __archive_columns);
+	for (size_t i=0; i<count; ++i) {
+		__list_entry(w, format, *entries[i], pak.getBlockSize(), i+1==count);
+	}
+	__list_end(w, format);
+}
+
+static const char* const __table_columns[]={
+	"index", "dir_index", "path", "time_modified", NULL
+};
+
+void listTable(const SDMD2& table, int format, FILE* out) {
+	FormatWriter w(out, __list_buffer_size);
+	const char* const* columns=__table_columns;
+	const EntryInfoSet& info=table.getEntryInfo();
+	const FileInfoVec& files=info.getData();
+	std::string path;
+	__list_begin(w, format, columns);
+	for (size_t i=0; i<files.size(); ++i) {
+		const FileInfo& fi=files[i];
+		__list_field(w, format, columns, 0);
+		w.appendUInt(fi.getIndex());
+		__list_field(w, format, columns, 1);
+		w.appendUInt(fi.getDirIndex());
+		__list_field(w, format, columns, 2);
+		const char* dir=info.getName(fi.getDirIndex());
+		const char* name=info.getName(fi.getIndex());
+		path.assign((dir) ? dir : "");
+		if (!path.empty() && path[path.size()-1]!='/') {
+			path.push_back('/');
+		}
+		path.append((name) ? name : "");
+		__list_string(w, format, path.c_str());
+		__list_field(w, format, columns, 3);
+		if (format==LISTFORMAT_JSON) {
+			w.append('"');
+		}
+		w.appendTimeUTC(fi.getTimeModified());
+		if (format==LISTFORMAT_JSON) {
+			w.append('"');
+		}
+		__list_row_end(w, format, i+1==files.size());
+	}
+	__list_end(w, format);
+}
+
+} // namespace PK2Unpack
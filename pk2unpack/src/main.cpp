@@ -5,74 +5,952 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <string>
+#include <algorithm>
+#include <vector>
 #include <duct/filestream.hpp>
 #include "sdpk2.hpp"
 #include "sdmd2.hpp"
+#include "parallel.hpp"
+#include "verify.hpp"
+#include "analyze.hpp"
+#include "list.hpp"
+#include "query.hpp"
+#include "grep.hpp"
+#include "dedup.hpp"
+#include "diff.hpp"
+#include "update.hpp"
+#include "sidecar.hpp"
+#include "directio.hpp"
+#include "prefetch.hpp"
+#include "pathindex.hpp"
+#include "tar.hpp"
+#include "reorder.hpp"
+#include "pathhash.hpp"
+#include "mappedfile.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "throttle.hpp"
 
 using namespace PK2Unpack;
 
-char __hash_str[33]={0x00};
-const char* __hash_str_ptr=NULL;
+// --threads=N; 0 means one per processor
+unsigned int __threads=0;
+bool __verify=false;
+bool __analyze=false;
+bool __list=false;
+// --diff old.sdpk2 new.sdpk2
+bool __diff=false;
+// --update archive.sdpk2 hash path [hash path ...]
+bool __update=false;
+// --grep=pattern (or --grep pattern); repeatable
+std::vector<std::string> __grep_patterns;
+// --dedup[=hardlink|reflink]; -1 when disabled
+int __dedup=-1;
+// --tar=path (or --tar path; "-" for stdout); NULL when disabled
+const char* __tar_path=NULL;
+// --find=path (repeatable); looked up in the sdmd2 given after the archive
+std::vector<std::string> __find_paths;
+// --path-index=path; the saved PathHash for --find (built and saved when missing or stale)
+const char* __path_index=NULL;
+// --reorder=trace|dir|size; REORDER_UNKNOWN when disabled
+int __reorder=REORDER_UNKNOWN;
+// --transcode[=level]; writes the zstd sidecar
+bool __transcode=false;
+int __transcode_level=9;
+// the archive's zstd sidecar, when there is one (and not --no-sidecar)
+bool __use_sidecar=true;
+ZstdSidecar __sidecar;
+// --direct-io; extraction reads bypass the page cache
+bool __direct_io=false;
+// --record=path; saves the archive's access trace; NULL when disabled
+const char* __record_path=NULL;
+// --prefetch=path; replays an access trace ahead of the reads; NULL when disabled
+const char* __prefetch_path=NULL;
+// --query-file=path ("-" for stdin); NULL when disabled
+const char* __query_path=NULL;
+// --format=text|json (--list also takes csv|tsv)
+const char* __format="text";
+// --stats[=path]; NULL when disabled, "" for stderr
+const char* __stats_path=NULL;
+// --trace=path; NULL when disabled
+const char* __trace_path=NULL;
+// --max-read=MB/s, --max-write=MB/s and --max-inflate=threads; 0 when unlimited
+ThrottleLimits __throttle={0, 0, 0};
+// --throttle=path; a control file re-read on SIGHUP or change, NULL when disabled
+const char* __throttle_path=NULL;
 
-void dump_entry(SDPK2& pak, const Entry& entry, const char* outdir, const char* outpath) {
+// --manifest[=path]; NULL when disabled
+const char* __manifest_path=NULL;
+FILE* __manifest=NULL;
+
+// reads an archive for extraction: O_DIRECT with --direct-io, otherwise a data stream
+class DumpSource {
+public:
+	DumpSource() : _stream(NULL), _source(NULL), _direct(NULL) {
+	};
+	~DumpSource() {
+		close();
+	};
+	bool open(const SDPK2& pak) {
+		close();
+		if (__direct_io) {
+			DirectBlockSource* direct=new DirectBlockSource();
+			if (!direct->open(pak.getPath())) {
+				delete direct;
+				return false;
+			}
+			_source=direct;
+			_direct=direct;
+		} else {
+			_stream=pak.openDataStream();
+			if (!_stream) {
+				return false;
+			}
+			_source=new StreamBlockSource(_stream);
+		}
+		return true;
+	};
+	void close() {
+		delete _source;
+		_source=NULL;
+		_direct=NULL;
+		SDPK2::closeDataStream(_stream);
+		_stream=NULL;
+	};
+	BlockSource* get() {
+		return _source;
+	};
+	// see DirectBlockSource::setLimit(); nothing to do for streams
+	void setLimit(uint64_t end) {
+		if (_direct) {
+			_direct->setLimit(end);
+		}
+	};
+	
+protected:
+	Stream* _stream;
+	BlockSource* _source;
+	DirectBlockSource* _direct;
+	
+	DumpSource(const DumpSource&);
+	DumpSource& operator=(const DumpSource&);
+};
+
+// --record and --prefetch over the reads of one archive, until destroyed
+class PrefetchScope {
+public:
+	PrefetchScope() : _prefetcher(NULL) {
+	};
+	~PrefetchScope() {
+		// the prefetch thread reads the globals (in Entry::readBlocks), so it stops first
+		if (_prefetcher) {
+			_prefetcher->stop();
+		}
+		Prefetch::recording=NULL;
+		Prefetch::replaying=NULL;
+		if (_prefetcher) {
+			fprintf(stderr, "# prefetch hits:%lu misses:%lu evictions:%lu lookahead:%lu\n",
+				(unsigned long)_prefetcher->getHits(), (unsigned long)_prefetcher->getMisses(),
+				(unsigned long)_prefetcher->getEvictions(), (unsigned long)_prefetcher->getLookahead());
+			delete _prefetcher;
+		}
+		if (__record_path) {
+			_record.save(__record_path);
+		}
+	};
+	bool begin(const SDPK2& pak) {
+		if (__record_path) {
+			_record.addArchive(pak);
+			Prefetch::recording=&_record;
+		}
+		if (__prefetch_path) {
+			if (!_replay.load(__prefetch_path)) {
+				return false;
+			}
+			// the trace's first archive is this one, wherever it was recorded
+			_prefetcher=new TracePrefetcher(_replay);
+			_prefetcher->setArchive(0, pak);
+			// published before the thread starts, which reads it
+			Prefetch::replaying=_prefetcher;
+			if (!_prefetcher->start()) {
+				Prefetch::replaying=NULL;
+			}
+		}
+		return true;
+	};
+	
+protected:
+	AccessTrace _record, _replay;
+	TracePrefetcher* _prefetcher;
+	
+	PrefetchScope(const PrefetchScope&);
+	PrefetchScope& operator=(const PrefetchScope&);
+};
+
+// crc (optional) receives the CRC32C of the entry when the manifest is enabled
+bool dump_entry(BlockSource& source, BlockDecoder& decoder, const SDPK2& pak, const Entry& entry, const char* hash_str, const char* outdir, const char* outpath, uint32_t* crc=NULL) {
 	std::string path(outdir);
 	path.append(outpath);
-	printf("Dumping [%.*s] to %s\n", 32, __hash_str_ptr, path.c_str());
+	printf("Dumping [%.*s] to %s\n", 32, hash_str, path.c_str());
+	TraceScope entry_trace("entry", entry.getSize());
+	StatScope output_scope(STAT_TIME_OUTPUT);
 	FileStream* out=FileStream::writeFile(path.c_str());
+	output_scope.stop();
+	bool good=false;
 	if (out) {
-		if (entry.readToStream(pak.getStream(), out, pak)!=0) {
-			printf("\tFailed to decompress/write some blocks\n");
+		Stats::add(STAT_ENTRIES, 1);
+		CRC32C digest;
+		int err=(__sidecar.covers(entry))
+			? __sidecar.readToStream(entry, out, (__manifest) ? &digest : NULL)
+			: entry.readToStream(source, out, pak, (__manifest) ? &digest : NULL, decoder);
+		if (err!=READERR_NONE) {
+			printf("\tFailed to decompress/write some blocks (%.*s: %s)\n", 32, hash_str, getReadErrorName(err));
+		} else {
+			good=true;
+			if (__manifest) {
+				fprintf(__manifest, "%.*s %lu %08x %s\n", 32, hash_str, (unsigned long)entry.getSize(), digest.value(), path.c_str());
+				if (crc) {
+					*crc=digest.value();
+				}
+			}
 		}
+		StatScope close_scope(STAT_TIME_OUTPUT);
 		out->close();
 		delete out;
 	} else {
 		printf("\tFailed to open %s for writing\n", path.c_str());
 	}
+	return good;
 }
 
-int main(int argc, char** argv) {
-	if (argc<2) {
+bool open_manifest(const char* outdir) {
+	if (!__manifest_path) {
+		return true;
+	}
+	std::string path;
+	if (__manifest_path[0]=='\0') {
+		path.append(outdir);
+		path.append("manifest.crc32c");
+	} else {
+		path.append(__manifest_path);
+	}
+	__manifest=fopen(path.c_str(), "w");
+	if (!__manifest) {
+		printf("ERROR: Failed to open manifest for writing: %s\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+void close_manifest() {
+	if (__manifest) {
+		fclose(__manifest);
+		__manifest=NULL;
+	}
+}
+
+struct __DumpOffsetLess {
+	const EntryVec* entries;
+	bool operator()(size_t x, size_t y) const {
+		return (*entries)[x].getOffset()<(*entries)[y].getOffset();
+	};
+};
+
+/**
+	Extracts every entry of an archive.
+	With --direct-io each item is a run of entries in offset order, so a thread reads one
+	contiguous range with its windows stopping at the end of the run; otherwise an item is an
+	entry and the page cache is shared.
+*/
+class DumpTask : public ParallelTask {
+public:
+	DumpTask(const SDPK2& pak, const char* outdir, unsigned int threads) : _pak(pak), _outdir(outdir), _sources(threads, (DumpSource*)NULL), _decoders(threads, (BlockDecoder*)NULL) {
+		if (__direct_io) {
+			split(threads);
+		}
+	};
+	size_t getItemCount() const {
+		return (__direct_io) ? _runs.size() : _pak.getEntries().size();
+	};
+	void begin(unsigned int thread) {
+		_sources[thread]=new DumpSource();
+		_sources[thread]->open(_pak);
+		_decoders[thread]=new BlockDecoder();
+	};
+	void run(size_t index, unsigned int thread) {
+		if (!__direct_io) {
+			dump(index, thread);
+			return;
+		}
+		const DumpRun& run=_runs[index];
+		_sources[thread]->setLimit(run.limit);
+		for (size_t i=run.first; i<run.last; ++i) {
+			dump(_order[i], thread);
+		}
+	};
+	void end(unsigned int thread) {
+		delete _sources[thread];
+		_sources[thread]=NULL;
+		delete _decoders[thread];
+		_decoders[thread]=NULL;
+	};
+	
+protected:
+	// _order[first, last) and the end of their compressed data
+	struct DumpRun {
+		size_t first, last;
+		uint64_t limit;
+	};
+	
+	const SDPK2& _pak;
+	const char* _outdir;
+	std::vector<DumpSource*> _sources;
+	std::vector<BlockDecoder*> _decoders;
+	std::vector<size_t> _order;
+	std::vector<DumpRun> _runs;
+	
+	void dump(size_t index, unsigned int thread) {
+		const Entry& entry=_pak.getEntries()[index];
+		char hash_str[33];
+		entry.hash().getExisting(hash_str, true);
+		if (_sources[thread]->get()) {
+			dump_entry(*_sources[thread]->get(), *_decoders[thread], _pak, entry, hash_str, _outdir, hash_str);
+		}
+	};
+	// a few runs per thread (for balance), each at least a window long
+	void split(unsigned int threads) {
+		const EntryVec& entries=_pak.getEntries();
+		std::vector<uint64_t> ends(entries.size(), 0);
+		uint64_t total=0;
+		for (size_t i=0; i<entries.size(); ++i) {
+			uint64_t offset, c_size;
+			if (entries[i].getCompressedRange(_pak, 0, 0xFFFFFFFF, offset, c_size)==READERR_NONE) {
+				ends[i]=offset+c_size;
+				total+=c_size;
+			}
+			_order.push_back(i);
+		}
+		__DumpOffsetLess offset_less={&entries};
+		std::stable_sort(_order.begin(), _order.end(), offset_less);
+		uint64_t target=total/((uint64_t)threads*4+1);
+		if (target<DIRECT_IO_WINDOW) {
+			target=DIRECT_IO_WINDOW;
+		}
+		DumpRun run={0, 0, 0};
+		uint64_t start=0;
+		for (size_t i=0; i<_order.size(); ++i) {
+			uint64_t offset=entries[_order[i]].getOffset();
+			if (run.last>run.first && offset>=start+target) {
+				_runs.push_back(run);
+				run.first=i;
+				run.limit=0;
+			}
+			if (run.last==run.first) {
+				start=offset;
+			}
+			run.last=i+1;
+			if (ends[_order[i]]>run.limit) {
+				run.limit=ends[_order[i]];
+			}
+		}
+		if (run.last>run.first) {
+			_runs.push_back(run);
+		}
+	};
+};
+
+// extracts the entries of a DedupIndex which are not duplicates
+class DedupDumpTask : public ParallelTask {
+public:
+	DedupDumpTask(const std::vector<SDPK2*>& paks, const DedupIndex& index, const std::vector<std::string>& dirs, unsigned int threads)
+		: _paks(paks), _index(index), _dirs(dirs), _sources(threads), _decoders(threads, (BlockDecoder*)NULL), _written(index.getEntryCount(), false), _crcs(index.getEntryCount(), 0) {
+	};
+	void begin(unsigned int thread) {
+		_sources[thread].assign(_paks.size(), (DumpSource*)NULL);
+		_decoders[thread]=new BlockDecoder();
+	};
+	void run(size_t index, unsigned int thread) {
+		if (_index.getSource(index)>=0) {
+			return;
+		}
+		const DedupRef& ref=_index.getRef(index);
+		const Entry& entry=_index.getEntry(index);
+		DumpSource*& source=_sources[thread][ref.archive];
+		if (!source) {
+			source=new DumpSource();
+			source->open(*_paks[ref.archive]);
+		}
+		char hash_str[33];
+		entry.hash().getExisting(hash_str, true);
+		if (source->get()) {
+			_written[index]=dump_entry(*source->get(), *_decoders[thread], *_paks[ref.archive], entry, hash_str, _dirs[ref.archive].c_str(), hash_str, &_crcs[index]);
+		}
+	};
+	void end(unsigned int thread) {
+		for (size_t i=0; i<_sources[thread].size(); ++i) {
+			delete _sources[thread][i];
+		}
+		_sources[thread].clear();
+		delete _decoders[thread];
+		_decoders[thread]=NULL;
+	};
+	bool written(size_t index) const {
+		return _written[index];
+	};
+	uint32_t getCRC(size_t index) const {
+		return _crcs[index];
+	};
+	
+protected:
+	const std::vector<SDPK2*>& _paks;
+	const DedupIndex& _index;
+	const std::vector<std::string>& _dirs;
+	std::vector<std::vector<DumpSource*> > _sources;
+	std::vector<BlockDecoder*> _decoders;
+	// not vector<bool>; threads write neighbouring elements
+	std::vector<char> _written;
+	std::vector<uint32_t> _crcs;
+};
+
+// Options start with "--" and may appear anywhere; everything else is positional
+bool parse_options(int argc, char** argv, std::vector<char*>& args) {
+	for (int i=1; i<argc; ++i) {
+		const char* arg=argv[i];
+		if (strncmp(arg, "--", 2)!=0) {
+			args.push_back(argv[i]);
+		} else if (strcmp(arg, "--manifest")==0) {
+			__manifest_path="";
+		} else if (strncmp(arg, "--manifest=", 11)==0) {
+			__manifest_path=arg+11;
+		} else if (strncmp(arg, "--threads=", 10)==0) {
+			__threads=(unsigned int)atoi(arg+10);
+		} else if (strcmp(arg, "--verify")==0) {
+			__verify=true;
+		} else if (strcmp(arg, "--analyze")==0) {
+			__analyze=true;
+		} else if (strcmp(arg, "--transcode")==0) {
+			__transcode=true;
+		} else if (strncmp(arg, "--transcode=", 12)==0) {
+			__transcode=true;
+			__transcode_level=atoi(arg+12);
+		} else if (strcmp(arg, "--direct-io")==0) {
+			__direct_io=true;
+		} else if (strncmp(arg, "--record=", 9)==0) {
+			__record_path=arg+9;
+		} else if (strncmp(arg, "--prefetch=", 11)==0) {
+			__prefetch_path=arg+11;
+		} else if (strcmp(arg, "--no-sidecar")==0) {
+			__use_sidecar=false;
+		} else if (strcmp(arg, "--update")==0) {
+			__update=true;
+		} else if (strcmp(arg, "--diff")==0) {
+			__diff=true;
+		} else if (strcmp(arg, "--list")==0) {
+			__list=true;
+		} else if (strncmp(arg, "--grep=", 7)==0) {
+			__grep_patterns.push_back(arg+7);
+		} else if (strcmp(arg, "--grep")==0 && i+1<argc) {
+			__grep_patterns.push_back(argv[++i]);
+		} else if (strcmp(arg, "--dedup")==0 || strcmp(arg, "--dedup=hardlink")==0) {
+			__dedup=DEDUP_HARDLINK;
+		} else if (strcmp(arg, "--dedup=reflink")==0) {
+			__dedup=DEDUP_REFLINK;
+		} else if (strncmp(arg, "--find=", 7)==0) {
+			__find_paths.push_back(arg+7);
+		} else if (strncmp(arg, "--path-index=", 13)==0) {
+			__path_index=arg+13;
+		} else if (strncmp(arg, "--reorder=", 10)==0) {
+			__reorder=getReorderMode(arg+10);
+			if (__reorder==REORDER_UNKNOWN) {
+				printf("ERROR: --reorder takes trace, dir or size: %s\n", arg+10);
+				return false;
+			}
+		} else if (strncmp(arg, "--tar=", 6)==0) {
+			__tar_path=arg+6;
+		} else if (strcmp(arg, "--tar")==0 && i+1<argc) {
+			__tar_path=argv[++i];
+		} else if (strncmp(arg, "--query-file=", 13)==0) {
+			__query_path=arg+13;
+		} else if (strcmp(arg, "--stats")==0) {
+			__stats_path="";
+		} else if (strncmp(arg, "--stats=", 8)==0) {
+			__stats_path=arg+8;
+		} else if (strncmp(arg, "--trace=", 8)==0) {
+			__trace_path=arg+8;
+		} else if (strncmp(arg, "--max-read=", 11)==0) {
+			if (!Throttle::parseRate(arg+11, __throttle.read)) {
+				printf("ERROR: --max-read takes a rate in MB/s (0 for unlimited): %s\n", arg+11);
+				return false;
+			}
+		} else if (strncmp(arg, "--max-write=", 12)==0) {
+			if (!Throttle::parseRate(arg+12, __throttle.write)) {
+				printf("ERROR: --max-write takes a rate in MB/s (0 for unlimited): %s\n", arg+12);
+				return false;
+			}
+		} else if (strncmp(arg, "--max-inflate=", 14)==0) {
+			if (!Throttle::parseThreads(arg+14, __throttle.inflate)) {
+				printf("ERROR: --max-inflate takes a thread count (0 for unlimited): %s\n", arg+14);
+				return false;
+			}
+		} else if (strncmp(arg, "--throttle=", 11)==0) {
+			__throttle_path=arg+11;
+		} else if (strncmp(arg, "--format=", 9)==0) {
+			__format=arg+9;
+		} else {
+			printf("ERROR: unrecognized option: %s\n", arg);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool print_stats() {
+	if (!__stats_path) {
+		return true;
+	}
+	FILE* out=(__stats_path[0]=='\0') ? stderr : fopen(__stats_path, "w");
+	if (!out) {
+		printf("ERROR: Failed to open stats output: %s\n", __stats_path);
+		return false;
+	}
+	Stats::print(out, strcmp(__format, "json")==0);
+	if (out!=stderr) {
+		fclose(out);
+	}
+	return true;
+}
+
+/*
+	--dedup: extract every given archive to <outdir><archive name>/<hash>, writing identical
+	entries once and linking the other copies to the first one.
+*/
+int run_dedup(const std::vector<char*>& args) {
+	const char* outdir="dump/";
+	std::vector<SDPK2*> paks;
+	std::vector<std::string> dirs;
+	int status=0;
+	for (size_t i=0; i<args.size(); ++i) {
+		size_t len=strlen(args[i]);
+		if (len>=5 && strncmp(args[i]+len-5, "sdpk2", 5)==0) {
+			paks.push_back(new SDPK2(args[i]));
+		} else {
+			outdir=args[i];
+		}
+	}
+	if (paks.empty()) {
+		printf("ERROR: --dedup requires one or more sdpk2 paths\n");
+		return 1;
+	}
+	for (size_t i=0; i<paks.size() && status==0; ++i) {
+		// the archive's file name without its extension
+		const char* path=paks[i]->getPath();
+		const char* name=strrchr(path, '/');
+		name=(name) ? name+1 : path;
+		std::string dir(outdir);
+		dir.append(name, strrchr(name, '.') ? strrchr(name, '.')-name : strlen(name));
+		// archives with the same name (e.g. v1/x.sdpk2 and v2/x.sdpk2) get "-<index>" until unique
+		bool renamed=false;
+		while (std::find(dirs.begin(), dirs.end(), dir+"/")!=dirs.end()) {
+			char suffix[24];
+			snprintf(suffix, sizeof(suffix), "-%lu", (unsigned long)i);
+			dir.append(suffix);
+			renamed=true;
+		}
+		dir.append("/");
+		if (renamed) {
+			printf("# %s extracts to %s\n", path, dir.c_str());
+		}
+		if (!paks[i]->open()) {
+			status=1;
+		} else if (mkdir(dir.c_str(), 0755)!=0 && errno!=EEXIST) {
+			printf("ERROR: Failed to create directory: %s\n", dir.c_str());
+			status=1;
+		}
+		dirs.push_back(dir);
+	}
+	if (status==0 && !open_manifest(outdir)) {
+		status=1;
+	}
+	if (status==0) {
+		unsigned int threads=(__threads>0) ? __threads : getHardwareThreads();
+		DedupIndex index;
+		for (size_t i=0; i<paks.size(); ++i) {
+			index.addArchive(*paks[i]);
+		}
+		size_t duplicates=index.build(threads);
+		DedupDumpTask task(paks, index, dirs, threads);
+		parallelFor(index.getEntryCount(), threads, task);
+		size_t linked=0;
+		BlockDecoder decoder;
+		char hash_str[33];
+		for (size_t i=0; i<index.getEntryCount(); ++i) {
+			long source=index.getSource(i);
+			if (source<0) {
+				continue;
+			}
+			const DedupRef& ref=index.getRef(i);
+			const Entry& entry=index.getEntry(i);
+			entry.hash().getExisting(hash_str, true);
+			std::string path(dirs[ref.archive]);
+			path.append(hash_str);
+			if (task.written(source)) {
+				char src_hash[33];
+				index.getEntry(source).hash().getExisting(src_hash, true);
+				std::string src(dirs[index.getRef(source).archive]);
+				src.append(src_hash);
+				if (linkFile(src.c_str(), path.c_str(), __dedup)) {
+					printf("Linking [%s] to %s\n", hash_str, src.c_str());
+					if (__manifest) {
+						fprintf(__manifest, "%s %lu %08x %s\n", hash_str, (unsigned long)entry.getSize(), task.getCRC(source), path.c_str());
+					}
+					++linked;
+					continue;
+				}
+			}
+			// no link support (or the source failed); write the copy
+			DumpSource reader;
+			if (reader.open(*paks[ref.archive])) {
+				dump_entry(*reader.get(), decoder, *paks[ref.archive], entry, hash_str, dirs[ref.archive].c_str(), hash_str);
+			}
+		}
+		close_manifest();
+		printf("# archives:%lu entries:%lu duplicates:%lu linked:%lu duplicate_bytes:%lu\n",
+			(unsigned long)paks.size(), (unsigned long)index.getEntryCount(), (unsigned long)duplicates, (unsigned long)linked, (unsigned long)index.getDuplicateBytes());
+	}
+	for (size_t i=0; i<paks.size(); ++i) {
+		delete paks[i];
+	}
+	return status;
+}
+
+// --diff: exits with 0 if the archives are the same, 1 if they differ and 2 on error
+int run_diff(const std::vector<char*>& args) {
+	if (args.size()!=2) {
+		printf("ERROR: --diff requires old and new sdpk2 paths\n");
+		return 2;
+	}
+	SDPK2 old_pak(args[0]), new_pak(args[1]);
+	if (!old_pak.open() || !new_pak.open()) {
+		return 2;
+	}
+	ArchiveDiff diff;
+	if (!diff.compare(old_pak, new_pak, __threads)) {
+		return 2;
+	}
+	diff.printText(stdout);
+	return (diff.hasChanges()) ? 1 : 0;
+}
+
+// --update: replace or add entries with the contents of files
+int run_update(const std::vector<char*>& args) {
+	if (args.size()<3 || args.size()%2!=1) {
+		printf("ERROR: --update requires an sdpk2 path and hash/file pairs\n");
+		return 1;
+	}
+	SDPK2 pak(args[0]);
+	if (!pak.open()) {
+		return 1;
+	}
+	ArchiveUpdate update(pak);
+	if (!update.open()) {
+		return 1;
+	}
+	size_t replaced=0, added=0;
+	std::vector<char> data;
+	for (size_t i=1; i<args.size(); i+=2) {
+		MD5Hash hash;
+		if (!hash.set(args[i])) {
+			printf("Malformed hash: %s\n", args[i]);
+			return 1;
+		}
+		Stream* in=FileStream::readFile(args[i+1]);
+		if (!in) {
+			printf("ERROR: Failed to open %s\n", args[i+1]);
+			return 1;
+		}
+		data.resize(in->size());
+		bool ok=data.empty() || in->read(&data[0], data.size())==data.size();
+		in->close();
+		delete in;
+		if (!ok) {
+			printf("ERROR: Failed to read %s\n", args[i+1]);
+			return 1;
+		}
+		if (!update.setEntry(hash, data.empty() ? NULL : &data[0], data.size())) {
+			return 1;
+		}
+		(pak.findEntry(hash)) ? ++replaced : ++added;
+	}
+	if (!update.commit()) {
+		return 1;
+	}
+	printf("# replaced:%lu added:%lu appended_bytes:%lu relocated:%lu header_size:%lu\n",
+		(unsigned long)replaced, (unsigned long)added, (unsigned long)update.getAppendedBytes(),
+		(unsigned long)update.getRelocatedCount(), (unsigned long)pak.getHeaderSize());
+	return 0;
+}
+
+// archive [table.sdmd2]; entries are named by their table paths when a table is given
+int run_tar(SDPK2& pak, const std::vector<char*>& args) {
+	SDMD2* table=NULL;
+	PathIndex paths;
+	if (args.size()>1) {
+		size_t len=strlen(args[1]);
+		if (len<5 || strncmp((args[1]+len)-5, "sdmd2", 5)!=0) {
+			fprintf(stderr, "ERROR: --tar takes an sdmd2 path for names: %s\n", args[1]);
+			return 1;
+		}
+		table=new SDMD2(args[1]);
+		if (!table->load()) {
+			delete table;
+			return 1;
+		}
+		paths.build(*table);
+	}
+	int fd=1;
+	if (strcmp(__tar_path, "-")!=0) {
+		fd=open(__tar_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (fd<0) {
+			fprintf(stderr, "ERROR: Failed to open tar output: %s\n", __tar_path);
+			delete table;
+			return 1;
+		}
+	}
+	size_t bad=tarArchive(pak, (table) ? &paths : NULL, __threads, fd);
+	bool ok=true;
+	if (fd!=1) {
+		ok=(close(fd)==0);
+	}
+	delete table;
+	return (bad>0 || !ok) ? 1 : 0;
+}
+
+// archive table.sdmd2; prints "<hash> <size> <time_modified> <path>" per path ("-" for what is missing)
+int run_find(SDPK2& pak, const std::vector<char*>& args) {
+	size_t len=(args.size()==2) ? strlen(args[1]) : 0;
+	if (len<5 || strncmp((args[1]+len)-5, "sdmd2", 5)!=0) {
+		printf("ERROR: --find takes: archive.sdpk2 table.sdmd2\n");
+		return 1;
+	}
+	SDMD2 table(args[1]);
+	if (!table.load()) {
+		return 1;
+	}
+	PathHash index;
+	if (!__path_index || !index.load(__path_index, table, &pak)) {
+		index.build(table, &pak);
+		if (__path_index && !index.save(__path_index)) {
+			return 1;
+		}
+	}
+	size_t missing=0;
+	char hash_str[33];
+	PathMatch match;
+	for (size_t i=0; i<__find_paths.size(); ++i) {
+		const std::string& path=__find_paths[i];
+		if (!index.find(path.data(), path.size(), match)) {
+			printf("- - - %s\n", path.c_str());
+			++missing;
+			continue;
+		}
+		match.hash.getExisting(hash_str, true);
+		if (match.entry) {
+			printf("%s %lu %lu %s\n", hash_str, (unsigned long)match.entry->getSize(), (unsigned long)match.file->getTimeModified(), path.c_str());
+		} else {
+			printf("%s - %lu %s\n", hash_str, (unsigned long)match.file->getTimeModified(), path.c_str());
+			++missing;
+		}
+	}
+	return (missing>0) ? 1 : 0;
+}
+
+// archive out.sdpk2 [trace|table.sdmd2]
+int run_reorder(SDPK2& pak, const std::vector<char*>& args) {
+	size_t needed=(__reorder==REORDER_SIZE) ? 2 : 3;
+	if (args.size()!=needed) {
+		printf("ERROR: --reorder=trace takes: archive.sdpk2 out.sdpk2 access.trace\n"
+			"\t--reorder=dir takes: archive.sdpk2 out.sdpk2 table.sdmd2\n"
+			"\t--reorder=size takes: archive.sdpk2 out.sdpk2\n");
+		return 1;
+	}
+	std::vector<size_t> order;
+	if (__reorder==REORDER_TRACE) {
+		AccessTrace trace;
+		if (!trace.load(args[2])) {
+			return 1;
+		}
+		// the trace's first archive is this one
+		orderByTrace(pak, trace, 0, order);
+	} else if (__reorder==REORDER_PATH) {
+		SDMD2 table(args[2]);
+		PathIndex paths;
+		if (!table.load()) {
+			return 1;
+		}
+		paths.build(table);
+		orderByPath(pak, paths, order);
+	} else {
+		orderBySize(pak, order);
+	}
+	if (!reorderArchive(pak, order, args[1])) {
+		return 1;
+	}
+	printf("# entries:%lu written:%s\n", (unsigned long)order.size(), args[1]);
+	return 0;
+}
+
+// archive hash [outpath] without --direct-io, a sidecar or any mode option:
+// only the entry's record and block sizes are read from the mapped header
+bool is_single_dump(const SDPK2& pak, const std::vector<char*>& args) {
+	struct stat st;
+	if (args.size()<2 || strncmp(args[1], "-a", 2)==0 || __direct_io
+		|| __transcode || __verify || !__grep_patterns.empty() || !__find_paths.empty()
+		|| __reorder!=REORDER_UNKNOWN || __tar_path || __query_path || __list || __analyze
+		|| __record_path || __prefetch_path) {
+		return false;
+	}
+	return !__use_sidecar || stat(ZstdSidecar::getPath(pak).c_str(), &st)!=0;
+}
+
+int run_single(SDPK2& pak, const std::vector<char*>& args) {
+	const char* hash_str=args[1];
+	const char* path=(args.size()>2) ? args[2] : args[1];
+	MD5Hash hash;
+	if (!hash.set(hash_str)) {
+		printf("Malformed hash\n");
+		return 1;
+	}
+	MappedFile file;
+	if (!file.open(pak.getPath())) {
+		return 1;
+	}
+	if (!pak.deserializeEntry(hash, (const unsigned char*)file.data(), file.size())) {
+		printf("Entry [%s] not found\n", hash_str);
+		return 1;
+	}
+	if (!open_manifest("dump/")) {
+		return 1;
+	}
+	MemoryBlockSource source(file.data(), file.size(), 0);
+	BlockDecoder decoder;
+	dump_entry(source, decoder, pak, pak.getEntries()[0], hash_str, "dump/", path);
+	close_manifest();
+	return 0;
+}
+
+int run(const std::vector<char*>& args) {
+	if (args.size()<1) {
 		printf("ERROR: sdpk2/sdmd2 path required\n");
 		return 1;
 	}
-	const char* path=argv[1];
+	const char* path=args[0];
 	size_t len=strlen(path);
+	int list_format=getListFormat(__format);
+	if ((__list || __query_path) && list_format==LISTFORMAT_UNKNOWN) {
+		printf("ERROR: --list/--query-file format must be json, csv or tsv: %s\n", __format);
+		return 1;
+	}
 	if (strncmp((path+len)-5, "sdmd2", 5)==0) {
 		SDMD2 table(path);
 		if (table.load()) {
-			table.printInfo();
+			if (__list) {
+				listTable(table, list_format, stdout);
+			} else {
+				table.printInfo();
+			}
 		} else {
 			return 1;
 		}
 	} else if (strncmp((path+len)-5, "sdpk2", 5)==0) {
 		SDPK2 pak(path);
-		if (pak.open()) {
+		if (is_single_dump(pak, args)) {
+			return run_single(pak, args);
+		}
+		PrefetchScope prefetch;
+		if (pak.open() && prefetch.begin(pak)) {
 			//pak.printInfo(0, true);
-			if (argc>2) {
-				__hash_str_ptr=argv[2];
-				if (argc>3) {
-					path=argv[3];
+			if (__transcode) {
+				bool ok=ZstdSidecar::transcode(pak, __transcode_level, __threads);
+				pak.close();
+				return (ok) ? 0 : 1;
+			} else if (__verify) {
+				size_t bad=verifyArchive(pak, __threads, stdout);
+				pak.close();
+				return (bad>0) ? 1 : 0;
+			} else if (!__grep_patterns.empty()) {
+				size_t matches=grepArchive(pak, __grep_patterns, __threads, stdout);
+				pak.close();
+				return (matches>0) ? 0 : 1;
+			} else if (!__find_paths.empty()) {
+				int status=run_find(pak, args);
+				pak.close();
+				return status;
+			} else if (__reorder!=REORDER_UNKNOWN) {
+				int status=run_reorder(pak, args);
+				pak.close();
+				return status;
+			} else if (__tar_path) {
+				int status=run_tar(pak, args);
+				pak.close();
+				return status;
+			} else if (__query_path) {
+				long misses=queryArchive(pak, __query_path, list_format, stdout);
+				pak.close();
+				return (misses!=0) ? 1 : 0;
+			} else if (__list) {
+				listArchive(pak, list_format, stdout);
+			} else if (__analyze) {
+				ArchiveAnalysis analysis;
+				analysis.analyze(pak);
+				if (strcmp(__format, "json")==0) {
+					analysis.printJSON(stdout, pak);
 				} else {
-					path=argv[2];
+					analysis.printText(stdout);
+				}
+			} else if (args.size()>1) {
+				if (__use_sidecar) {
+					__sidecar.open(pak);
+				}
+				const char* hash_str=args[1];
+				if (args.size()>2) {
+					path=args[2];
+				} else {
+					path=args[1];
 				}
 				MD5Hash hash;
-				if (strncmp(__hash_str_ptr, "-a", 2)==0) {
-					__hash_str_ptr=__hash_str;
+				if (strncmp(hash_str, "-a", 2)==0) {
 					if (strncmp(path, "-a", 2)==0) {
 						path="dump/";
 					}
-					const EntryVec& entries=pak.getEntries();
-					for (size_t i=0; i<entries.size(); ++i) {
-						entries[i].hash().getExisting(__hash_str, false);
-						dump_entry(pak, entries[i], path, __hash_str_ptr);
+					if (!open_manifest(path)) {
+						return 1;
 					}
-				} else if (hash.set(__hash_str_ptr)) {
+					unsigned int threads=(__threads>0) ? __threads : getHardwareThreads();
+					DumpTask task(pak, path, threads);
+					parallelFor(task.getItemCount(), threads, task);
+					close_manifest();
+				} else if (hash.set(hash_str)) {
 					const Entry* entry=pak.findEntry(hash);
 					if (entry) {
-						dump_entry(pak, *entry, "dump/", path);
+						if (!open_manifest("dump/")) {
+							return 1;
+						}
+						DumpSource source;
+						BlockDecoder decoder;
+						if (!source.open(pak)) {
+							close_manifest();
+							return 1;
+						}
+						dump_entry(*source.get(), decoder, pak, *entry, hash_str, "dump/", path);
+						close_manifest();
 					} else {
-						printf("Entry [%s] not found\n", __hash_str_ptr);
+						printf("Entry [%s] not found\n", hash_str);
 						return 1;
 					}
 				} else {
@@ -80,6 +958,7 @@ int main(int argc, char** argv) {
 					return 1;
 				}
 			}
+			__sidecar.close();
 			pak.close();
 		} else {
 			return 1;
@@ -90,3 +969,31 @@ int main(int argc, char** argv) {
 	return 0;
 }
 
+int main(int argc, char** argv) {
+	std::vector<char*> args;
+	if (!parse_options(argc, argv, args)) {
+		return 1;
+	}
+	Stats::enabled=(__stats_path!=NULL);
+	Trace::enabled=(__trace_path!=NULL);
+	if (!Throttle::start(__throttle, __throttle_path)) {
+		return 1;
+	}
+	int status;
+	if (__diff) {
+		status=run_diff(args);
+	} else if (__update) {
+		status=run_update(args);
+	} else if (__dedup>=0) {
+		status=run_dedup(args);
+	} else {
+		status=run(args);
+	}
+	if (!print_stats()) {
+		return 1;
+	}
+	if (__trace_path && !Trace::write(__trace_path)) {
+		return 1;
+	}
+	return status;
+}
@@ -0,0 +1,51 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mappedfile.hpp"
+
+namespace PK2Unpack {
+
+// class MappedFile implementation
+
+bool MappedFile::open(const char* path) {
+	close();
+	int fd=::open(path, O_RDONLY);
+	if (fd<0) {
+		printf("ERROR: Failed to open file: %s\n", path);
+		return false;
+	}
+	struct stat st;
+	bool ok=(fstat(fd, &st)==0);
+	if (ok && st.st_size>0) {
+		void* p=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p==MAP_FAILED) {
+			ok=false;
+		} else {
+			_data=(const char*)p;
+			_size=st.st_size;
+		}
+	}
+	::close(fd);
+	if (!ok) {
+		printf("ERROR: Failed to map file: %s\n", path);
+	}
+	return ok;
+}
+
+void MappedFile::close() {
+	if (_data) {
+		munmap((void*)_data, _size);
+		_data=NULL;
+		_size=0;
+	}
+}
+
+} // namespace PK2Unpack
@@ -0,0 +1,120 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <string.h>
+#include "md5.hpp"
+
+namespace PK2Unpack {
+
+// class MD5 implementation
+
+// per-round shift amounts
+static const unsigned int __md5_shift[64]={
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+// floor(abs(sin(i+1))*2^32)
+static const uint32_t __md5_k[64]={
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+void MD5::reset() {
+	_state[0]=0x67452301;
+	_state[1]=0xefcdab89;
+	_state[2]=0x98badcfe;
+	_state[3]=0x10325476;
+	_length=0;
+}
+
+void MD5::transform(const unsigned char* block) {
+	uint32_t m[16];
+	for (unsigned int i=0; i<16; ++i) {
+		// little-endian words
+		m[i]=(uint32_t)block[i*4]|((uint32_t)block[i*4+1]<<8)|((uint32_t)block[i*4+2]<<16)|((uint32_t)block[i*4+3]<<24);
+	}
+	uint32_t a=_state[0], b=_state[1], c=_state[2], d=_state[3];
+	for (unsigned int i=0; i<64; ++i) {
+		uint32_t f;
+		unsigned int g;
+		if (i<16) {
+			f=(b&c)|(~b&d);
+			g=i;
+		} else if (i<32) {
+			f=(d&b)|(~d&c);
+			g=(5*i+1)&15;
+		} else if (i<48) {
+			f=b^c^d;
+			g=(3*i+5)&15;
+		} else {
+			f=c^(b|~d);
+			g=(7*i)&15;
+		}
+		f+=a+__md5_k[i]+m[g];
+		a=d;
+		d=c;
+		c=b;
+		b+=(f<<__md5_shift[i])|(f>>(32-__md5_shift[i]));
+	}
+	_state[0]+=a;
+	_state[1]+=b;
+	_state[2]+=c;
+	_state[3]+=d;
+}
+
+void MD5::update(const void* data, size_t size) {
+	const unsigned char* p=(const unsigned char*)data;
+	size_t used=_length&63;
+	_length+=size;
+	if (used>0) {
+		size_t n=(size<64-used) ? size : 64-used;
+		memcpy(_buffer+used, p, n);
+		p+=n;
+		size-=n;
+		if (used+n<64) {
+			return;
+		}
+		transform(_buffer);
+	}
+	for (; size>=64; p+=64, size-=64) {
+		transform(p);
+	}
+	memcpy(_buffer, p, size);
+}
+
+void MD5::finish(MD5Hash& out) {
+	uint64_t bits=_length*8;
+	unsigned char pad[72];
+	size_t used=_length&63;
+	size_t n=(used<56) ? 56-used : 120-used;
+	memset(pad, 0, sizeof(pad));
+	pad[0]=0x80;
+	for (unsigned int i=0; i<8; ++i) {
+		pad[n+i]=(bits>>(i*8))&0xFF;
+	}
+	update(pad, n+8);
+	unsigned char* o=out.data();
+	for (unsigned int i=0; i<16; ++i) {
+		o[i]=(_state[i/4]>>((i%4)*8))&0xFF;
+	}
+}
+
+void MD5::compute(const void* data, size_t size, MD5Hash& out) {
+	MD5 md5;
+	md5.update(data, size);
+	md5.finish(out);
+}
+
+} // namespace PK2Unpack
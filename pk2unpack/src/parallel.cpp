@@ -0,0 +1,71 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <unistd.h>
+#include <pthread.h>
+#include <vector>
+#include <duct/debug.hpp>
+#include "parallel.hpp"
+
+namespace PK2Unpack {
+
+unsigned int getHardwareThreads() {
+	long count=sysconf(_SC_NPROCESSORS_ONLN);
+	return (count<1) ? 1 : (unsigned int)count;
+}
+
+struct __ParallelState {
+	ParallelTask* task;
+	size_t count;
+	size_t next;
+};
+
+struct __ParallelThread {
+	__ParallelState* state;
+	unsigned int index;
+};
+
+static void* __parallel_worker(void* arg) {
+	__ParallelThread* t=(__ParallelThread*)arg;
+	__ParallelState* state=t->state;
+	state->task->begin(t->index);
+	size_t i;
+	while ((i=__sync_fetch_and_add(&state->next, 1))<state->count) {
+		state->task->run(i, t->index);
+	}
+	state->task->end(t->index);
+	return NULL;
+}
+
+void parallelFor(size_t count, unsigned int threads, ParallelTask& task) {
+	if (threads==0) {
+		threads=getHardwareThreads();
+	}
+	if (threads>count) {
+		threads=(count>0) ? count : 1;
+	}
+	__ParallelState state={&task, count, 0};
+	std::vector<__ParallelThread> info(threads);
+	std::vector<pthread_t> handles(threads);
+	unsigned int started=1;
+	for (unsigned int i=0; i<threads; ++i) {
+		info[i].state=&state;
+		info[i].index=i;
+	}
+	for (unsigned int i=1; i<threads; ++i) {
+		if (pthread_create(&handles[i], NULL, __parallel_worker, &info[i])!=0) {
+			debug_printp_source(&task, "failed to create worker thread");
+			break;
+		}
+		++started;
+	}
+	__parallel_worker(&info[0]);
+	for (unsigned int i=1; i<started; ++i) {
+		pthread_join(handles[i], NULL);
+	}
+}
+
+} // namespace PK2Unpack
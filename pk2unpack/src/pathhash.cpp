@@ -0,0 +1,333 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <algorithm>
+#include "byteorder.hpp"
+#include "crc32c.hpp"
+#include "md5.hpp"
+#include "pathindex.hpp"
+#include "pathhash.hpp"
+
+namespace PK2Unpack {
+
+#define PATHHASH_NONE 0xFFFFFFFF
+#define PATHHASH_HEAD_SIZE 36
+
+// key hash for a level: the MD5 is already uniform, so double hashing and a finalizer suffice
+static inline uint64_t __level_hash(const MD5Hash& hash, unsigned int level) {
+	uint64_t a, b;
+	memcpy(&a, hash.data(), 8);
+	memcpy(&b, hash.data()+8, 8);
+	uint64_t x=a+(uint64_t)level*(b|1);
+	x^=x>>33;
+	x*=0xFF51AFD7ED558CCDull;
+	x^=x>>33;
+	x*=0xC4CEB9FE1A85EC53ull;
+	x^=x>>33;
+	return x;
+}
+
+// [0, range) without a division
+static inline uint64_t __reduce(uint64_t x, uint64_t range) {
+	return (uint64_t)(((unsigned __int128)x*range)>>64);
+}
+
+static bool __md5_less(const MD5Hash& x, const MD5Hash& y) {
+	return x.compare(y)<0;
+}
+
+// CRC32C of the entry hashes in index order; the slots' entry indices only hold while it matches
+static uint32_t __entries_fingerprint(const SDPK2* pak) {
+	CRC32C crc;
+	if (pak) {
+		const EntryVec& entries=pak->getEntries();
+		for (size_t i=0; i<entries.size(); ++i) {
+			crc.update(entries[i].hash().data(), 16);
+		}
+	}
+	return crc.value();
+}
+
+// whether path is the file's dir name, "/" and name (as PathIndex::resolvePath() builds it)
+static bool __path_equals(const EntryInfoSet& info, const FileInfo& file, const char* path, size_t length) {
+	const char* dir=info.getName(file.getDirIndex());
+	const char* name=info.getName(file.getIndex());
+	if (!dir || !name) {
+		return false;
+	}
+	size_t dir_length=strlen(dir);
+	if (dir_length>length || memcmp(dir, path, dir_length)!=0) {
+		return false;
+	}
+	path+=dir_length;
+	length-=dir_length;
+	if (dir_length==0 || dir[dir_length-1]!='/') {
+		if (length==0 || *path!='/') {
+			return false;
+		}
+		++path;
+		--length;
+	}
+	return strlen(name)==length && memcmp(name, path, length)==0;
+}
+
+// class PathHash implementation
+
+PathHash::PathHash() : _table(NULL), _pak(NULL) {
+}
+
+size_t PathHash::build(const SDMD2& table, const SDPK2* pak) {
+	_table=&table;
+	_pak=pak;
+	_bits.clear();
+	_levels.assign(1, 0);
+	_fallback.clear();
+	const EntryInfoSet& info=table.getEntryInfo();
+	const FileInfoVec& files=info.getData();
+	std::vector<MD5Hash> keys;
+	std::vector<uint32_t> key_files;
+	keys.reserve(files.size());
+	key_files.reserve(files.size());
+	std::string path;
+	MD5Hash hash;
+	for (size_t i=0; i<files.size(); ++i) {
+		if (PathIndex::resolvePath(info, files[i], path)) {
+			MD5::compute(path.data(), path.size(), hash);
+			keys.push_back(hash);
+			key_files.push_back(i);
+		}
+	}
+	// indices into keys still to be placed
+	std::vector<uint32_t> remaining(keys.size()), next;
+	for (size_t i=0; i<remaining.size(); ++i) {
+		remaining[i]=i;
+	}
+	std::vector<uint64_t> collide;
+	for (unsigned int level=0; level<PATHHASH_MAX_LEVELS && !remaining.empty(); ++level) {
+		uint64_t size=(uint64_t)(remaining.size()*PATHHASH_GAMMA);
+		size=(size+63)&~(uint64_t)63;
+		uint64_t base=_levels.back();
+		_bits.resize((base+size)/64, 0);
+		collide.assign(size/64, 0);
+		uint64_t* bits=&_bits[base/64];
+		for (size_t i=0; i<remaining.size(); ++i) {
+			uint64_t p=__reduce(__level_hash(keys[remaining[i]], level), size);
+			if (bits[p/64]&(1ull<<(p%64))) {
+				collide[p/64]|=1ull<<(p%64);
+			} else {
+				bits[p/64]|=1ull<<(p%64);
+			}
+		}
+		next.clear();
+		for (size_t i=0; i<size/64; ++i) {
+			bits[i]&=~collide[i];
+		}
+		for (size_t i=0; i<remaining.size(); ++i) {
+			uint64_t p=__reduce(__level_hash(keys[remaining[i]], level), size);
+			if (collide[p/64]&(1ull<<(p%64))) {
+				next.push_back(remaining[i]);
+			}
+		}
+		remaining.swap(next);
+		_levels.push_back(base+size);
+	}
+	buildRanks();
+	for (size_t i=0; i<remaining.size(); ++i) {
+		_fallback.push_back(keys[remaining[i]]);
+	}
+	std::sort(_fallback.begin(), _fallback.end(), __md5_less);
+	// fill the slots
+	std::vector<const Entry*> found(keys.size(), (const Entry*)NULL);
+	if (pak && !keys.empty()) {
+		pak->findEntries(&keys[0], keys.size(), &found[0]);
+	}
+	_files.assign(keys.size(), PATHHASH_NONE);
+	_entries.assign(keys.size(), PATHHASH_NONE);
+	for (size_t i=0; i<keys.size(); ++i) {
+		uint64_t s=slot(keys[i]);
+		if (s>=keys.size()) {
+			continue;
+		}
+		_files[s]=key_files[i];
+		if (found[i]) {
+			_entries[s]=found[i]-&pak->getEntries()[0];
+		}
+	}
+	return keys.size();
+}
+
+void PathHash::buildRanks() {
+	// one sample per (possibly partial) 512-bit block, then the total
+	_ranks.assign((_bits.size()+7)/8+1, 0);
+	uint32_t count=0;
+	for (size_t i=0; i<_bits.size(); ++i) {
+		if (i%8==0) {
+			_ranks[i/8]=count;
+		}
+		count+=__builtin_popcountll(_bits[i]);
+	}
+	_ranks.back()=count;
+}
+
+uint64_t PathHash::slot(const MD5Hash& hash) const {
+	for (size_t level=0; level+1<_levels.size(); ++level) {
+		uint64_t p=_levels[level]+__reduce(__level_hash(hash, level), _levels[level+1]-_levels[level]);
+		uint64_t word=_bits[p/64];
+		if (word&(1ull<<(p%64))) {
+			uint64_t rank=_ranks[p/512];
+			for (size_t i=(p/512)*8; i<p/64; ++i) {
+				rank+=__builtin_popcountll(_bits[i]);
+			}
+			return rank+__builtin_popcountll(word&((1ull<<(p%64))-1));
+		}
+	}
+	std::vector<MD5Hash>::const_iterator it=std::lower_bound(_fallback.begin(), _fallback.end(), hash, __md5_less);
+	if (it!=_fallback.end() && it->compare(hash)==0) {
+		return _ranks.back()+(it-_fallback.begin());
+	}
+	return ~(uint64_t)0;
+}
+
+bool PathHash::find(const char* path, size_t length, PathMatch& out) const {
+	if (!_table) {
+		return false;
+	}
+	MD5::compute(path, length, out.hash);
+	uint64_t s=slot(out.hash);
+	if (s>=_files.size() || _files[s]>=_table->getEntryInfo().getFileCount()) {
+		return false;
+	}
+	const EntryInfoSet& info=_table->getEntryInfo();
+	const FileInfo& file=info.getData()[_files[s]];
+	if (!__path_equals(info, file, path, length)) {
+		return false;
+	}
+	out.file=&file;
+	out.entry=NULL;
+	if (_pak && _entries[s]<_pak->getEntries().size() && _pak->getEntries()[_entries[s]].hash().compare(out.hash)==0) {
+		out.entry=&_pak->getEntries()[_entries[s]];
+	}
+	return true;
+}
+
+double PathHash::getBitsPerKey() const {
+	if (_files.empty()) {
+		return 0.0;
+	}
+	return (double)(_bits.size()*64+_ranks.size()*32+_fallback.size()*128)/(double)_files.size();
+}
+
+/*
+	File layout (big-endian):
+	"PKMH", u32 version, u32 key count, u32 level count, u32 fallback count,
+	u32 table file count, u32 table names size, u32 archive entry count,
+	u32 CRC32C of the archive's entry hashes in order (0 without an archive);
+	then the level bit offsets (u64, level count+1), the bit words (u64),
+	the fallback hashes (16 bytes each) and the file and entry index of each slot (u32).
+*/
+bool PathHash::save(const char* path) const {
+	if (!_table) {
+		return false;
+	}
+	std::vector<unsigned char> out(PATHHASH_HEAD_SIZE+_levels.size()*8+_bits.size()*8+_fallback.size()*16+_files.size()*8);
+	unsigned char* p=&out[0];
+	memcpy(p, "PKMH", 4);
+	storeBE<uint32_t>(p+4, 2);
+	storeBE<uint32_t>(p+8, _files.size());
+	storeBE<uint32_t>(p+12, _levels.size()-1);
+	storeBE<uint32_t>(p+16, _fallback.size());
+	storeBE<uint32_t>(p+20, _table->getEntryInfo().getFileCount());
+	storeBE<uint32_t>(p+24, _table->getEntryInfo().getNamesSize());
+	storeBE<uint32_t>(p+28, (_pak) ? _pak->getEntries().size() : 0);
+	storeBE<uint32_t>(p+32, __entries_fingerprint(_pak));
+	p+=PATHHASH_HEAD_SIZE;
+	for (size_t i=0; i<_levels.size(); ++i, p+=8) {
+		storeBE<uint64_t>(p, _levels[i]);
+	}
+	for (size_t i=0; i<_bits.size(); ++i, p+=8) {
+		storeBE<uint64_t>(p, _bits[i]);
+	}
+	for (size_t i=0; i<_fallback.size(); ++i, p+=16) {
+		memcpy(p, _fallback[i].data(), 16);
+	}
+	for (size_t i=0; i<_files.size(); ++i, p+=8) {
+		storeBE<uint32_t>(p, _files[i]);
+		storeBE<uint32_t>(p+4, _entries[i]);
+	}
+	FILE* f=fopen(path, "wb");
+	if (!f) {
+		printf("ERROR: Failed to open path index for writing: %s\n", path);
+		return false;
+	}
+	bool ok=fwrite(&out[0], 1, out.size(), f)==out.size();
+	return (fclose(f)==0) && ok;
+}
+
+bool PathHash::load(const char* path, const SDMD2& table, const SDPK2* pak) {
+	FILE* f=fopen(path, "rb");
+	if (!f) {
+		return false;
+	}
+	unsigned char head[PATHHASH_HEAD_SIZE];
+	bool ok=fread(head, 1, sizeof(head), f)==sizeof(head)
+		&& memcmp(head, "PKMH", 4)==0 && loadBE<uint32_t>(head+4)==2
+		&& loadBE<uint32_t>(head+20)==table.getEntryInfo().getFileCount()
+		&& loadBE<uint32_t>(head+24)==table.getEntryInfo().getNamesSize()
+		&& loadBE<uint32_t>(head+28)==((pak) ? pak->getEntries().size() : 0)
+		&& loadBE<uint32_t>(head+32)==__entries_fingerprint(pak)
+		&& loadBE<uint32_t>(head+8)<=table.getEntryInfo().getFileCount()
+		&& loadBE<uint32_t>(head+16)<=loadBE<uint32_t>(head+8)
+		&& loadBE<uint32_t>(head+12)<=PATHHASH_MAX_LEVELS;
+	std::vector<unsigned char> in;
+	if (ok) {
+		size_t keys=loadBE<uint32_t>(head+8);
+		size_t levels=loadBE<uint32_t>(head+12)+1;
+		size_t fallback=loadBE<uint32_t>(head+16);
+		in.resize(levels*8);
+		ok=fread(&in[0], 1, in.size(), f)==in.size();
+		_levels.resize(levels);
+		for (size_t i=0; ok && i<levels; ++i) {
+			_levels[i]=loadBE<uint64_t>(&in[i*8]);
+			ok=(_levels[i]%64==0) && (i==0 || _levels[i]>=_levels[i-1]) && _levels[i]<=(uint64_t)keys*64*PATHHASH_MAX_LEVELS;
+		}
+		size_t words=(ok) ? _levels.back()/64 : 0;
+		in.resize(words*8+fallback*16+keys*8);
+		ok=ok && _levels[0]==0 && (in.empty() || fread(&in[0], 1, in.size(), f)==in.size());
+		if (ok) {
+			const unsigned char* p=(in.empty()) ? NULL : &in[0];
+			_bits.resize(words);
+			for (size_t i=0; i<words; ++i, p+=8) {
+				_bits[i]=loadBE<uint64_t>(p);
+			}
+			_fallback.resize(fallback);
+			for (size_t i=0; i<fallback; ++i, p+=16) {
+				memcpy(_fallback[i].data(), p, 16);
+			}
+			_files.resize(keys);
+			_entries.resize(keys);
+			for (size_t i=0; i<keys; ++i, p+=8) {
+				_files[i]=loadBE<uint32_t>(p);
+				_entries[i]=loadBE<uint32_t>(p+4);
+			}
+			buildRanks();
+			ok=(_ranks.back()+fallback==keys);
+		}
+	}
+	fclose(f);
+	if (!ok) {
+		printf("WARNING: Ignoring stale or malformed path index: %s\n", path);
+		_table=NULL;
+		_pak=NULL;
+		_files.clear();
+		return false;
+	}
+	_table=&table;
+	_pak=pak;
+	return true;
+}
+
+} // namespace PK2Unpack
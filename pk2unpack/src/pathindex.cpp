@@ -0,0 +1,59 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <algorithm>
+#include "md5.hpp"
+#include "pathindex.hpp"
+
+namespace PK2Unpack {
+
+// class PathIndex implementation
+
+bool PathIndex::resolvePath(const EntryInfoSet& info, const FileInfo& file, std::string& out) {
+	const char* dir=info.getName(file.getDirIndex());
+	const char* name=info.getName(file.getIndex());
+	if (!dir || !name) {
+		return false;
+	}
+	out.assign(dir);
+	if (out.empty() || out[out.size()-1]!='/') {
+		out.push_back('/');
+	}
+	out.append(name);
+	return true;
+}
+
+static bool __path_entry_less(const PathEntry& x, const PathEntry& y) {
+	return x.hash.compare(y.hash)<0;
+}
+
+size_t PathIndex::build(const SDMD2& table) {
+	_table=&table;
+	_entries.clear();
+	const EntryInfoSet& info=table.getEntryInfo();
+	const FileInfoVec& files=info.getData();
+	_entries.reserve(files.size());
+	PathEntry entry;
+	for (size_t i=0; i<files.size(); ++i) {
+		if (!resolvePath(info, files[i], entry.path)) {
+			continue;
+		}
+		MD5::compute(entry.path.data(), entry.path.size(), entry.hash);
+		entry.file=i;
+		_entries.push_back(entry);
+	}
+	std::sort(_entries.begin(), _entries.end(), __path_entry_less);
+	return _entries.size();
+}
+
+const PathEntry* PathIndex::find(const MD5Hash& hash) const {
+	PathEntry key;
+	key.hash=hash;
+	PathEntryVec::const_iterator it=std::lower_bound(_entries.begin(), _entries.end(), key, __path_entry_less);
+	return (it!=_entries.end() && it->hash.compare(hash)==0) ? &*it : NULL;
+}
+
+} // namespace PK2Unpack
@@ -0,0 +1,392 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "stats.hpp"
+#include "prefetch.hpp"
+
+namespace PK2Unpack {
+
+// how many trace items past the expected one a read may match (threads reorder reads a little)
+#define PREFETCH_MATCH_WINDOW 64
+
+// class AccessTrace implementation
+
+AccessTrace::AccessTrace() {
+	pthread_mutex_init(&_lock, NULL);
+}
+
+AccessTrace::~AccessTrace() {
+	pthread_mutex_destroy(&_lock);
+}
+
+size_t AccessTrace::addArchive(const SDPK2& pak) {
+	_paks.push_back(&pak);
+	_paths.push_back(pak.getPath());
+	return _paks.size()-1;
+}
+
+void AccessTrace::record(const SDPK2& pak, const Entry& entry, unsigned int first_block, unsigned int block_count) {
+	AccessRecord record;
+	record.archive=0;
+	for (; record.archive<_paks.size() && _paks[record.archive]!=&pak; ++record.archive) {
+	}
+	if (record.archive==_paks.size()) {
+		return;
+	}
+	record.hash=entry.hash();
+	record.first_block=first_block;
+	record.block_count=block_count;
+	pthread_mutex_lock(&_lock);
+	_records.push_back(record);
+	pthread_mutex_unlock(&_lock);
+}
+
+bool AccessTrace::save(const char* path) const {
+	FILE* f=fopen(path, "w");
+	if (!f) {
+		printf("ERROR: Failed to open access trace for writing: %s\n", path);
+		return false;
+	}
+	for (size_t i=0; i<_paths.size(); ++i) {
+		fprintf(f, "archive %lu %s\n", (unsigned long)i, _paths[i].c_str());
+	}
+	char hash_str[33];
+	for (size_t i=0; i<_records.size(); ++i) {
+		const AccessRecord& record=_records[i];
+		record.hash.getExisting(hash_str, true);
+		fprintf(f, "%u %s %u %u\n", record.archive, hash_str, record.first_block, record.block_count);
+	}
+	return fclose(f)==0;
+}
+
+bool AccessTrace::load(const char* path) {
+	FILE* f=fopen(path, "r");
+	if (!f) {
+		printf("ERROR: Failed to open access trace: %s\n", path);
+		return false;
+	}
+	_paks.clear();
+	_paths.clear();
+	_records.clear();
+	char line[4096], hash_str[33];
+	unsigned long index;
+	int offset;
+	AccessRecord record;
+	bool ok=true;
+	for (unsigned long number=1; fgets(line, sizeof(line), f); ++number) {
+		if (sscanf(line, "archive %lu %n", &index, &offset)==1) {
+			line[strcspn(line, "\n")]='\0';
+			_paths.resize(index+1);
+			_paths[index].assign(line+offset);
+		} else if (sscanf(line, "%u %32s %u %u", &record.archive, hash_str, &record.first_block, &record.block_count)==4 && record.hash.set(hash_str)) {
+			_records.push_back(record);
+		} else if (line[0]!='\n' && line[0]!='#') {
+			printf("ERROR: Malformed access trace line %lu: %s\n", number, path);
+			ok=false;
+			break;
+		}
+	}
+	fclose(f);
+	return ok;
+}
+
+// class TracePrefetcher implementation
+
+// puts the blocks of an item in the cache by their archive offsets
+class PrefetchBlockHandler : public BlockHandler {
+public:
+	PrefetchBlockHandler(TracePrefetcher& prefetcher, const SDPK2& pak, const Entry& entry, uint64_t offset)
+		: _prefetcher(prefetcher), _pak(pak), _entry(entry), _offset(offset) {
+	};
+	bool block(unsigned int index, const char* data, size_t size) {
+		_prefetcher.put(_pak, _offset, data, size);
+		size_t c_blocksize=_pak.getBlockSizeTable()[_entry.getBlockSizeIndex()+index];
+		_offset+=(c_blocksize==0) ? _pak.getBlockSize() : c_blocksize;
+		return true;
+	};
+	
+protected:
+	TracePrefetcher& _prefetcher;
+	const SDPK2& _pak;
+	const Entry& _entry;
+	uint64_t _offset;
+};
+
+TracePrefetcher::TracePrefetcher(const AccessTrace& trace, size_t cache_size)
+	: _trace(trace), _paks(trace.getArchivePaths().size(), (const SDPK2*)NULL), _running(false), _stop(false),
+	_consumer(0), _consumer_bytes(0), _warmed(0), _consumer_time(0), _rate(0.0), _lookahead(PREFETCH_MIN_LOOKAHEAD), _max_lookahead(cache_size/2),
+	_cache_bytes(0), _cache_size(cache_size), _seq(0), _hits(0), _misses(0), _evictions(0) {
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_cond, NULL);
+}
+
+TracePrefetcher::~TracePrefetcher() {
+	stop();
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_lock);
+}
+
+void TracePrefetcher::setArchive(size_t index, const SDPK2& pak) {
+	if (index>=_paks.size()) {
+		_paks.resize(index+1, NULL);
+	}
+	_paks[index]=&pak;
+}
+
+bool TracePrefetcher::start() {
+	if (_running) {
+		return true;
+	}
+	// resolve the records against the open archives
+	const std::vector<AccessRecord>& records=_trace.getRecords();
+	// per archive, so each archive's entries are searched once
+	std::vector<const Entry*> found(records.size(), (const Entry*)NULL);
+	std::vector<MD5Hash> hashes;
+	std::vector<size_t> which;
+	std::vector<const Entry*> results;
+	for (size_t a=0; a<_paks.size(); ++a) {
+		if (!_paks[a]) {
+			continue;
+		}
+		hashes.clear();
+		which.clear();
+		for (size_t i=0; i<records.size(); ++i) {
+			if (records[i].archive==a) {
+				hashes.push_back(records[i].hash);
+				which.push_back(i);
+			}
+		}
+		if (hashes.empty()) {
+			continue;
+		}
+		results.resize(hashes.size());
+		_paks[a]->findEntries(&hashes[0], hashes.size(), &results[0]);
+		for (size_t i=0; i<which.size(); ++i) {
+			found[which[i]]=results[i];
+		}
+	}
+	uint64_t end=0;
+	_items.clear();
+	for (size_t i=0; i<records.size(); ++i) {
+		const AccessRecord& record=records[i];
+		const SDPK2* pak=(record.archive<_paks.size()) ? _paks[record.archive] : NULL;
+		const Entry* entry=found[i];
+		if (!entry || pak->getBlockSize()==0) {
+			continue;
+		}
+		uint64_t first=(uint64_t)record.first_block*pak->getBlockSize();
+		if (first>=entry->getSize()) {
+			continue;
+		}
+		uint64_t size=entry->getSize()-first;
+		if ((uint64_t)record.block_count*pak->getBlockSize()<size) {
+			size=(uint64_t)record.block_count*pak->getBlockSize();
+		}
+		Item item={record.archive, pak, entry, record.first_block, record.block_count, end+size};
+		_items.push_back(item);
+		end+=size;
+	}
+	_stop=false;
+	_running=(pthread_create(&_thread, NULL, run, this)==0);
+	return _running;
+}
+
+void TracePrefetcher::stop() {
+	if (!_running) {
+		return;
+	}
+	pthread_mutex_lock(&_lock);
+	_stop=true;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_lock);
+	pthread_join(_thread, NULL);
+	_running=false;
+	_cache.clear();
+	_order.clear();
+	_cache_bytes=0;
+}
+
+void TracePrefetcher::consumed(const SDPK2& pak, const Entry& entry, unsigned int first_block) {
+	pthread_mutex_lock(&_lock);
+	size_t end=(_consumer+PREFETCH_MATCH_WINDOW<_items.size()) ? _consumer+PREFETCH_MATCH_WINDOW : _items.size();
+	for (size_t i=_consumer; i<end; ++i) {
+		const Item& item=_items[i];
+		if (item.pak!=&pak || item.entry!=&entry || item.first_block!=first_block) {
+			continue;
+		}
+		uint64_t now=Stats::now();
+		if (_consumer_time!=0 && now>_consumer_time) {
+			double rate=(double)(item.end-_consumer_bytes)*1e9/(double)(now-_consumer_time);
+			_rate=(_rate==0.0) ? rate : _rate*0.875+rate*0.125;
+		}
+		if (i>=_warmed && _max_lookahead<_cache_size) {
+			// overtook the prefetcher
+			_max_lookahead*=2;
+		}
+		_consumer=i+1;
+		_consumer_bytes=item.end;
+		_consumer_time=now;
+		_lookahead=(uint64_t)(_rate*(double)PREFETCH_HORIZON_NS/1e9);
+		if (_lookahead>_max_lookahead) {
+			_lookahead=_max_lookahead;
+		}
+		if (_lookahead<PREFETCH_MIN_LOOKAHEAD) {
+			_lookahead=PREFETCH_MIN_LOOKAHEAD;
+		}
+		pthread_cond_broadcast(&_cond);
+		break;
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+bool TracePrefetcher::take(const SDPK2& pak, uint64_t offset, char* out, size_t size) {
+	CacheKey key={&pak, offset};
+	PooledBuffer data;
+	pthread_mutex_lock(&_lock);
+	std::unordered_map<CacheKey, CacheBlock, CacheKeyHash>::iterator it=_cache.find(key);
+	if (it==_cache.end() || it->second.data.size()!=size) {
+		++_misses;
+		pthread_mutex_unlock(&_lock);
+		return false;
+	}
+	data=std::move(it->second.data);
+	_cache_bytes-=size;
+	_cache.erase(it);
+	++_hits;
+	pthread_mutex_unlock(&_lock);
+	memcpy(out, data.data(), size);
+	return true;
+}
+
+void TracePrefetcher::put(const SDPK2& pak, uint64_t offset, const char* data, size_t size) {
+	CacheBlock block;
+	if (size>_cache_size || !block.data.allocate(size)) {
+		return;
+	}
+	memcpy(block.data.data(), data, size);
+	CacheKey key={&pak, offset};
+	pthread_mutex_lock(&_lock);
+	if (_cache.find(key)==_cache.end()) {
+		bool evicted=false;
+		while (_cache_bytes+size>_cache_size && !_order.empty()) {
+			std::unordered_map<CacheKey, CacheBlock, CacheKeyHash>::iterator it=_cache.find(_order.front().first);
+			if (it!=_cache.end() && it->second.seq==_order.front().second) {
+				_cache_bytes-=it->second.data.size();
+				_cache.erase(it);
+				++_evictions;
+				evicted=true;
+			}
+			_order.pop_front();
+		}
+		if (evicted) {
+			// warmed too far ahead (or off the consumer's path)
+			_max_lookahead=(_max_lookahead/2>PREFETCH_MIN_LOOKAHEAD) ? _max_lookahead/2 : PREFETCH_MIN_LOOKAHEAD;
+			if (_lookahead>_max_lookahead) {
+				_lookahead=_max_lookahead;
+			}
+		}
+		block.seq=_seq++;
+		_order.push_back(std::make_pair(key, block.seq));
+		_cache_bytes+=size;
+		_cache.insert(std::make_pair(key, std::move(block)));
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+static thread_local bool __prefetch_thread=false;
+
+void* TracePrefetcher::run(void* arg) {
+	TracePrefetcher* p=(TracePrefetcher*)arg;
+	__prefetch_thread=true;
+	std::vector<Stream*> streams(p->_paks.size(), (Stream*)NULL);
+	std::vector<int> fds(p->_paks.size(), -1);
+	BlockDecoder decoder;
+	size_t advised=0;
+	pthread_mutex_lock(&p->_lock);
+	while (!p->_stop) {
+		if (p->_warmed<p->_consumer) {
+			// overtaken; there is no point warming what was already read
+			p->_warmed=p->_consumer;
+		}
+		if (p->_warmed>=p->_items.size()) {
+			break;
+		}
+		size_t i=p->_warmed;
+		uint64_t item_start=(i>0) ? p->_items[i-1].end : 0;
+		if (item_start>p->_consumer_bytes+p->_lookahead) {
+			pthread_cond_wait(&p->_cond, &p->_lock);
+			continue;
+		}
+		uint64_t advise_limit=p->_consumer_bytes+p->_lookahead*2;
+		pthread_mutex_unlock(&p->_lock);
+		// hint the kernel about the runs after this one
+		if (advised<i) {
+			advised=i;
+		}
+		for (; advised<p->_items.size() && ((advised>0) ? p->_items[advised-1].end : 0)<=advise_limit; ++advised) {
+			const Item& item=p->_items[advised];
+			uint64_t offset, size;
+			if (fds[item.archive]<0) {
+				fds[item.archive]=open(item.pak->getPath(), O_RDONLY);
+			}
+			if (fds[item.archive]>=0 && item.entry->getCompressedRange(*item.pak, item.first_block, item.block_count, offset, size)==READERR_NONE) {
+				posix_fadvise(fds[item.archive], offset, size, POSIX_FADV_WILLNEED);
+			}
+		}
+		const Item& item=p->_items[i];
+		uint64_t offset, size;
+		if (!streams[item.archive]) {
+			streams[item.archive]=item.pak->openDataStream();
+		}
+		if (streams[item.archive] && item.entry->getCompressedRange(*item.pak, item.first_block, item.block_count, offset, size)==READERR_NONE) {
+			StreamBlockSource source(streams[item.archive]);
+			PrefetchBlockHandler handler(*p, *item.pak, *item.entry, offset);
+			item.entry->readBlocks(source, *item.pak, handler, decoder, item.first_block, item.block_count);
+		}
+		pthread_mutex_lock(&p->_lock);
+		if (p->_warmed==i) {
+			++p->_warmed;
+		}
+	}
+	pthread_mutex_unlock(&p->_lock);
+	for (size_t i=0; i<streams.size(); ++i) {
+		SDPK2::closeDataStream(streams[i]);
+		if (fds[i]>=0) {
+			close(fds[i]);
+		}
+	}
+	return NULL;
+}
+
+// Prefetch
+
+namespace Prefetch {
+
+AccessTrace* recording=NULL;
+TracePrefetcher* replaying=NULL;
+
+TracePrefetcher* consumer() {
+	return (__prefetch_thread) ? NULL : replaying;
+}
+
+void onRead(const SDPK2& pak, const Entry& entry, unsigned int first_block, unsigned int block_count) {
+	if (__prefetch_thread) {
+		return;
+	}
+	if (recording) {
+		recording->record(pak, entry, first_block, block_count);
+	}
+	if (replaying) {
+		replaying->consumed(pak, entry, first_block);
+	}
+}
+
+} // namespace Prefetch
+
+} // namespace PK2Unpack
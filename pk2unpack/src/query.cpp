@@ -0,0 +1,112 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include "query.hpp"
+#include "list.hpp"
+#include "hex.hpp"
+
+namespace PK2Unpack {
+
+static bool __read_all(FILE* f, std::string& data) {
+	char buf[0x10000];
+	size_t n;
+	while ((n=fread(buf, 1, sizeof(buf), f))>0) {
+		data.append(buf, n);
+	}
+	return !ferror(f);
+}
+
+static bool __is_space(char c) {
+	return c==' ' || c=='\t' || c=='\r' || c=='\n';
+}
+
+long queryArchive(const SDPK2& pak, const char* path, int format, FILE* out) {
+	std::string data;
+	bool use_stdin=strcmp(path, "-")==0;
+	FILE* f=(use_stdin) ? stdin : fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "ERROR: Failed to open query file: %s\n", path);
+		return -1;
+	}
+	bool ok=__read_all(f, data);
+	if (!use_stdin) {
+		fclose(f);
+	}
+	if (!ok) {
+		fprintf(stderr, "ERROR: Failed to read query file: %s\n", path);
+		return -1;
+	}
+	long misses=0;
+	// gather the well-formed tokens back to back so they decode in one call
+	std::string hex;
+	std::vector<size_t> starts;
+	size_t pos=0;
+	while (pos<data.size()) {
+		size_t end=data.find('\n', pos);
+		if (end==std::string::npos) {
+			end=data.size();
+		}
+		size_t b=pos, e=end;
+		while (b<e && __is_space(data[b])) {
+			++b;
+		}
+		while (e>b && __is_space(data[e-1])) {
+			--e;
+		}
+		if (b<e && data[b]!='#') {
+			if (e-b==32) {
+				hex.append(data, b, 32);
+				starts.push_back(b);
+			} else {
+				fprintf(stderr, "Malformed hash: %.*s\n", (int)(e-b), data.c_str()+b);
+				++misses;
+			}
+		}
+		pos=end+1;
+	}
+	std::vector<MD5Hash> hashes(starts.size());
+	std::vector<bool> valid(starts.size(), true);
+	std::vector<unsigned char> raw(starts.size()*16);
+	if (!raw.empty() && !hexDecode(hex.data(), raw.size(), &raw[0])) {
+		// find the bad ones
+		for (size_t i=0; i<starts.size(); ++i) {
+			if (!hexDecode(hex.data()+i*32, 16, &raw[i*16])) {
+				fprintf(stderr, "Malformed hash: %.32s\n", hex.data()+i*32);
+				valid[i]=false;
+				++misses;
+			}
+		}
+	}
+	size_t count=0;
+	for (size_t i=0; i<starts.size(); ++i) {
+		if (valid[i]) {
+			memcpy(hashes[count].data(), &raw[i*16], 16);
+			starts[count]=starts[i];
+			++count;
+		}
+	}
+	hashes.resize(count);
+	std::vector<const Entry*> found(count);
+	if (count>0) {
+		pak.findEntries(&hashes[0], count, &found[0]);
+	}
+	size_t n=0;
+	for (size_t i=0; i<count; ++i) {
+		if (found[i]) {
+			found[n++]=found[i];
+		} else {
+			fprintf(stderr, "Entry [%.32s] not found\n", data.c_str()+starts[i]);
+			++misses;
+		}
+	}
+	listEntries(pak, (n>0) ? &found[0] : NULL, n, format, out);
+	return misses;
+}
+
+} // namespace PK2Unpack
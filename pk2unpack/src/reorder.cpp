@@ -0,0 +1,255 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include "reorder.hpp"
+
+namespace PK2Unpack {
+
+#define REORDER_COPY_SIZE 0x100000
+
+int getReorderMode(const char* name) {
+	if (strcmp(name, "trace")==0) {
+		return REORDER_TRACE;
+	} else if (strcmp(name, "dir")==0) {
+		return REORDER_PATH;
+	} else if (strcmp(name, "size")==0) {
+		return REORDER_SIZE;
+	}
+	return REORDER_UNKNOWN;
+}
+
+// sorts entry indices by a rank, then by data offset
+struct __ReorderLess {
+	const EntryVec& entries;
+	const std::vector<uint64_t>& rank;
+	bool operator()(size_t x, size_t y) const {
+		if (rank[x]!=rank[y]) {
+			return rank[x]<rank[y];
+		}
+		return entries[x].getOffset()<entries[y].getOffset();
+	};
+};
+
+static void __order_by_rank(const SDPK2& pak, const std::vector<uint64_t>& rank, std::vector<size_t>& order) {
+	order.resize(pak.getEntries().size());
+	for (size_t i=0; i<order.size(); ++i) {
+		order[i]=i;
+	}
+	__ReorderLess less={pak.getEntries(), rank};
+	std::stable_sort(order.begin(), order.end(), less);
+}
+
+void orderByTrace(const SDPK2& pak, const AccessTrace& trace, size_t archive, std::vector<size_t>& order) {
+	const EntryVec& entries=pak.getEntries();
+	std::vector<uint64_t> rank(entries.size(), ~(uint64_t)0);
+	const std::vector<AccessRecord>& records=trace.getRecords();
+	std::vector<MD5Hash> hashes;
+	for (size_t i=0; i<records.size(); ++i) {
+		if (records[i].archive==archive) {
+			hashes.push_back(records[i].hash);
+		}
+	}
+	std::vector<const Entry*> found(hashes.size(), (const Entry*)NULL);
+	if (!hashes.empty()) {
+		pak.findEntries(&hashes[0], hashes.size(), &found[0]);
+	}
+	// first access ranks first
+	for (size_t i=0; i<found.size(); ++i) {
+		if (found[i] && rank[found[i]-&entries[0]]==~(uint64_t)0) {
+			rank[found[i]-&entries[0]]=i;
+		}
+	}
+	__order_by_rank(pak, rank, order);
+}
+
+struct __PathLess {
+	const PathEntryVec& paths;
+	bool operator()(size_t x, size_t y) const {
+		return paths[x].path<paths[y].path;
+	};
+};
+
+void orderByPath(const SDPK2& pak, const PathIndex& paths, std::vector<size_t>& order) {
+	const EntryVec& entries=pak.getEntries();
+	// paths are sorted by hash; rank them by path
+	const PathEntryVec& sorted=paths.getEntries();
+	std::vector<size_t> by_path(sorted.size());
+	for (size_t i=0; i<by_path.size(); ++i) {
+		by_path[i]=i;
+	}
+	__PathLess less={sorted};
+	std::sort(by_path.begin(), by_path.end(), less);
+	std::vector<uint64_t> path_rank(sorted.size());
+	for (size_t i=0; i<by_path.size(); ++i) {
+		path_rank[by_path[i]]=i;
+	}
+	std::vector<uint64_t> rank(entries.size(), ~(uint64_t)0);
+	for (size_t i=0; i<entries.size(); ++i) {
+		const PathEntry* path=paths.find(entries[i].hash());
+		if (path) {
+			rank[i]=path_rank[path-&sorted[0]];
+		}
+	}
+	__order_by_rank(pak, rank, order);
+}
+
+void orderBySize(const SDPK2& pak, std::vector<size_t>& order) {
+	const EntryVec& entries=pak.getEntries();
+	std::vector<uint64_t> rank(entries.size());
+	for (size_t i=0; i<entries.size(); ++i) {
+		rank[i]=entries[i].getSize();
+	}
+	__order_by_rank(pak, rank, order);
+}
+
+// copy size bytes at in_offset to the end of out; in-kernel where the filesystems allow it
+static bool __copy_range(int in, uint64_t in_offset, int out, uint64_t size, std::vector<char>& buffer) {
+	loff_t off=in_offset;
+	while (size>0) {
+		ssize_t n=copy_file_range(in, &off, out, NULL, size, 0);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<=0) {
+			break;
+		}
+		size-=n;
+	}
+	// not supported (or a short copy); plain reads and writes for the rest
+	buffer.resize(REORDER_COPY_SIZE);
+	while (size>0) {
+		size_t chunk=(size<REORDER_COPY_SIZE) ? size : REORDER_COPY_SIZE;
+		ssize_t n=pread(in, &buffer[0], chunk, off);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<=0) {
+			return false;
+		}
+		for (ssize_t done=0; done<n; ) {
+			ssize_t w=write(out, &buffer[done], n-done);
+			if (w<0 && errno==EINTR) {
+				continue;
+			} else if (w<=0) {
+				return false;
+			}
+			done+=w;
+		}
+		off+=n;
+		size-=n;
+	}
+	return true;
+}
+
+bool reorderArchive(const SDPK2& pak, const std::vector<size_t>& order, const char* out_path) {
+	const EntryVec& entries=pak.getEntries();
+	const BlockSizeTable& table=pak.getBlockSizeTable();
+	size_t block_size=pak.getBlockSize();
+	if (order.size()!=entries.size() || block_size==0) {
+		printf("ERROR: Bad entry order for %s\n", pak.getPath());
+		return false;
+	}
+	// the new records and table; data follows the header in record order
+	SDPK2 out(out_path);
+	out.setBlockSize(block_size);
+	out.setCompressionMethod(pak.getCompressionMethod());
+	EntryVec& new_entries=out.getEntries();
+	BlockSizeTable& new_table=out.getBlockSizeTable();
+	new_entries.reserve(entries.size());
+	std::vector<uint64_t> c_sizes(entries.size());
+	for (size_t i=0; i<order.size(); ++i) {
+		const Entry& entry=entries[order[i]];
+		size_t count=(entry.getSize()+block_size-1)/block_size;
+		if (entry.getBlockSizeIndex()+count>table.size()) {
+			printf("ERROR: Entry %lu's blocks run past comp_block_sizes\n", (unsigned long)order[i]);
+			return false;
+		}
+		new_entries.push_back(entry);
+		uint64_t c_size=0;
+		for (size_t k=0; k<count; ++k) {
+			size_t v=table[entry.getBlockSizeIndex()+k];
+			c_size+=(v==0) ? block_size : v;
+		}
+		c_sizes[i]=c_size;
+	}
+	// (old offset, old blocksize index) -> record holding the copy; shared data stays shared
+	std::map<std::pair<uint64_t, uint32_t>, size_t> copies;
+	// whether a record's data is copied (rather than shared)
+	std::vector<char> placed(new_entries.size(), false);
+	uint64_t pos=0;
+	for (size_t i=0; i<new_entries.size(); ++i) {
+		const Entry& entry=entries[order[i]];
+		std::pair<uint64_t, uint32_t> key(entry.getOffset(), entry.getBlockSizeIndex());
+		std::map<std::pair<uint64_t, uint32_t>, size_t>::iterator it=copies.find(key);
+		if (it!=copies.end() && c_sizes[it->second]>=c_sizes[i]) {
+			new_entries[i].setOffset(new_entries[it->second].getOffset());
+			new_entries[i].setBlockSizeIndex(new_entries[it->second].getBlockSizeIndex());
+			continue;
+		}
+		size_t count=(entry.getSize()+block_size-1)/block_size;
+		new_entries[i].setOffset(pos);
+		new_entries[i].setBlockSizeIndex(new_table.size());
+		new_table.insert(new_table.end(), table.begin()+entry.getBlockSizeIndex(), table.begin()+entry.getBlockSizeIndex()+count);
+		pos+=c_sizes[i];
+		copies[key]=i;
+		placed[i]=true;
+	}
+	// offsets so far are relative to the end of the header
+	size_t header_size=out.getHeaderSize();
+	for (size_t i=0; i<new_entries.size(); ++i) {
+		new_entries[i].setOffset(new_entries[i].getOffset()+header_size);
+	}
+	std::vector<unsigned char> header;
+	out.serializeInfo(header, header_size);
+	std::string tmp_path(out_path);
+	tmp_path.append(".tmp");
+	int in=::open(pak.getPath(), O_RDONLY);
+	int fd=::open(tmp_path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	bool ok=(in>=0 && fd>=0);
+	if (!ok) {
+		printf("ERROR: Failed to open %s\n", (in<0) ? pak.getPath() : tmp_path.c_str());
+	}
+	for (size_t done=0; ok && done<header.size(); ) {
+		ssize_t n=::write(fd, &header[done], header.size()-done);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<=0) {
+			ok=false;
+		} else {
+			done+=n;
+		}
+	}
+	std::vector<char> buffer;
+	for (size_t i=0; ok && i<new_entries.size(); ++i) {
+		if (!placed[i] || c_sizes[i]==0) {
+			continue;
+		}
+		ok=__copy_range(in, entries[order[i]].getOffset(), fd, c_sizes[i], buffer);
+	}
+	if (ok && fsync(fd)!=0) {
+		ok=false;
+	}
+	if (fd>=0 && ::close(fd)!=0) {
+		ok=false;
+	}
+	if (in>=0) {
+		::close(in);
+	}
+	if (ok && rename(tmp_path.c_str(), out_path)!=0) {
+		ok=false;
+	}
+	if (!ok) {
+		printf("ERROR: Failed to write %s\n", out_path);
+		unlink(tmp_path.c_str());
+	}
+	return ok;
+}
+
+} // namespace PK2Unpack
@@ -14,21 +14,29 @@
 #include <duct/endianstream.hpp>
 #include "misc.hpp"
 #include "sdmd2.hpp"
+#include "staticformat.hpp"
+#include "gen/sdmd2_format.hpp"
 
 namespace PK2Unpack {
 
 // class IDSet implementation
 
-void IDSet::deserialize(Stream* stream) {
+bool IDSet::deserialize(BEReader& reader) {
 	release();
-	_count=stream->readUInt32();
-	_unk=stream->readUInt8();
+	const unsigned char* head_buf=reader.readBytes(SDMD2Format::IDSetHead_SIZE);
+	if (!head_buf) {
+		return false;
+	}
+	SDMD2Format::IDSetHead head;
+	SDMD2Format::decode(head, head_buf);
+	if (!reader.require(sizeof(int32_t)*(size_t)head.count)) {
+		return false;
+	}
+	_count=head.count;
+	_unk=head._unk;
 	_data=(int32_t*)malloc(sizeof(int32_t)*_count);
 	debug_assertp(_data, this, "failed to allocate buffer");
-	unsigned int i;
-	for (i=0; i<_count; ++i) {
-		_data[i]=stream->readInt32();
-	}
+	return reader.readArray(_data, _count);
 }
 
 void IDSet::serialize(Stream* stream) const {
@@ -68,68 +76,119 @@ void IDSet::printInfo(const char* name, unsigned int tabcount, bool newline) con
 
 // class FileInfo implementation
 
-void FileInfo::deserialize(Stream* stream) {
-	_dir_index=stream->readUInt32();
-	_index=stream->readUInt32();
-	_dc.deserialize(stream, 8);
-	_time_modified=(time_t)stream->readUInt32();
+bool FileInfo::deserialize(BEReader& reader) {
+	const unsigned char* data=reader.readBytes(SDMD2Format::FileInfo_SIZE);
+	if (!data) {
+		return false;
+	}
+	SDMD2Format::FileInfo fi;
+	SDMD2Format::decode(fi, data);
+	_dir_index=fi.dir_index;
+	_index=fi.index;
+	// _i1 and _i2 are kept raw (big-endian) for printing
+	void* dc=malloc(8);
+	debug_assertp(dc, this, "failed to allocate buffer");
+	memcpy(dc, data+SDMD2Format::FileInfo_OFFSET__i1, 8);
+	_dc.setData(dc, 8);
+	_time_modified=(time_t)fi.time_modified;
+	return true;
 }
 
 void FileInfo::serialize(Stream* stream) const {
 	stream->writeUInt32(_dir_index);
 	stream->writeUInt32(_index);
 	_dc.serialize(stream);
+	stream->writeUInt32((uint32_t)_time_modified);
 }
 
-DataFormat __fmt_temp[]={
-	{FORMATTYPE_UINT,	0, DUCT_BIG_ENDIAN},
-	{FORMATTYPE_SKIP,	4, NULL},
-	//{FORMATTYPE_UINT,	0, DUCT_BIG_ENDIAN},
-	{FORMATTYPE_SET,	0, NULL},
-	{FORMATTYPE_HEX,	0, NULL},
-	{NULL, NULL, NULL}
-};
+// _dc is the raw _i1 and _i2; print _i1 as a uint, then all 8 bytes as hex
+typedef StaticDataFormat<
+	DataField<FORMATTYPE_UINT, 0, DUCT_BIG_ENDIAN>,
+	DataField<FORMATTYPE_SKIP, 4>,
+	DataField<FORMATTYPE_SET, 0>,
+	DataField<FORMATTYPE_HEX, 0>
+> __FileInfoDCFormat;
 
+// records mostly share a handful of timestamps, so keep the last one formatted
+time_t __time_last=(time_t)-1;
 char __time_buf[80];
+size_t __time_len=0;
+
+void FileInfo::printInfo(FormatWriter& out, unsigned int tabcount, bool newline) const {
+	if (_time_modified!=__time_last) {
+		struct tm* ts=localtime(&_time_modified);
+		__time_len=strftime(__time_buf, sizeof(__time_buf), "%a %Y-%m-%d %H:%M:%S %Z", ts);
+		__time_last=_time_modified;
+	}
+	out.fill('\t', tabcount);
+	out.append("[index:", 7);
+	out.appendUInt(_index, 4);
+	out.append(", dir_index:", 12);
+	out.appendUInt(_dir_index, 4);
+	out.append(", time_modified:", 16);
+	out.append(__time_buf, __time_len);
+	out.append(", _dc(", 6);
+	out.appendUInt(_dc.getSize());
+	out.append("):{", 3);
+	int result=__FileInfoDCFormat::print(_dc, out);
+	out.append("}#", 2);
+	out.appendInt(result);
+	out.append(']');
+	if (newline) {
+		out.append('\n');
+	}
+}
 
 void FileInfo::printInfo(unsigned int tabcount, bool newline) const {
-	/*printf("%.*s[index:%4u, dir_index:%4u, _i1:%12u, _i2:%12d, _i3:%12d]%.*s", tabcount, CONST_TAB_STR,
-	_index, _dir_index, _i1, _i2, _i3, (newline) ? 1 : 0, "\n");*/
-	struct tm* ts=localtime(&_time_modified);
-	strftime(__time_buf, sizeof(__time_buf), "%a %Y-%m-%d %H:%M:%S %Z", ts);
-	printf("%.*s[index:%4u, dir_index:%4u, time_modified:%s, _dc(%lu):{", tabcount, CONST_TAB_STR, _index, _dir_index, __time_buf, _dc.getSize());
-	printf("}#%d", _dc.print(__fmt_temp));
-	printf("]%.*s", (newline) ? 1 : 0, "\n");
+	FormatWriter out(stdout);
+	printInfo(out, tabcount, newline);
 }
 
 // class EntryInfoSet implementation
 
-void EntryInfoSet::deserialize(Stream* stream) {
+bool EntryInfoSet::deserialize(BEReader& reader) {
 	release();
-	_i1=stream->readInt32();
-	_i2=stream->readInt32();
-	_name_count=stream->readUInt32();
-	_offsets=(uint32_t*)malloc(sizeof(uint32_t)*_name_count);
-	size_t i;
-	for (i=0; i<_name_count; ++i) {
-		_offsets[i]=stream->readUInt32();
+	const unsigned char* head_buf=reader.readBytes(SDMD2Format::EntryInfoSetHead_SIZE);
+	if (!head_buf) {
+		return false;
 	}
-	_names_size=stream->readUInt32();
-	_names=(char**)malloc(sizeof(char*)*_name_count);
+	SDMD2Format::EntryInfoSetHead head;
+	SDMD2Format::decode(head, head_buf);
+	// check the offsets and names_size fit before allocating
+	if (!reader.require(sizeof(uint32_t)*((size_t)head.name_count+1))) {
+		return false;
+	}
+	_i1=head._i1;
+	_i2=head._i2;
+	_name_count=head.name_count;
+	_offsets=(uint32_t*)malloc(sizeof(uint32_t)*_name_count);
+	debug_assertp(_offsets, this, "failed to allocate buffer");
+	reader.readArray(_offsets, _name_count);
+	_names_size=reader.readUnchecked<uint32_t>();
+	_names=(char**)calloc(_name_count, sizeof(char*));
 	debug_assertp(_names, this, "failed to allocate buffer");
-	size_t size;
+	size_t i, size;
 	for (i=0; i<_name_count; ++i) {
 		size=(i+1==_name_count) ? _names_size-_offsets[i] : _offsets[i+1]-_offsets[i];
-		size*=sizeof(char);
-		_names[i]=(char*)malloc(size);
+		const unsigned char* name=reader.readBytes(size);
+		if (!name) {
+			return false;
+		}
+		// names are NUL-terminated in the file, but don't trust it
+		_names[i]=(char*)malloc(size+1);
 		debug_assertp(_names[i], this, "failed to allocate buffer");
-		stream->read((void*)_names[i], size);
+		memcpy(_names[i], name, size);
+		_names[i][size]='\0';
+	}
+	size=reader.read<uint32_t>();
+	if (!reader.require(size*SDMD2Format::FileInfo_SIZE)) {
+		return false;
 	}
-	size=stream->readUInt32();
 	_files.resize(size);
 	for (i=0; i<size; ++i) {
-		_files[i].deserialize(stream);
+		_files[i].deserialize(reader);
 	}
+	return reader.good();
 }
 
 void EntryInfoSet::serialize(Stream* stream) const {
@@ -173,28 +232,46 @@ void EntryInfoSet::printInfo(const char* name, unsigned int tabcount, bool newli
 		}
 	}
 	printf("%.*s},\n%.*sfiles(%lu):{\n", tabcount, CONST_TAB_STR, tabcount, CONST_TAB_STR, _files.size());
+	FormatWriter out(stdout);
 	for (i=0; i<_files.size(); ++i) {
-		_files[i].printInfo(tabcount+1, true);
+		_files[i].printInfo(out, tabcount+1, true);
 	}
+	out.flush();
 	printf("%.*s}]%.*s", tabcount, CONST_TAB_STR, (newline) ? 1 : 0, "\n");
 }
 
 // class SDMD2 implementation
 
-void SDMD2::deserialize(Stream* stream) {
-	_ids1.deserialize(stream);
-	_ids2.deserialize(stream);
-	_entryinfo.deserialize(stream);
+bool SDMD2::deserialize(BEReader& reader) {
+	return _ids1.deserialize(reader)
+		&& _ids2.deserialize(reader)
+		&& _entryinfo.deserialize(reader);
+}
+
+bool SDMD2::deserialize(Stream* stream) {
+	// parse from memory; the table is small and every field is big-endian
+	size_t size=stream->size()-stream->pos();
+	unsigned char* buf=(unsigned char*)malloc((size>0) ? size : 1);
+	debug_assertp(buf, this, "failed to allocate buffer");
+	bool ok=stream->read(buf, size)==size;
+	if (ok) {
+		BEReader reader(buf, size);
+		ok=deserialize(reader);
+	}
+	free(buf);
+	return ok;
 }
 
 bool SDMD2::load() {
 	Stream* s=FileStream::readFile(_path);
 	if (s) {
-		EndianStream es(s, false, DUCT_BIG_ENDIAN);
-		deserialize(&es);
-		es.close();
+		bool ok=deserialize(s);
 		s->close();
 		delete s;
+		if (!ok) {
+			printf("ERROR: Truncated or malformed SDMD2 file: %s\n", _path);
+			return false;
+		}
 	} else {
 		printf("ERROR: Failed to open SDMD2 file: %s\n", _path);
 		return false;
@@ -6,12 +6,23 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <algorithm>
 #include <zlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <duct/debug.hpp>
 #include <duct/filestream.hpp>
 #include <duct/endianstream.hpp>
 #include "misc.hpp"
 #include "sdpk2.hpp"
+#include "gen/sdpk2_format.hpp"
+#include "bereader.hpp"
+#include "hex.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "prefetch.hpp"
+#include "throttle.hpp"
 
 namespace PK2Unpack {
 
@@ -19,16 +30,9 @@ namespace PK2Unpack {
 
 bool MD5Hash::set(const char* str) {
 	if (strnlen(str, 32)==32) {
-		unsigned short d[4];
-		for (int i=0; i<16; i+=4) {
-			if (sscanf(str+(i*2), "%2hx%2hx%2hx%2hx", d, d+1, d+2, d+3)!=4) {
-				clear();
-				return false;
-			}
-			_data[i]=(unsigned char)d[0];
-			_data[i+1]=(unsigned char)d[1];
-			_data[i+2]=(unsigned char)d[2];
-			_data[i+3]=(unsigned char)d[3];
+		if (!hexDecode(str, 16, _data)) {
+			clear();
+			return false;
 		}
 		return true;
 	}
@@ -42,9 +46,7 @@ bool MD5Hash::isNull() const {
 }
 
 void MD5Hash::getExisting(char* str, bool nullterm) const {
-	for (int i=0; i<16; i+=4) {
-		sprintf(str+(i*2), "%02x%02x%02x%02x", _data[i], _data[i+1], _data[i+2], _data[i+3]);
-	}
+	hexEncode(_data, 16, str);
 	if (nullterm) {
 		str[32]=0;
 	}
@@ -53,6 +55,7 @@ void MD5Hash::getExisting(char* str, bool nullterm) const {
 char* MD5Hash::get(char** out, bool nullterm) const {
 	char* str=(char*)malloc((nullterm) ? 33 : 32);
 	debug_assertp(str, this, "failed to allocate 33- or 32-byte buffer");
+	getExisting(str, nullterm);
 	if (out!=NULL) {
 		*out=str;
 	}
@@ -65,78 +68,403 @@ void MD5Hash::printInfo(unsigned int tabcount, bool newline) const {
 	printf("%.*s[%.*s]%.*s", tabcount, CONST_TAB_STR, 32, str, (newline) ? 1 : 0, "\n");
 }
 
+// class BlockDecoder implementation
+
+const char* __read_errors[]={
+	"none",
+	"compmethod",
+	"blockindex",
+	"blocksize",
+	"read",
+	"inflate",
+	"length",
+	"write",
+	"position",
+	"notfound"
+};
+
+const char* getReadErrorName(int err) {
+	if (err<READERR_NONE || err>READERR_NOTFOUND) {
+		return "unknown";
+	}
+	return __read_errors[err];
+}
+
+BlockDecoder::BlockDecoder() : _in(NULL), _out(NULL), _in_size(0), _out_size(0) {
+	_strm.zalloc=Z_NULL;
+	_strm.zfree=Z_NULL;
+	_strm.opaque=Z_NULL;
+	_strm.next_in=(Bytef*)Z_NULL;
+	_strm.avail_in=0;
+	int status=inflateInit2(&_strm, 15);
+	debug_assertp(status==Z_OK, this, "failed to init zip stream");
+	(void)status;
+}
+
+BlockDecoder::~BlockDecoder() {
+	inflateEnd(&_strm);
+	free(_in);
+	free(_out);
+}
+
+char* BlockDecoder::getInBuffer(size_t size) {
+	if (_in_size<size) {
+		free(_in);
+		_in=(char*)malloc(size);
+		debug_assertp(_in, this, "failed to allocate buffer");
+		_in_size=size;
+	}
+	return _in;
+}
+
+char* BlockDecoder::getOutBuffer(size_t size) {
+	if (_out_size<size) {
+		free(_out);
+		_out=(char*)malloc(size);
+		debug_assertp(_out, this, "failed to allocate buffer");
+		_out_size=size;
+	}
+	return _out;
+}
+
+int BlockDecoder::inflateBlock(const char* in, size_t c_size, char* out, size_t uc_size) {
+	inflateReset(&_strm);
+	_strm.next_in=(Bytef*)in;
+	_strm.avail_in=c_size;
+	_strm.next_out=(Bytef*)out;
+	_strm.avail_out=uc_size;
+	int status=inflate(&_strm, Z_FINISH);
+	if (status==Z_STREAM_END) {
+		return (_strm.avail_out==0) ? READERR_NONE : READERR_LENGTH;
+	} else if (status==Z_BUF_ERROR || status==Z_OK) {
+		// out of output space means the block inflates to more than uc_size
+		return (_strm.avail_out==0) ? READERR_LENGTH : READERR_INFLATE;
+	}
+	return READERR_INFLATE;
+}
+
+// class BlockEncoder implementation
+
+BlockEncoder::BlockEncoder(int level) : _out(NULL), _out_size(0) {
+	_strm.zalloc=Z_NULL;
+	_strm.zfree=Z_NULL;
+	_strm.opaque=Z_NULL;
+	int status=deflateInit2(&_strm, level, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY);
+	debug_assertp(status==Z_OK, this, "failed to init zip stream");
+	(void)status;
+}
+
+BlockEncoder::~BlockEncoder() {
+	deflateEnd(&_strm);
+	free(_out);
+}
+
+const char* BlockEncoder::encodeBlock(const char* data, size_t uc_blocksize, size_t block_size, size_t& c_blocksize, size_t& table_value) {
+	if (_out_size<block_size) {
+		free(_out);
+		_out=(char*)malloc(block_size);
+		debug_assertp(_out, this, "failed to allocate buffer");
+		_out_size=block_size;
+	}
+	deflateReset(&_strm);
+	_strm.next_in=(Bytef*)data;
+	_strm.avail_in=uc_blocksize;
+	_strm.next_out=(Bytef*)_out;
+	// a deflated block must be smaller than its data, or it reads as stored
+	_strm.avail_out=uc_blocksize-1;
+	if (uc_blocksize>1 && deflate(&_strm, Z_FINISH)==Z_STREAM_END) {
+		c_blocksize=uc_blocksize-1-_strm.avail_out;
+		table_value=c_blocksize;
+		return _out;
+	}
+	// stored; a full block is recorded as 0
+	c_blocksize=uc_blocksize;
+	table_value=(uc_blocksize==block_size) ? 0 : uc_blocksize;
+	return data;
+}
+
+int BlockEncoder::writeBlocks(Stream* out, const char* data, uint64_t size, size_t block_size, std::vector<size_t>& table, uint64_t* c_size) {
+	uint64_t written=0;
+	size_t uc_blocksize, c_blocksize, table_value;
+	while (size!=0) {
+		uc_blocksize=(size<block_size) ? size : block_size;
+		const char* block=encodeBlock(data, uc_blocksize, block_size, c_blocksize, table_value);
+		table.push_back(table_value);
+		if (out->write(block, c_blocksize)!=c_blocksize) {
+			return READERR_WRITE;
+		}
+		written+=c_blocksize;
+		data+=uc_blocksize;
+		size-=uc_blocksize;
+	}
+	if (c_size) {
+		*c_size=written;
+	}
+	return READERR_NONE;
+}
+
+void BlockEncoder::encodeBlocks(const char* data, uint64_t size, size_t block_size, std::vector<size_t>& table, std::vector<char>& out) {
+	size_t uc_blocksize, c_blocksize, table_value;
+	while (size!=0) {
+		uc_blocksize=(size<block_size) ? size : block_size;
+		const char* block=encodeBlock(data, uc_blocksize, block_size, c_blocksize, table_value);
+		table.push_back(table_value);
+		out.insert(out.end(), block, block+c_blocksize);
+		data+=uc_blocksize;
+		size-=uc_blocksize;
+	}
+}
+
 // class Entry implementation
 
-#define __read_buf_size 0x10000
-char __read_buf_out[__read_buf_size], __read_buf_in[__read_buf_size];
-
-int Entry::readToStream(Stream* instream, Stream* outstream, const SDPK2& pak) const {
-	debug_assertp(pak.getCompressionMethod()==COMPMETHOD_ZLIB, this, "unsupported compression method");
-	if (_size>0) {
-		z_stream strm;
-		strm.zalloc=Z_NULL;
-		strm.zfree=Z_NULL;
-		strm.opaque=Z_NULL;
-		strm.next_in=(Bytef*)Z_NULL;
-		strm.avail_in=0;
-		strm.next_out=(Bytef*)Z_NULL;
-		strm.avail_out=0;
-		int status=inflateInit2(&strm, 15);
-		debug_assertp(status==Z_OK, this, "failed to init zip stream");
-		instream->seek(_offset);
-		size_t w_sizeleft, w_size, uc_size, c_size, c_blocksize, uc_blocksize;
-		unsigned int b_index=_blocksize_index;
-		uc_size=_size;
-		c_size=0;
-		while (uc_size!=0) {
-			uc_blocksize=(uc_size<pak.getBlockSize()) ? uc_size : pak.getBlockSize();
-			c_blocksize=pak.getBlockSizeTable()[b_index++];
-			c_size+=c_blocksize;
-			//printf("begin uc_size=%li uc_blocksize=%lu c_blocksize=%lu\n", uc_size, uc_blocksize, c_blocksize);
-			debug_assertp(c_blocksize<=uc_blocksize, this, "compressed block size is larger than uncompressed block size");
-			if (c_blocksize==0 || uc_size==c_blocksize) {
-				if (c_blocksize==0) {
-					c_blocksize=pak.getBlockSize();
-				}
-				w_sizeleft=c_blocksize;
-				while (w_sizeleft!=0) {
-					w_size=(w_sizeleft<__read_buf_size) ? w_sizeleft : __read_buf_size;
-					instream->read(__read_buf_in, w_size);
-					outstream->write(__read_buf_in, w_size);
-					w_sizeleft-=w_size;
-				}
-			} else { // inflate
-				w_sizeleft=c_blocksize;
-				//printf("inflate block: w_sizeleft=%lu\n", w_sizeleft);
-				do {
-					w_size=(w_sizeleft<__read_buf_size) ? w_sizeleft : __read_buf_size;
-					instream->read(__read_buf_in, w_size);
-					strm.next_in=(Bytef*)__read_buf_in;
-					strm.avail_in=w_size;
-					do {
-						strm.next_out=(Bytef*)__read_buf_out;
-						strm.avail_out=__read_buf_size;
-						status=inflate(&strm, Z_NO_FLUSH);
-						//printf("status=%d strm.avail_out=%u strm.avail_in=%u chunk_size=%lu\n", status, strm.avail_out, strm.avail_in, __read_buf_size-(size_t)strm.avail_out);
-						debug_assert(status>=Z_OK, "zlib error");
-						outstream->write(__read_buf_out, __read_buf_size-strm.avail_out);
-					} while (strm.avail_out==0);
-					w_sizeleft-=w_size;
-				} while (status>=Z_OK && w_sizeleft>0);
-				debug_assertp((status==Z_OK || status==Z_STREAM_END), this, "failed to handle/decompress block");
-				inflateReset(&strm);
+// largest compressed block: comp_block_sizes elements are ushorts
+#define __max_c_blocksize 0xFFFF
+
+int Entry::getCompressedRange(const SDPK2& pak, unsigned int first_block, unsigned int block_count, uint64_t& offset, uint64_t& size) const {
+	const BlockSizeTable& table=pak.getBlockSizeTable();
+	size_t block_size=pak.getBlockSize();
+	uint64_t uc_size=_size, c_blocksize;
+	unsigned int b_index=_blocksize_index, index=0;
+	offset=_offset;
+	size=0;
+	for (; uc_size!=0 && (index<first_block || index-first_block<block_count); ++index, ++b_index) {
+		if (b_index>=table.size()) {
+			return READERR_BLOCKINDEX;
+		}
+		c_blocksize=(table[b_index]==0) ? block_size : table[b_index];
+		if (index<first_block) {
+			offset+=c_blocksize;
+		} else {
+			size+=c_blocksize;
+		}
+		uc_size-=(uc_size<block_size) ? uc_size : block_size;
+	}
+	return READERR_NONE;
+}
+
+int Entry::readBlocks(BlockSource& source, const SDPK2& pak, BlockHandler& handler, BlockDecoder& decoder, unsigned int first_block, unsigned int block_count) const {
+	if (pak.getCompressionMethod()!=COMPMETHOD_ZLIB) {
+		handler.error(0, READERR_COMPMETHOD);
+		return READERR_COMPMETHOD;
+	}
+	if (_size==0 || block_count==0) {
+		return READERR_NONE;
+	}
+	if (__builtin_expect(Prefetch::recording || Prefetch::replaying, 0)) {
+		Prefetch::onRead(pak, *this, first_block, block_count);
+	}
+	TracePrefetcher* prefetcher=Prefetch::consumer();
+	const BlockSizeTable& table=pak.getBlockSizeTable();
+	size_t block_size=pak.getBlockSize();
+	uint64_t uc_size=_size, c_size=0, start=_offset;
+	size_t c_blocksize, uc_blocksize;
+	unsigned int b_index=_blocksize_index, index=0;
+	// skip the compressed data of the blocks before first_block
+	for (; index<first_block && uc_size!=0; ++index, ++b_index) {
+		if (b_index>=table.size()) {
+			handler.error(index, READERR_BLOCKINDEX);
+			return READERR_BLOCKINDEX;
+		}
+		start+=(table[b_index]==0) ? block_size : table[b_index];
+		uc_size-=(uc_size<block_size) ? uc_size : block_size;
+	}
+	char* buf_in=decoder.getInBuffer((block_size>__max_c_blocksize) ? block_size : __max_c_blocksize);
+	char* buf_out=decoder.getOutBuffer(block_size);
+	source.seek(start);
+	int result=READERR_NONE, err;
+	bool stored;
+	const char* data;
+	for (; uc_size!=0 && index-first_block<block_count; ++index, ++b_index) {
+		if (b_index>=table.size()) {
+			handler.error(index, READERR_BLOCKINDEX);
+			return READERR_BLOCKINDEX;
+		}
+		uc_blocksize=(uc_size<block_size) ? uc_size : block_size;
+		c_blocksize=table[b_index];
+		stored=(c_blocksize==0 || uc_size==c_blocksize);
+		if (c_blocksize==0) {
+			c_blocksize=block_size;
+		}
+		c_size+=c_blocksize;
+		char* dest=handler.blockBuffer(index, uc_blocksize);
+		if (prefetcher && prefetcher->take(pak, start+c_size-c_blocksize, (dest) ? dest : buf_out, uc_blocksize)) {
+			// decoded ahead by the prefetcher
+			source.seek(start+c_size);
+			if (!handler.block(index, (dest) ? dest : buf_out, uc_blocksize)) {
+				return READERR_WRITE;
 			}
 			uc_size-=uc_blocksize;
+			continue;
+		}
+		if (__builtin_expect(Throttle::enabled, 0)) {
+			Throttle::read.take(c_blocksize);
+		}
+		StatScope read_scope(STAT_TIME_READ);
+		TraceScope read_trace("read", index);
+		// a good stored block can be read straight into dest
+		data=source.read(c_blocksize, (dest && stored && c_blocksize==uc_blocksize) ? dest : buf_in);
+		read_trace.stop();
+		read_scope.stop();
+		if (!data) {
+			handler.error(index, READERR_READ);
+			return READERR_READ;
+		}
+		if (c_blocksize>uc_blocksize) {
+			err=READERR_BLOCKSIZE;
+		} else if (stored) {
+			err=READERR_NONE;
+			if (dest && data!=dest) {
+				memcpy(dest, data, uc_blocksize);
+				data=dest;
+			}
+			Stats::add(STAT_BLOCKS_STORED, 1);
+		} else {
+			InflateSlot inflate_slot;
+			StatScope inflate_scope(STAT_TIME_INFLATE);
+			TraceScope inflate_trace("inflate", index);
+			char* out=(dest) ? dest : buf_out;
+			err=decoder.inflateBlock(data, c_blocksize, out, uc_blocksize);
+			inflate_trace.stop();
+			inflate_scope.stop();
+			data=out;
+			Stats::add(STAT_BLOCKS_DEFLATED, 1);
+			Stats::add(STAT_BYTES_INFLATED, uc_blocksize);
+		}
+		if (err!=READERR_NONE) {
+			if (result==READERR_NONE) {
+				result=err;
+			}
+			if (!handler.error(index, err)) {
+				return err;
+			}
+		} else if (!handler.block(index, data, uc_blocksize)) {
+			return READERR_WRITE;
+		}
+		uc_size-=uc_blocksize;
+	}
+	Stats::add(STAT_BYTES_READ, c_size);
+	if (source.pos()!=start+c_size) {
+		//printf("leftover: %lu: %lu, %lu\n", start+c_size-source.pos(), start+c_size, source.pos());
+		if (result==READERR_NONE) {
+			result=READERR_POSITION;
+		}
+		handler.error(index, READERR_POSITION);
+	}
+	return result;
+}
+
+// class StreamBlockHandler implementation
+
+bool StreamBlockHandler::block(unsigned int index, const char* data, size_t size) {
+	if (_digest) {
+		_digest->update(data, size);
+	}
+	if (__builtin_expect(Throttle::enabled, 0)) {
+		Throttle::write.take(size);
+	}
+	StatScope write_scope(STAT_TIME_WRITE);
+	TraceScope write_trace("write", index);
+	Stats::add(STAT_BYTES_WRITTEN, size);
+	return _stream->write(data, size)==size;
+}
+
+BlockDecoder __default_decoder;
+
+int Entry::readToStream(BlockSource& source, Stream* outstream, const SDPK2& pak, CRC32C* digest, BlockDecoder& decoder) const {
+	StreamBlockHandler handler(outstream, digest);
+	return readBlocks(source, pak, handler, decoder);
+}
+
+int Entry::readToStream(Stream* instream, Stream* outstream, const SDPK2& pak, CRC32C* digest, BlockDecoder* decoder) const {
+	StreamBlockSource source(instream);
+	return readToStream(source, outstream, pak, digest, (decoder) ? *decoder : __default_decoder);
+}
+
+int Entry::readToBuffer(BlockSource& source, const SDPK2& pak, PooledBuffer& out, BlockDecoder& decoder, BufferPool& pool) const {
+	if (!out.allocate(_size, pool)) {
+		return READERR_WRITE;
+	}
+	BufferBlockHandler handler(pak.getBlockSize(), out.data());
+	int err=readBlocks(source, pak, handler, decoder);
+	if (err!=READERR_NONE) {
+		out.reset();
+	}
+	return err;
+}
+
+int Entry::readToBuffer(Stream* instream, const SDPK2& pak, PooledBuffer& out, BlockDecoder* decoder, BufferPool& pool) const {
+	StreamBlockSource source(instream);
+	return readToBuffer(source, pak, out, (decoder) ? *decoder : __default_decoder, pool);
+}
+
+class RangeBlockHandler : public BlockHandler {
+public:
+	RangeBlockHandler(size_t block_size, uint64_t offset, uint64_t size, char* out) : _block_size(block_size), _offset(offset), _size(size), _out(out) {
+	};
+	char* blockBuffer(unsigned int index, size_t size) {
+		// blocks entirely inside the range decode in place
+		uint64_t pos=(uint64_t)index*_block_size;
+		return (pos>=_offset && pos+size<=_offset+_size) ? _out+(pos-_offset) : NULL;
+	};
+	bool block(unsigned int index, const char* data, size_t size) {
+		uint64_t pos=(uint64_t)index*_block_size;
+		if (pos>=_offset && data==_out+(pos-_offset)) {
+			return true;
+		}
+		uint64_t from=(_offset>pos) ? _offset-pos : 0;
+		uint64_t to=(_offset+_size<pos+size) ? _offset+_size-pos : size;
+		if (from<to) {
+			memcpy(_out+(pos+from-_offset), data+from, to-from);
 		}
-		inflateEnd(&strm);
-		//printf("leftover: %lu: %lu, %lu\n", _offset+c_size-instream->pos(), _offset+c_size, instream->pos());
-		debug_assertp(instream->pos()==_offset+c_size, this, "read either too little or too much data");
+		return true;
+	};
+	
+protected:
+	size_t _block_size;
+	uint64_t _offset, _size;
+	char* _out;
+};
+
+int Entry::readRange(Stream* instream, const SDPK2& pak, uint64_t offset, uint64_t size, char* out, BlockDecoder* decoder) const {
+	StreamBlockSource source(instream);
+	return readRange(source, pak, offset, size, out, (decoder) ? *decoder : __default_decoder);
+}
+
+int Entry::readRange(BlockSource& source, const SDPK2& pak, uint64_t offset, uint64_t size, char* out, BlockDecoder& decoder) const {
+	if (offset>_size || size>_size-offset) {
+		return READERR_LENGTH;
+	}
+	if (size==0) {
+		return READERR_NONE;
 	}
-	return 0;
+	size_t block_size=pak.getBlockSize();
+	unsigned int first=offset/block_size;
+	unsigned int last=(offset+size-1)/block_size;
+	RangeBlockHandler handler(block_size, offset, size, out);
+	return readBlocks(source, pak, handler, decoder, first, last-first+1);
+}
+
+#define __uint40_make(o, b, i) ((o=((uint64_t)b<<32)|i))
+#define __uint40_split(o, b, i) (({b=(o>>32)&0xFF; i=o&0xFFFFFFFF;}))
+
+void Entry::deserialize(const unsigned char* data) {
+	SDPK2Format::Entry e;
+	SDPK2Format::decode(e, data);
+	memcpy(_hash.data(), e.hash.data, 16);
+	_blocksize_index=e.blocksize_index;
+	_size=e.size.value;
+	_offset=e.offset.value;
 }
 
-#define __uint40_make(o, b, i) ((o=((size_t)b<<32)|i))
-#define __uint40_split(o, b, i) (({b=o&0x00FF00000000; i=o&0x0000FFFFFFFF;}))
+void Entry::serialize(unsigned char* data) const {
+	memcpy(data+SDPK2Format::Entry_OFFSET_hash, _hash.data(), 16);
+	storeBE<uint32_t>(data+SDPK2Format::Entry_OFFSET_blocksize_index, _blocksize_index);
+	// uint40: high byte, then the low 32 bits
+	data[SDPK2Format::Entry_OFFSET_size]=(_size>>32)&0xFF;
+	storeBE<uint32_t>(data+SDPK2Format::Entry_OFFSET_size+1, _size&0xFFFFFFFF);
+	data[SDPK2Format::Entry_OFFSET_offset]=(_offset>>32)&0xFF;
+	storeBE<uint32_t>(data+SDPK2Format::Entry_OFFSET_offset+1, _offset&0xFFFFFFFF);
+}
 
 void Entry::deserialize(Stream* stream) {
 	_hash.deserialize(stream);
@@ -192,6 +520,65 @@ const Entry* SDPK2::findEntry(const MD5Hash& hash) const {
 	return NULL;
 }
 
+Stream* SDPK2::openDataStream() const {
+	StatScope open_scope(STAT_TIME_OPEN);
+	Stream* s=FileStream::readFile(_path);
+	if (!s) {
+		printf("ERROR: Failed to open SDPK2 file: %s\n", _path);
+	}
+	return s;
+}
+
+void SDPK2::closeDataStream(Stream* stream) {
+	if (stream) {
+		StatScope close_scope(STAT_TIME_CLOSE);
+		stream->close();
+		delete stream;
+	}
+}
+
+struct __EntryHashLess {
+	bool operator()(const Entry* x, const Entry* y) const {
+		return x->hash().compare(y->hash())<0;
+	};
+};
+
+struct __QueryHashLess {
+	const MD5Hash* hashes;
+	bool operator()(size_t x, size_t y) const {
+		return hashes[x].compare(hashes[y])<0;
+	};
+};
+
+void SDPK2::findEntries(const MD5Hash* hashes, size_t count, const Entry** out) const {
+	std::vector<const Entry*> sorted(_entries.size());
+	for (size_t i=0; i<_entries.size(); ++i) {
+		sorted[i]=&_entries[i];
+	}
+	std::sort(sorted.begin(), sorted.end(), __EntryHashLess());
+	std::vector<size_t> order(count);
+	for (size_t i=0; i<count; ++i) {
+		order[i]=i;
+	}
+	__QueryHashLess query_less={hashes};
+	std::sort(order.begin(), order.end(), query_less);
+	// merge; duplicate hashes in the archive resolve to the first in entry order
+	size_t e=0;
+	for (size_t q=0; q<count; ++q) {
+		const MD5Hash& hash=hashes[order[q]];
+		while (e<sorted.size() && sorted[e]->hash().compare(hash)<0) {
+			++e;
+		}
+		const Entry* found=NULL;
+		for (size_t k=e; k<sorted.size() && sorted[k]->hash().compare(hash)==0; ++k) {
+			if (!found || sorted[k]<found) {
+				found=sorted[k];
+			}
+		}
+		out[order[q]]=found;
+	}
+}
+
 void SDPK2::clearEntries() {
 	_entries.clear();
 };
@@ -202,53 +589,200 @@ const char* __comp_methods[]={
 	"lzx "
 };
 
-void SDPK2::deserializeInfo(Stream* stream) {
+bool SDPK2::deserializeInfo(const unsigned char* data, size_t size) {
 	//clear(); // resizing without clearing is faster
-	int temp;
-	stream->read(&temp, 4);
-	debug_assertp(temp==0x52415350 /*50534152 "PSAR" */, this, "unrecognized header");
-	temp=stream->readInt16();
-	debug_assertp(temp==1, this, "TODO: unrecognized version");
-	temp=stream->readInt16();
-	debug_assertp(temp==4, this, "TODO: unrecognized _unk");
-	stream->read(&temp, 4);
+	BEReader reader(data, size);
+	const unsigned char* head_buf=reader.readBytes(SDPK2Format::LayoutHead_SIZE);
+	if (!head_buf) {
+		return false;
+	}
+	SDPK2Format::LayoutHead head;
+	SDPK2Format::decode(head, head_buf);
+	debug_assertp(memcmp(head.header, "PSAR", 4)==0, this, "unrecognized header");
+	debug_assertp(head.version==1, this, "TODO: unrecognized version");
+	debug_assertp(head._unk==4, this, "TODO: unrecognized _unk");
 	_comp_method=COMPMETHOD_UNKNOWN;
 	for (unsigned int i=COMPMETHOD_FIRST; i<=COMPMETHOD_LAST; ++i) {
-		if (strncmp((const char*)(&temp), __comp_methods[i], 4)==0) {
+		if (strncmp((const char*)head.comp_method, __comp_methods[i], 4)==0) {
 			_comp_method=(CompressionMethod)i;
 			break;
 		}
 	}
-	size_t header_size=stream->readUInt32();
-	size_t size=stream->readUInt32(); // entry_size
-	debug_assertp(size==30, this, "entry_size!=30");
-	size=stream->readUInt32(); // entry_count
-	_block_size=stream->readUInt32();
-	int block_blocksize=stream->readInt32(); // size of elements in comp_block_sizes
-	debug_assertp(block_blocksize==2, this, "block_block_size!=2");
-	_entries.resize(size);
-	unsigned int i;
-	for (i=0; i<size; ++i) {
-		_entries[i].deserialize(stream);
-	}
-	unsigned int count=(header_size-stream->pos())/2;
-	_c_blocksize_table.resize(count);
+	size_t header_size=head.header_size;
+	debug_assertp(head.entry_size==SDPK2Format::Entry_SIZE, this, "entry_size!=30");
+	size_t count=head.entry_count;
+	_block_size=head.block_size;
+	// size of elements in comp_block_sizes
+	debug_assertp(head.comp_block_element_size==2, this, "block_block_size!=2");
+	if (header_size>size || !reader.require(count*SDPK2Format::Entry_SIZE)) {
+		printf("(SDPK2) header is truncated\n");
+		return false;
+	}
+	_entries.resize(count);
+	size_t i;
 	for (i=0; i<count; ++i) {
-		_c_blocksize_table[i]=stream->readUInt16();
+		_entries[i].deserialize(reader.readBytesUnchecked(SDPK2Format::Entry_SIZE));
+	}
+	if (reader.pos()>header_size) {
+		printf("(SDPK2) entries overrun header_size: %lu > %lu\n", reader.pos(), header_size);
+		return false;
 	}
-	if (stream->pos()!=header_size) {
-		printf("(SDPK2) stream position does not match header_size: %lu != %lu\n", stream->pos(), header_size);
+	count=(header_size-reader.pos())/2;
+	std::vector<uint16_t> table(count);
+	reader.readArray((count>0) ? &table[0] : NULL, count);
+	_c_blocksize_table.assign(table.begin(), table.end());
+	if (reader.pos()!=header_size) {
+		printf("(SDPK2) stream position does not match header_size: %lu != %lu\n", reader.pos(), header_size);
 		assert(false);
 	}
+	return true;
+}
+
+// first 30-byte record (in entry order) whose hash matches
+static const unsigned char* __find_record(const unsigned char* p, size_t count, const MD5Hash& hash) {
+#if defined(__SSE2__)
+	const __m128i needle=_mm_loadu_si128((const __m128i*)hash.data());
+	for (size_t i=0; i<count; ++i, p+=SDPK2Format::Entry_SIZE) {
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), needle))==0xFFFF) {
+			return p;
+		}
+	}
+#else
+	for (size_t i=0; i<count; ++i, p+=SDPK2Format::Entry_SIZE) {
+		if (memcmp(p, hash.data(), 16)==0) {
+			return p;
+		}
+	}
+#endif
+	return NULL;
+}
+
+bool SDPK2::deserializeEntry(const MD5Hash& hash, const unsigned char* data, size_t size) {
+	clear();
+	if (size<SDPK2Format::LayoutHead_SIZE || memcmp(data, "PSAR", 4)!=0) {
+		printf("(SDPK2) unrecognized header\n");
+		return false;
+	}
+	SDPK2Format::LayoutHead head;
+	SDPK2Format::decode(head, data);
+	_comp_method=COMPMETHOD_UNKNOWN;
+	for (unsigned int i=COMPMETHOD_FIRST; i<=COMPMETHOD_LAST; ++i) {
+		if (strncmp((const char*)head.comp_method, __comp_methods[i], 4)==0) {
+			_comp_method=(CompressionMethod)i;
+			break;
+		}
+	}
+	_block_size=head.block_size;
+	size_t header_size=head.header_size;
+	size_t table_pos=SDPK2Format::LayoutHead_SIZE+(size_t)head.entry_count*SDPK2Format::Entry_SIZE;
+	if (head.entry_size!=SDPK2Format::Entry_SIZE || head.comp_block_element_size!=2
+		|| header_size>size || table_pos>header_size) {
+		printf("(SDPK2) header is truncated\n");
+		return false;
+	}
+	const unsigned char* record=__find_record(data+SDPK2Format::LayoutHead_SIZE, head.entry_count, hash);
+	if (!record) {
+		return false;
+	}
+	Entry entry;
+	entry.deserialize(record);
+	// the entry's slice of comp_block_sizes, clamped; readBlocks reports what is missing
+	size_t table_count=(header_size-table_pos)/2;
+	size_t blocks=(_block_size>0) ? (entry.getSize()+_block_size-1)/_block_size : 0;
+	size_t first=(entry.getBlockSizeIndex()<table_count) ? entry.getBlockSizeIndex() : table_count;
+	if (blocks>table_count-first) {
+		blocks=table_count-first;
+	}
+	_c_blocksize_table.resize(blocks);
+	for (size_t i=0; i<blocks; ++i) {
+		_c_blocksize_table[i]=loadBE<uint16_t>(data+table_pos+(first+i)*2);
+	}
+	entry.setBlockSizeIndex(0);
+	_entries.push_back(entry);
+	return true;
+}
+
+bool SDPK2::deserializeInfo(Stream* stream) {
+	// read the whole header and parse it from memory
+	unsigned char head_buf[SDPK2Format::LayoutHead_SIZE];
+	if (stream->read(head_buf, sizeof(head_buf))!=sizeof(head_buf)) {
+		printf("(SDPK2) header is truncated\n");
+		return false;
+	}
+	size_t header_size=loadBE<uint32_t>(head_buf+SDPK2Format::LayoutHead_OFFSET_header_size);
+	if (header_size<sizeof(head_buf)) {
+		header_size=sizeof(head_buf);
+	}
+	std::vector<unsigned char> buf(header_size);
+	memcpy(&buf[0], head_buf, sizeof(head_buf));
+	size_t rest=header_size-sizeof(head_buf);
+	if (rest>0 && stream->read(&buf[sizeof(head_buf)], rest)!=rest) {
+		printf("(SDPK2) header is truncated\n");
+		return false;
+	}
+	return deserializeInfo(&buf[0], header_size);
+}
+
+void SDPK2::serializeInfo(Stream* stream) const {
+	stream->write("PSAR", 4);
+	stream->writeInt16(1); // version
+	stream->writeInt16(4); // _unk
+	stream->write(__comp_methods[(_comp_method==COMPMETHOD_UNKNOWN) ? COMPMETHOD_ZLIB : _comp_method], 4);
+	stream->writeUInt32(getHeaderSize());
+	stream->writeUInt32(30); // entry_size
+	stream->writeUInt32(_entries.size());
+	stream->writeUInt32(_block_size);
+	stream->writeInt32(2); // comp_block_element_size
+	for (size_t i=0; i<_entries.size(); ++i) {
+		_entries[i].serialize(stream);
+	}
+	for (size_t i=0; i<_c_blocksize_table.size(); ++i) {
+		stream->writeUInt16(_c_blocksize_table[i]);
+	}
+}
+
+void SDPK2::serializeInfo(std::vector<unsigned char>& out, size_t header_size) const {
+	size_t size=getHeaderSize();
+	if (header_size<size) {
+		header_size=size;
+	}
+	out.assign(header_size, 0);
+	unsigned char* p=&out[0];
+	memcpy(p+SDPK2Format::LayoutHead_OFFSET_header, "PSAR", 4);
+	storeBE<uint16_t>(p+SDPK2Format::LayoutHead_OFFSET_version, 1);
+	storeBE<uint16_t>(p+SDPK2Format::LayoutHead_OFFSET__unk, 4);
+	memcpy(p+SDPK2Format::LayoutHead_OFFSET_comp_method, __comp_methods[(_comp_method==COMPMETHOD_UNKNOWN) ? COMPMETHOD_ZLIB : _comp_method], 4);
+	storeBE<uint32_t>(p+SDPK2Format::LayoutHead_OFFSET_header_size, header_size);
+	storeBE<uint32_t>(p+SDPK2Format::LayoutHead_OFFSET_entry_size, SDPK2Format::Entry_SIZE);
+	storeBE<uint32_t>(p+SDPK2Format::LayoutHead_OFFSET_entry_count, _entries.size());
+	storeBE<uint32_t>(p+SDPK2Format::LayoutHead_OFFSET_block_size, _block_size);
+	storeBE<uint32_t>(p+SDPK2Format::LayoutHead_OFFSET_comp_block_element_size, 2);
+	p+=SDPK2Format::LayoutHead_SIZE;
+	for (size_t i=0; i<_entries.size(); ++i, p+=SDPK2Format::Entry_SIZE) {
+		_entries[i].serialize(p);
+	}
+	for (size_t i=0; i<_c_blocksize_table.size(); ++i, p+=2) {
+		storeBE<uint16_t>(p, _c_blocksize_table[i]);
+	}
+	// the rest reads back as unused comp_block_sizes elements
 }
 
 bool SDPK2::open() {
 	if (!_stream) {
+		TraceScope open_trace("open");
+		StatScope open_scope(STAT_TIME_OPEN);
 		Stream* s=FileStream::readFile(_path);
+		open_scope.stop();
 		if (s) {
 			EndianStream* es2=new EndianStream(s, true, DUCT_BIG_ENDIAN);
 			_stream=es2;
-			deserializeInfo(es2);
+			StatScope header_scope(STAT_TIME_HEADER);
+			if (!deserializeInfo(es2)) {
+				printf("ERROR: Failed to read SDPK2 header: %s\n", _path);
+				header_scope.stop();
+				close();
+				return false;
+			}
 		} else {
 			printf("ERROR: Failed to open SDPK2 file: %s\n", _path);
 			return false;
@@ -259,6 +793,7 @@ bool SDPK2::open() {
 
 void SDPK2::close() {
 	if (_stream) {
+		StatScope close_scope(STAT_TIME_CLOSE);
 		Stream* s=_stream->getStream();
 		_stream->close();
 		delete s;
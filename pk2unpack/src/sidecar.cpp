@@ -0,0 +1,480 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#if defined(PK2UNPACK_ZSTD)
+	#include <zstd.h>
+#endif
+#include <duct/debug.hpp>
+#include "byteorder.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "throttle.hpp"
+#include "sidecar.hpp"
+
+namespace PK2Unpack {
+
+static bool __pread_full(int fd, void* data, size_t size, uint64_t offset) {
+	char* p=(char*)data;
+	while (size>0) {
+		ssize_t n=pread(fd, p, size, offset);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<=0) {
+			return false;
+		}
+		p+=n;
+		size-=n;
+		offset+=n;
+	}
+	return true;
+}
+
+#if defined(PK2UNPACK_ZSTD)
+
+static bool __pwrite_full(int fd, const void* data, size_t size, uint64_t offset) {
+	const char* p=(const char*)data;
+	while (size>0) {
+		ssize_t n=pwrite(fd, p, size, offset);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<=0) {
+			return false;
+		}
+		p+=n;
+		size-=n;
+		offset+=n;
+	}
+	return true;
+}
+
+// size of the archive file and CRC32C of its header, as read from the file
+static bool __archive_fingerprint(const char* path, uint64_t& size, uint32_t& crc) {
+	int fd=::open(path, O_RDONLY);
+	if (fd<0) {
+		return false;
+	}
+	struct stat st;
+	unsigned char head[32];
+	bool ok=(fstat(fd, &st)==0 && __pread_full(fd, head, sizeof(head), 0));
+	if (ok) {
+		size=st.st_size;
+		std::vector<unsigned char> header(loadBE<uint32_t>(head+12));
+		ok=header.size()>=sizeof(head) && __pread_full(fd, &header[0], header.size(), 0);
+		crc=(ok) ? CRC32C::compute(&header[0], header.size()) : 0;
+	}
+	::close(fd);
+	return ok;
+}
+
+#endif // defined(PK2UNPACK_ZSTD)
+
+// class SidecarDecoder implementation
+
+#if defined(PK2UNPACK_ZSTD)
+
+SidecarDecoder::SidecarDecoder() : _ctx(ZSTD_createDCtx()) {
+	debug_assertp(_ctx, this, "failed to create zstd context");
+}
+
+SidecarDecoder::~SidecarDecoder() {
+	ZSTD_freeDCtx((ZSTD_DCtx*)_ctx);
+}
+
+int SidecarDecoder::decodeFrame(const char* in, size_t c_size, char* out, size_t uc_size) {
+	size_t n=ZSTD_decompressDCtx((ZSTD_DCtx*)_ctx, out, uc_size, in, c_size);
+	if (ZSTD_isError(n)) {
+		return READERR_INFLATE;
+	}
+	return (n==uc_size) ? READERR_NONE : READERR_LENGTH;
+}
+
+#else
+
+SidecarDecoder::SidecarDecoder() : _ctx(NULL) {
+}
+
+SidecarDecoder::~SidecarDecoder() {
+}
+
+int SidecarDecoder::decodeFrame(const char*, size_t, char*, size_t) {
+	return READERR_COMPMETHOD;
+}
+
+#endif // defined(PK2UNPACK_ZSTD)
+
+char* SidecarDecoder::getInBuffer(size_t size) {
+	if (_in.size()<size) {
+		_in.resize(size);
+	}
+	return &_in[0];
+}
+
+char* SidecarDecoder::getOutBuffer(size_t size) {
+	if (_out.size()<size) {
+		_out.resize(size);
+	}
+	return &_out[0];
+}
+
+// class ZstdSidecar implementation
+
+std::string ZstdSidecar::getPath(const SDPK2& pak) {
+	std::string path(pak.getPath());
+	path.append(".zst");
+	return path;
+}
+
+bool ZstdSidecar::open(const SDPK2& pak) {
+	close();
+#if defined(PK2UNPACK_ZSTD)
+	std::string path=getPath(pak);
+	int fd=::open(path.c_str(), O_RDONLY);
+	if (fd<0) {
+		return false;
+	}
+	unsigned char head[SIDECAR_HEAD_SIZE];
+	uint64_t archive_size;
+	uint32_t header_crc;
+	size_t count=pak.getBlockSizeTable().size();
+	if (!__pread_full(fd, head, sizeof(head), 0)
+		|| memcmp(head, "PKZS", 4)!=0 || loadBE<uint32_t>(head+4)!=1) {
+		printf("ERROR: Not a sidecar file: %s\n", path.c_str());
+	} else if (!__archive_fingerprint(pak.getPath(), archive_size, header_crc)
+		|| loadBE<uint32_t>(head+8)!=pak.getBlockSize() || loadBE<uint32_t>(head+12)!=count
+		|| loadBE<uint64_t>(head+16)!=archive_size || loadBE<uint32_t>(head+24)!=header_crc) {
+		printf("Ignoring stale sidecar: %s\n", path.c_str());
+	} else {
+		std::vector<unsigned char> records(count*SIDECAR_RECORD_SIZE);
+		if (count>0 && !__pread_full(fd, &records[0], records.size(), SIDECAR_HEAD_SIZE)) {
+			printf("ERROR: Sidecar is truncated: %s\n", path.c_str());
+		} else {
+			_offsets.resize(count);
+			_sizes.resize(count);
+			for (size_t i=0; i<count; ++i) {
+				_offsets[i]=loadBE<uint64_t>(&records[i*SIDECAR_RECORD_SIZE]);
+				_sizes[i]=loadBE<uint32_t>(&records[i*SIDECAR_RECORD_SIZE+8]);
+			}
+			_pak=&pak;
+			_fd=fd;
+			return true;
+		}
+	}
+	::close(fd);
+#else
+	(void)pak;
+#endif
+	return false;
+}
+
+void ZstdSidecar::close() {
+	if (_fd>=0) {
+		::close(_fd);
+		_fd=-1;
+	}
+	_pak=NULL;
+	_offsets.clear();
+	_sizes.clear();
+}
+
+bool ZstdSidecar::covers(const Entry& entry) const {
+	if (!_pak) {
+		return false;
+	}
+	size_t block_size=_pak->getBlockSize();
+	size_t count=(entry.getSize()+block_size-1)/block_size;
+	size_t first=entry.getBlockSizeIndex();
+	if (first>_sizes.size() || count>_sizes.size()-first) {
+		return false;
+	}
+	for (size_t i=0; i<count; ++i) {
+		if (_sizes[first+i]==0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static SidecarDecoder& __thread_decoder() {
+	static thread_local SidecarDecoder decoder;
+	return decoder;
+}
+
+int ZstdSidecar::readBlocks(const Entry& entry, BlockHandler& handler, SidecarDecoder* decoder) const {
+	if (!_pak) {
+		handler.error(0, READERR_READ);
+		return READERR_READ;
+	}
+	if (!decoder) {
+		decoder=&__thread_decoder();
+	}
+	size_t block_size=_pak->getBlockSize();
+	uint64_t uc_size=entry.getSize(), c_size=0;
+	size_t b_index=entry.getBlockSizeIndex(), uc_blocksize;
+	int result=READERR_NONE, err;
+	for (unsigned int index=0; uc_size!=0; ++index, ++b_index) {
+		if (b_index>=_sizes.size() || _sizes[b_index]==0) {
+			handler.error(index, READERR_BLOCKINDEX);
+			return READERR_BLOCKINDEX;
+		}
+		uc_blocksize=(uc_size<block_size) ? uc_size : block_size;
+		char* dest=handler.blockBuffer(index, uc_blocksize);
+		if (!dest) {
+			dest=decoder->getOutBuffer(block_size);
+		}
+		char* in=decoder->getInBuffer(_sizes[b_index]);
+		if (__builtin_expect(Throttle::enabled, 0)) {
+			Throttle::read.take(_sizes[b_index]);
+		}
+		StatScope read_scope(STAT_TIME_READ);
+		TraceScope read_trace("read", index);
+		bool ok=__pread_full(_fd, in, _sizes[b_index], _offsets[b_index]);
+		read_trace.stop();
+		read_scope.stop();
+		c_size+=_sizes[b_index];
+		if (!ok) {
+			err=READERR_READ;
+		} else {
+			InflateSlot inflate_slot;
+			StatScope inflate_scope(STAT_TIME_INFLATE);
+			TraceScope inflate_trace("zstd", index);
+			err=decoder->decodeFrame(in, _sizes[b_index], dest, uc_blocksize);
+			Stats::add(STAT_BYTES_INFLATED, uc_blocksize);
+		}
+		if (err!=READERR_NONE) {
+			if (result==READERR_NONE) {
+				result=err;
+			}
+			if (!handler.error(index, err)) {
+				return err;
+			}
+		} else if (!handler.block(index, dest, uc_blocksize)) {
+			return READERR_WRITE;
+		}
+		uc_size-=uc_blocksize;
+	}
+	Stats::add(STAT_BYTES_READ, c_size);
+	return result;
+}
+
+int ZstdSidecar::readToStream(const Entry& entry, Stream* outstream, CRC32C* digest, SidecarDecoder* decoder) const {
+	StreamBlockHandler handler(outstream, digest);
+	return readBlocks(entry, handler, decoder);
+}
+
+int ZstdSidecar::readToBuffer(const Entry& entry, PooledBuffer& out, SidecarDecoder* decoder, BufferPool& pool) const {
+	if (!_pak || !out.allocate(entry.getSize(), pool)) {
+		return (_pak) ? READERR_WRITE : READERR_READ;
+	}
+	BufferBlockHandler handler(_pak->getBlockSize(), out.data());
+	int err=readBlocks(entry, handler, decoder);
+	if (err!=READERR_NONE) {
+		out.reset();
+	}
+	return err;
+}
+
+#if defined(PK2UNPACK_ZSTD)
+
+// compresses each block the entry owns into a frame at the next free offset of the sidecar
+class TranscodeHandler : public BlockHandler {
+public:
+	TranscodeHandler(int fd, uint64_t& end, ZSTD_CCtx* ctx, int level, std::vector<char>& buffer, uint64_t* offsets, uint32_t* sizes, const uint32_t* owners, uint32_t entry)
+		: _fd(fd), _end(end), _ctx(ctx), _level(level), _buffer(buffer), _offsets(offsets), _sizes(sizes), _owners(owners), _entry(entry), _failed(false) {
+	};
+	bool block(unsigned int index, const char* data, size_t size) {
+		if (_owners[index]!=_entry) {
+			// a shared record; the entry which owns it writes it
+			return true;
+		}
+		_buffer.resize(ZSTD_compressBound(size));
+		size_t n=ZSTD_compressCCtx(_ctx, &_buffer[0], _buffer.size(), data, size, _level);
+		if (ZSTD_isError(n)) {
+			// leave the block without a frame; it is read from the archive
+			return true;
+		}
+		uint64_t offset=__sync_fetch_and_add(&_end, (uint64_t)n);
+		if (!__pwrite_full(_fd, &_buffer[0], n, offset)) {
+			_failed=true;
+			return false;
+		}
+		_offsets[index]=offset;
+		_sizes[index]=n;
+		return true;
+	};
+	bool error(unsigned int, int) {
+		// bad blocks get no frame
+		return true;
+	};
+	bool failed() const {
+		return _failed;
+	};
+	
+protected:
+	int _fd;
+	uint64_t& _end;
+	ZSTD_CCtx* _ctx;
+	int _level;
+	std::vector<char>& _buffer;
+	uint64_t* _offsets;
+	uint32_t* _sizes;
+	const uint32_t* _owners;
+	uint32_t _entry;
+	bool _failed;
+};
+
+class TranscodeTask : public ParallelTask {
+public:
+	TranscodeTask(const SDPK2& pak, int fd, uint64_t start, int level, unsigned int threads)
+		: _pak(pak), _fd(fd), _end(start), _level(level), _streams(threads, (Stream*)NULL), _decoders(threads, (BlockDecoder*)NULL),
+		_ctxs(threads, (ZSTD_CCtx*)NULL), _buffers(threads), _offsets(pak.getBlockSizeTable().size(), 0), _sizes(pak.getBlockSizeTable().size(), 0),
+		_owners(pak.getBlockSizeTable().size(), ~(uint32_t)0), _owning(pak.getEntries().size(), 0), _failed(threads, 0) {
+		// entries may share block records; each record is written only by the first entry using it
+		const EntryVec& entries=pak.getEntries();
+		size_t block_size=pak.getBlockSize();
+		for (size_t i=0; i<entries.size() && block_size>0; ++i) {
+			size_t first=entries[i].getBlockSizeIndex();
+			uint64_t blocks=(entries[i].getSize()+block_size-1)/block_size;
+			for (size_t b=first; b<_owners.size() && b-first<blocks; ++b) {
+				if (_owners[b]==~(uint32_t)0) {
+					_owners[b]=i;
+					_owning[i]=1;
+				}
+			}
+		}
+	};
+	void begin(unsigned int thread) {
+		_streams[thread]=_pak.openDataStream();
+		_decoders[thread]=new BlockDecoder();
+		_ctxs[thread]=ZSTD_createCCtx();
+	};
+	void run(size_t index, unsigned int thread) {
+		const Entry& entry=_pak.getEntries()[index];
+		size_t first=entry.getBlockSizeIndex();
+		if (!_streams[thread] || !_ctxs[thread]) {
+			_failed[thread]=1;
+			return;
+		}
+		if (first>=_offsets.size() || !_owning[index]) {
+			// no blocks, none in the table (the entry stays unreadable), or all written by other entries
+			return;
+		}
+		TraceScope entry_trace("entry", entry.getSize());
+		StreamBlockSource source(_streams[thread]);
+		TranscodeHandler handler(_fd, _end, _ctxs[thread], _level, _buffers[thread], &_offsets[first], &_sizes[first], &_owners[first], index);
+		entry.readBlocks(source, _pak, handler, *_decoders[thread]);
+		if (handler.failed()) {
+			_failed[thread]=1;
+		}
+	};
+	void end(unsigned int thread) {
+		SDPK2::closeDataStream(_streams[thread]);
+		_streams[thread]=NULL;
+		delete _decoders[thread];
+		_decoders[thread]=NULL;
+		ZSTD_freeCCtx(_ctxs[thread]);
+		_ctxs[thread]=NULL;
+	};
+	// after parallelFor() returns
+	bool failed() const {
+		return std::find(_failed.begin(), _failed.end(), 1)!=_failed.end();
+	};
+	uint64_t getEnd() const {
+		return _end;
+	};
+	// records for the sidecar index
+	void serializeRecords(std::vector<unsigned char>& out) const {
+		out.resize(_offsets.size()*SIDECAR_RECORD_SIZE);
+		for (size_t i=0; i<_offsets.size(); ++i) {
+			storeBE<uint64_t>(&out[i*SIDECAR_RECORD_SIZE], _offsets[i]);
+			storeBE<uint32_t>(&out[i*SIDECAR_RECORD_SIZE+8], _sizes[i]);
+		}
+	};
+	
+protected:
+	const SDPK2& _pak;
+	int _fd;
+	uint64_t _end;
+	int _level;
+	std::vector<Stream*> _streams;
+	std::vector<BlockDecoder*> _decoders;
+	std::vector<ZSTD_CCtx*> _ctxs;
+	std::vector<std::vector<char> > _buffers;
+	std::vector<uint64_t> _offsets;
+	std::vector<uint32_t> _sizes;
+	// entry index writing each record
+	std::vector<uint32_t> _owners;
+	// whether an entry owns any record
+	std::vector<char> _owning;
+	// per thread; not vector<bool>; threads write neighbouring elements
+	std::vector<char> _failed;
+};
+
+bool ZstdSidecar::transcode(const SDPK2& pak, int level, unsigned int threads) {
+	if (threads==0) {
+		threads=getHardwareThreads();
+	}
+	uint64_t archive_size;
+	uint32_t header_crc;
+	if (!__archive_fingerprint(pak.getPath(), archive_size, header_crc)) {
+		printf("ERROR: Failed to read SDPK2 header: %s\n", pak.getPath());
+		return false;
+	}
+	std::string path=getPath(pak);
+	std::string tmp_path(path);
+	tmp_path.append(".tmp");
+	int fd=::open(tmp_path.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if (fd<0) {
+		printf("ERROR: Failed to open %s for writing\n", tmp_path.c_str());
+		return false;
+	}
+	size_t count=pak.getBlockSizeTable().size();
+	TranscodeTask task(pak, fd, SIDECAR_HEAD_SIZE+count*SIDECAR_RECORD_SIZE, level, threads);
+	parallelFor(pak.getEntries().size(), threads, task);
+	bool ok=!task.failed();
+	if (ok) {
+		std::vector<unsigned char> index(SIDECAR_HEAD_SIZE);
+		memcpy(&index[0], "PKZS", 4);
+		storeBE<uint32_t>(&index[4], 1);
+		storeBE<uint32_t>(&index[8], pak.getBlockSize());
+		storeBE<uint32_t>(&index[12], count);
+		storeBE<uint64_t>(&index[16], archive_size);
+		storeBE<uint32_t>(&index[24], header_crc);
+		storeBE<uint32_t>(&index[28], 0);
+		std::vector<unsigned char> records;
+		task.serializeRecords(records);
+		index.insert(index.end(), records.begin(), records.end());
+		ok=__pwrite_full(fd, &index[0], index.size(), 0) && fsync(fd)==0;
+	}
+	::close(fd);
+	if (ok && rename(tmp_path.c_str(), path.c_str())!=0) {
+		ok=false;
+	}
+	if (!ok) {
+		printf("ERROR: Failed to write sidecar: %s\n", path.c_str());
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	printf("# sidecar:%s blocks:%lu archive_bytes:%lu sidecar_bytes:%lu\n", path.c_str(), (unsigned long)count, (unsigned long)archive_size, (unsigned long)task.getEnd());
+	return true;
+}
+
+#else
+
+bool ZstdSidecar::transcode(const SDPK2&, int, unsigned int) {
+	printf("ERROR: built without zstd support (premake4 --zstd gmake)\n");
+	return false;
+}
+
+#endif // defined(PK2UNPACK_ZSTD)
+
+} // namespace PK2Unpack
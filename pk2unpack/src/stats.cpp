@@ -0,0 +1,98 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "stats.hpp"
+
+namespace PK2Unpack {
+
+namespace Stats {
+
+bool enabled=false;
+
+static __thread ThreadStats* __local=NULL;
+static ThreadStats* __all=NULL;
+static pthread_mutex_t __all_lock=PTHREAD_MUTEX_INITIALIZER;
+static uint64_t __start=now();
+
+ThreadStats* local() {
+	if (!__local) {
+		// never freed; merged at exit by print()
+		ThreadStats* ts=(ThreadStats*)calloc(1, sizeof(ThreadStats));
+		pthread_mutex_lock(&__all_lock);
+		ts->next=__all;
+		__all=ts;
+		pthread_mutex_unlock(&__all_lock);
+		__local=ts;
+	}
+	return __local;
+}
+
+static const char* __counter_names[]={
+	"entries",
+	"bytes_read",
+	"bytes_inflated",
+	"bytes_written",
+	"blocks_stored",
+	"blocks_deflated"
+};
+
+static const char* __timer_names[]={
+	"open",
+	"header",
+	"read",
+	"inflate",
+	"write",
+	"output_open_close",
+	"close"
+};
+
+void print(FILE* out, bool json) {
+	uint64_t counters[STAT_COUNTER_COUNT]={0};
+	uint64_t timers[STAT_TIMER_COUNT]={0};
+	unsigned int threads=0;
+	pthread_mutex_lock(&__all_lock);
+	for (ThreadStats* ts=__all; ts; ts=ts->next) {
+		for (unsigned int i=0; i<STAT_COUNTER_COUNT; ++i) {
+			counters[i]+=ts->counters[i];
+		}
+		for (unsigned int i=0; i<STAT_TIMER_COUNT; ++i) {
+			timers[i]+=ts->timers[i];
+		}
+		++threads;
+	}
+	pthread_mutex_unlock(&__all_lock);
+	double wall=(double)(now()-__start)/1e9;
+	if (json) {
+		fprintf(out, "{\"threads\":%u,\"wall_seconds\":%.6f", threads, wall);
+		for (unsigned int i=0; i<STAT_COUNTER_COUNT; ++i) {
+			fprintf(out, ",\"%s\":%lu", __counter_names[i], (unsigned long)counters[i]);
+		}
+		for (unsigned int i=0; i<STAT_TIMER_COUNT; ++i) {
+			fprintf(out, ",\"%s_seconds\":%.6f", __timer_names[i], (double)timers[i]/1e9);
+		}
+		fprintf(out, "}\n");
+	} else {
+		fprintf(out, "stats[threads:%u, wall:%.3fs\n", threads, wall);
+		for (unsigned int i=0; i<STAT_COUNTER_COUNT; ++i) {
+			fprintf(out, "\t%-18s %14lu\n", __counter_names[i], (unsigned long)counters[i]);
+		}
+		// times are summed over threads
+		for (unsigned int i=0; i<STAT_TIMER_COUNT; ++i) {
+			fprintf(out, "\t%-18s %12.3fms\n", __timer_names[i], (double)timers[i]/1e6);
+		}
+		if (wall>0.0) {
+			fprintf(out, "\t%-18s %12.1fMB/s\n", "read_rate", (double)counters[STAT_BYTES_READ]/wall/1e6);
+		}
+		fprintf(out, "]\n");
+	}
+}
+
+} // namespace Stats
+
+} // namespace PK2Unpack
@@ -0,0 +1,392 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <duct/debug.hpp>
+#include "parallel.hpp"
+#include "throttle.hpp"
+#include "tar.hpp"
+
+namespace PK2Unpack {
+
+// class TarWriter implementation
+
+TarWriter::TarWriter(int fd, size_t buffer_size) : _fd(fd), _buffer(NULL), _size(0), _capacity(buffer_size), _file_size(0), _file_written(0), _failed(false) {
+	_buffer=(char*)malloc(_capacity);
+	debug_assertp(_buffer, this, "failed to allocate buffer");
+}
+
+TarWriter::~TarWriter() {
+	flush();
+	free(_buffer);
+}
+
+bool TarWriter::flush() {
+	const char* p=_buffer;
+	while (_size>0 && !_failed) {
+		ssize_t n=::write(_fd, p, _size);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<=0) {
+			_failed=true;
+			break;
+		}
+		p+=n;
+		_size-=n;
+	}
+	_size=0;
+	return !_failed;
+}
+
+bool TarWriter::append(const void* data, size_t size) {
+	const char* p=(const char*)data;
+	// headers and padding count against --max-write too
+	if (__builtin_expect(Throttle::enabled, 0)) {
+		Throttle::write.take(size);
+	}
+	if (_size+size>_capacity) {
+		if (!flush()) {
+			return false;
+		}
+		// large data goes straight out
+		if (size>=_capacity) {
+			while (size>0) {
+				ssize_t n=::write(_fd, p, size);
+				if (n<0 && errno==EINTR) {
+					continue;
+				} else if (n<=0) {
+					_failed=true;
+					return false;
+				}
+				p+=n;
+				size-=n;
+			}
+			return true;
+		}
+	}
+	memcpy(_buffer+_size, p, size);
+	_size+=size;
+	return true;
+}
+
+static void __tar_octal(char* field, size_t width, uint64_t value) {
+	// width-1 digits and a NUL
+	for (size_t i=width-1; i>0; --i) {
+		field[i-1]='0'+(value&7);
+		value>>=3;
+	}
+	field[width-1]='\0';
+}
+
+bool TarWriter::header(const char* name, uint64_t size, time_t mtime, char type) {
+	char h[TAR_RECORD_SIZE];
+	memset(h, 0, sizeof(h));
+	size_t len=strlen(name);
+	// ustar: prefix (155) "/" name (100)
+	const char* split=NULL;
+	if (len>100) {
+		for (const char* s=strchr(name, '/'); s; s=strchr(s+1, '/')) {
+			if ((size_t)(s-name)<=155 && len-(s-name)-1<=100 && len-(s-name)-1>0) {
+				split=s;
+				break;
+			}
+		}
+	}
+	if (split) {
+		memcpy(h+345, name, split-name);
+		memcpy(h, split+1, len-(split-name)-1);
+	} else {
+		memcpy(h, name, (len<100) ? len : 100);
+	}
+	__tar_octal(h+100, 8, 0644);
+	__tar_octal(h+108, 8, 0);
+	__tar_octal(h+116, 8, 0);
+	__tar_octal(h+124, 12, (size<077777777777ull) ? size : 0);
+	__tar_octal(h+136, 12, (mtime>0) ? (uint64_t)mtime : 0);
+	h[156]=type;
+	memcpy(h+257, "ustar", 6);
+	memcpy(h+263, "00", 2);
+	// checksum over the header with the checksum field as spaces
+	memset(h+148, ' ', 8);
+	unsigned int sum=0;
+	for (size_t i=0; i<sizeof(h); ++i) {
+		sum+=(unsigned char)h[i];
+	}
+	__tar_octal(h+148, 7, sum);
+	return append(h, sizeof(h));
+}
+
+// pax "<length> <key>=<value>\n" record; the length counts itself
+static void __pax_record(std::string& out, const char* key, const std::string& value) {
+	size_t base=strlen(key)+value.size()+3;
+	size_t len=base+1;
+	char digits[24];
+	while (true) {
+		size_t n=snprintf(digits, sizeof(digits), "%lu", (unsigned long)len);
+		if (base+n==len) {
+			break;
+		}
+		len=base+n;
+	}
+	out.append(digits);
+	out.push_back(' ');
+	out.append(key);
+	out.push_back('=');
+	out.append(value);
+	out.push_back('\n');
+}
+
+bool TarWriter::beginFile(const std::string& name, uint64_t size, time_t mtime) {
+	bool long_name=name.size()>100;
+	if (long_name) {
+		// fits the ustar prefix/name split?
+		long_name=true;
+		for (size_t s=name.find('/'); s!=std::string::npos; s=name.find('/', s+1)) {
+			if (s<=155 && name.size()-s-1<=100 && name.size()-s-1>0) {
+				long_name=false;
+				break;
+			}
+		}
+	}
+	if (long_name || size>=077777777777ull) {
+		std::string pax;
+		if (long_name) {
+			__pax_record(pax, "path", name);
+		}
+		if (size>=077777777777ull) {
+			char digits[24];
+			snprintf(digits, sizeof(digits), "%lu", (unsigned long)size);
+			__pax_record(pax, "size", digits);
+		}
+		static const char zeros[TAR_RECORD_SIZE]={0};
+		if (!header("././@PaxHeader", pax.size(), mtime, 'x') || !append(pax.data(), pax.size())
+			|| !append(zeros, (TAR_RECORD_SIZE-pax.size()%TAR_RECORD_SIZE)%TAR_RECORD_SIZE)) {
+			return false;
+		}
+	}
+	_file_size=size;
+	_file_written=0;
+	// the ustar name is truncated when the pax path applies
+	return header(name.c_str(), size, mtime, '0');
+}
+
+bool TarWriter::write(const void* data, size_t size) {
+	if (size>_file_size-_file_written) {
+		size=_file_size-_file_written;
+	}
+	_file_written+=size;
+	return append(data, size);
+}
+
+bool TarWriter::endFile() {
+	static const char zeros[TAR_RECORD_SIZE]={0};
+	while (_file_written<_file_size) {
+		uint64_t n=_file_size-_file_written;
+		if (!write(zeros, (n<sizeof(zeros)) ? n : sizeof(zeros))) {
+			return false;
+		}
+	}
+	return append(zeros, (TAR_RECORD_SIZE-_file_size%TAR_RECORD_SIZE)%TAR_RECORD_SIZE);
+}
+
+bool TarWriter::finish() {
+	static const char zeros[TAR_RECORD_SIZE*2]={0};
+	return append(zeros, sizeof(zeros)) && flush();
+}
+
+// tarArchive
+
+// entries larger than this are decoded by the writer, straight into the tar
+#define TAR_DIRECT_SIZE 0x4000000
+
+class TarBlockHandler : public BlockHandler {
+public:
+	TarBlockHandler(TarWriter& writer) : _writer(writer) {
+	};
+	bool block(unsigned int, const char* data, size_t size) {
+		return _writer.write(data, size);
+	};
+	
+protected:
+	TarWriter& _writer;
+};
+
+struct TarSlot {
+	PooledBuffer data;
+	int err;
+	bool ready;
+	// left for the writer (TAR_DIRECT_SIZE)
+	bool direct;
+};
+
+// decodes entries ahead of the writer, at most slots.size() at a time
+class TarPipeline {
+public:
+	TarPipeline(const SDPK2& pak, unsigned int window) : _pak(pak), _slots(window), _next(0), _written(0), _stop(false) {
+		pthread_mutex_init(&_lock, NULL);
+		pthread_cond_init(&_cond, NULL);
+		for (size_t i=0; i<_slots.size(); ++i) {
+			_slots[i].ready=false;
+		}
+	};
+	~TarPipeline() {
+		pthread_cond_destroy(&_cond);
+		pthread_mutex_destroy(&_lock);
+	};
+	static void* worker(void* arg) {
+		TarPipeline* p=(TarPipeline*)arg;
+		Stream* stream=p->_pak.openDataStream();
+		BlockDecoder decoder;
+		const EntryVec& entries=p->_pak.getEntries();
+		pthread_mutex_lock(&p->_lock);
+		while (p->_next<entries.size() && !p->_stop) {
+			size_t i=p->_next;
+			if (i>=p->_written+p->_slots.size()) {
+				pthread_cond_wait(&p->_cond, &p->_lock);
+				continue;
+			}
+			++p->_next;
+			pthread_mutex_unlock(&p->_lock);
+			TarSlot& slot=p->_slots[i%p->_slots.size()];
+			slot.direct=entries[i].getSize()>TAR_DIRECT_SIZE;
+			if (slot.direct) {
+				slot.err=READERR_NONE;
+			} else if (!stream) {
+				slot.err=READERR_READ;
+			} else {
+				StreamBlockSource source(stream);
+				slot.err=entries[i].readToBuffer(source, p->_pak, slot.data, decoder);
+			}
+			pthread_mutex_lock(&p->_lock);
+			slot.ready=true;
+			pthread_cond_broadcast(&p->_cond);
+		}
+		pthread_mutex_unlock(&p->_lock);
+		SDPK2::closeDataStream(stream);
+		return NULL;
+	};
+	// wait for entry i to be decoded
+	TarSlot& wait(size_t i) {
+		TarSlot& slot=_slots[i%_slots.size()];
+		pthread_mutex_lock(&_lock);
+		while (!slot.ready) {
+			pthread_cond_wait(&_cond, &_lock);
+		}
+		pthread_mutex_unlock(&_lock);
+		return slot;
+	};
+	// no more entries are claimed after this
+	void stop() {
+		pthread_mutex_lock(&_lock);
+		_stop=true;
+		pthread_cond_broadcast(&_cond);
+		pthread_mutex_unlock(&_lock);
+	};
+	// entry i is written; its slot can take another entry
+	void release(size_t i) {
+		TarSlot& slot=_slots[i%_slots.size()];
+		slot.data.reset();
+		pthread_mutex_lock(&_lock);
+		slot.ready=false;
+		++_written;
+		pthread_cond_broadcast(&_cond);
+		pthread_mutex_unlock(&_lock);
+	};
+	
+protected:
+	const SDPK2& _pak;
+	std::vector<TarSlot> _slots;
+	pthread_mutex_t _lock;
+	pthread_cond_t _cond;
+	size_t _next, _written;
+	bool _stop;
+	
+	TarPipeline(const TarPipeline&);
+	TarPipeline& operator=(const TarPipeline&);
+};
+
+size_t tarArchive(const SDPK2& pak, const PathIndex* paths, unsigned int threads, int fd) {
+	if (threads==0) {
+		threads=getHardwareThreads();
+	}
+	struct stat st;
+	time_t archive_mtime=(stat(pak.getPath(), &st)==0) ? st.st_mtime : 0;
+	const EntryVec& entries=pak.getEntries();
+	TarWriter writer(fd);
+	TarPipeline pipeline(pak, threads*4);
+	std::vector<pthread_t> workers;
+	for (unsigned int i=0; i<threads; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, TarPipeline::worker, &pipeline)==0) {
+			workers.push_back(thread);
+		}
+	}
+	Stream* direct_stream=NULL;
+	BlockDecoder direct_decoder;
+	size_t bad=0;
+	char hash_str[33];
+	std::string name;
+	size_t i=0;
+	for (; i<entries.size() && !workers.empty(); ++i) {
+		const Entry& entry=entries[i];
+		TarSlot& slot=pipeline.wait(i);
+		entry.hash().getExisting(hash_str, true);
+		const PathEntry* path=(paths) ? paths->find(entry.hash()) : NULL;
+		time_t mtime=archive_mtime;
+		if (path) {
+			// relative names; tar strips a leading "/" anyway
+			name.assign(path->path, (path->path[0]=='/') ? 1 : 0, std::string::npos);
+			mtime=paths->getFileInfo(*path).getTimeModified();
+		} else {
+			name.assign(hash_str);
+		}
+		if (slot.err!=READERR_NONE) {
+			fprintf(stderr, "%s: %s; left out\n", name.c_str(), getReadErrorName(slot.err));
+			++bad;
+		} else if (!writer.beginFile(name, entry.getSize(), mtime)) {
+			pipeline.release(i);
+			break;
+		} else if (slot.direct) {
+			if (!direct_stream) {
+				direct_stream=pak.openDataStream();
+			}
+			TarBlockHandler handler(writer);
+			StreamBlockSource source(direct_stream);
+			int err=(direct_stream) ? entry.readBlocks(source, pak, handler, direct_decoder) : READERR_READ;
+			if (err!=READERR_NONE && !writer.failed()) {
+				fprintf(stderr, "%s: %s; zero-filled\n", name.c_str(), getReadErrorName(err));
+				++bad;
+			}
+			writer.endFile();
+		} else {
+			writer.write(slot.data.data(), entry.getSize());
+			writer.endFile();
+		}
+		pipeline.release(i);
+		if (writer.failed()) {
+			break;
+		}
+	}
+	if (writer.failed() || workers.empty()) {
+		fprintf(stderr, "ERROR: Failed to write tar output\n");
+		pipeline.stop();
+		// everything not written counts as failed
+		bad+=entries.size()-i;
+	} else {
+		writer.finish();
+	}
+	for (size_t i=0; i<workers.size(); ++i) {
+		pthread_join(workers[i], NULL);
+	}
+	SDPK2::closeDataStream(direct_stream);
+	return bad;
+}
+
+} // namespace PK2Unpack
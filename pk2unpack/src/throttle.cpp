@@ -0,0 +1,272 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "stats.hpp"
+#include "throttle.hpp"
+
+namespace PK2Unpack {
+
+// longest single wait, so limit changes are seen quickly
+#define THROTTLE_MAX_WAIT 50000000ull
+// how often the control file's modification time is checked
+#define THROTTLE_CHECK_INTERVAL 1000000000ull
+#define THROTTLE_MIN_BURST 0x100000
+
+static void __sleep_ns(uint64_t ns) {
+	struct timespec ts;
+	ts.tv_sec=ns/1000000000ull;
+	ts.tv_nsec=ns%1000000000ull;
+	nanosleep(&ts, NULL);
+}
+
+// class TokenBucket implementation
+
+TokenBucket::TokenBucket() : _rate(0), _burst(0.0), _tokens(0.0), _last(0) {
+	pthread_mutex_init(&_lock, NULL);
+}
+
+TokenBucket::~TokenBucket() {
+	pthread_mutex_destroy(&_lock);
+}
+
+void TokenBucket::refill(uint64_t now) {
+	if (now>_last) {
+		_tokens+=(double)(now-_last)*(double)_rate/1e9;
+		if (_tokens>_burst) {
+			_tokens=_burst;
+		}
+	}
+	_last=now;
+}
+
+void TokenBucket::setRate(uint64_t rate) {
+	pthread_mutex_lock(&_lock);
+	uint64_t now=Stats::now();
+	refill(now);
+	if (_rate==0) {
+		// start full
+		_tokens=1e300;
+	}
+	_rate=rate;
+	_burst=(rate/10>THROTTLE_MIN_BURST) ? (double)(rate/10) : (double)THROTTLE_MIN_BURST;
+	if (_tokens>_burst) {
+		_tokens=_burst;
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+void TokenBucket::take(uint64_t n) {
+	Throttle::poll();
+	pthread_mutex_lock(&_lock);
+	while (_rate!=0) {
+		refill(Stats::now());
+		// more than the bucket holds goes into debt once the bucket is full
+		if (_tokens>=(double)n || _tokens>=_burst) {
+			_tokens-=(double)n;
+			break;
+		}
+		double need=((double)n<_burst) ? (double)n : _burst;
+		uint64_t wait=(uint64_t)((need-_tokens)*1e9/(double)_rate)+1;
+		pthread_mutex_unlock(&_lock);
+		__sleep_ns((wait<THROTTLE_MAX_WAIT) ? wait : THROTTLE_MAX_WAIT);
+		Throttle::poll();
+		pthread_mutex_lock(&_lock);
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+// class ThreadLimit implementation
+
+ThreadLimit::ThreadLimit() : _limit(0), _active(0) {
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_cond, NULL);
+}
+
+ThreadLimit::~ThreadLimit() {
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_lock);
+}
+
+void ThreadLimit::setLimit(unsigned int limit) {
+	pthread_mutex_lock(&_lock);
+	_limit=limit;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_lock);
+}
+
+void ThreadLimit::acquire() {
+	Throttle::poll();
+	pthread_mutex_lock(&_lock);
+	while (_limit!=0 && _active>=_limit) {
+		// timed, so a waiting thread also picks up control file changes
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec+=THROTTLE_MAX_WAIT;
+		if (ts.tv_nsec>=1000000000) {
+			ts.tv_nsec-=1000000000;
+			++ts.tv_sec;
+		}
+		pthread_cond_timedwait(&_cond, &_lock, &ts);
+		pthread_mutex_unlock(&_lock);
+		Throttle::poll();
+		pthread_mutex_lock(&_lock);
+	}
+	++_active;
+	pthread_mutex_unlock(&_lock);
+}
+
+void ThreadLimit::release() {
+	pthread_mutex_lock(&_lock);
+	--_active;
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_lock);
+}
+
+namespace Throttle {
+
+bool enabled=false;
+TokenBucket read;
+TokenBucket write;
+ThreadLimit inflate;
+
+static ThrottleLimits __base;
+static const char* __control_path=NULL;
+// both read by every thread outside __reload_lock, so only through __atomic builtins
+static int __hangup=0;
+static uint64_t __next_check=0;
+static struct timespec __mtime;
+static pthread_mutex_t __reload_lock=PTHREAD_MUTEX_INITIALIZER;
+
+static void __on_hangup(int) {
+	__atomic_store_n(&__hangup, 1, __ATOMIC_RELAXED);
+}
+
+bool parseRate(const char* str, uint64_t& value) {
+	char* end;
+	double mb=strtod(str, &end);
+	end+=strspn(end, " \t");
+	// also rejects NaN, and rates which would not fit in bytes per second
+	if (end==str || *end!='\0' || !(mb>=0.0 && mb<1e12)) {
+		return false;
+	}
+	value=(uint64_t)(mb*1048576.0);
+	return true;
+}
+
+bool parseThreads(const char* str, unsigned int& value) {
+	char* end;
+	errno=0;
+	unsigned long count=strtoul(str, &end, 10);
+	end+=strspn(end, " \t");
+	// strtoul() negates a leading '-' instead of failing
+	if (end==str || *end!='\0' || str[strspn(str, " \t")]=='-' || errno==ERANGE || count>UINT_MAX) {
+		return false;
+	}
+	value=(unsigned int)count;
+	return true;
+}
+
+// the control file's limits over __base
+static bool __load(ThrottleLimits& limits) {
+	FILE* file=fopen(__control_path, "r");
+	if (!file) {
+		fprintf(stderr, "ERROR: Failed to open throttle control file: %s\n", __control_path);
+		return false;
+	}
+	limits=__base;
+	char line[256];
+	bool ok=true;
+	for (unsigned int number=1; fgets(line, sizeof(line), file); ++number) {
+		char* p=line+strspn(line, " \t");
+		p[strcspn(p, "#\r\n")]='\0';
+		if (*p=='\0') {
+			continue;
+		}
+		if (strncmp(p, "read=", 5)==0) {
+			ok=parseRate(p+5, limits.read);
+		} else if (strncmp(p, "write=", 6)==0) {
+			ok=parseRate(p+6, limits.write);
+		} else if (strncmp(p, "inflate=", 8)==0) {
+			ok=parseThreads(p+8, limits.inflate);
+		} else {
+			ok=false;
+		}
+		if (!ok) {
+			fprintf(stderr, "ERROR: %s:%u: expected read=<MB/s>, write=<MB/s> or inflate=<threads>\n", __control_path, number);
+			break;
+		}
+	}
+	fclose(file);
+	return ok;
+}
+
+static void __apply(const ThrottleLimits& limits) {
+	read.setRate(limits.read);
+	write.setRate(limits.write);
+	inflate.setLimit(limits.inflate);
+}
+
+bool start(const ThrottleLimits& limits, const char* control_path) {
+	__base=limits;
+	__control_path=control_path;
+	ThrottleLimits current=limits;
+	if (__control_path) {
+		struct stat st;
+		if (stat(__control_path, &st)==0) {
+			__mtime=st.st_mtim;
+		}
+		if (!__load(current)) {
+			return false;
+		}
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler=__on_hangup;
+		action.sa_flags=SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGHUP, &action, NULL);
+		__atomic_store_n(&__next_check, Stats::now()+THROTTLE_CHECK_INTERVAL, __ATOMIC_RELAXED);
+	}
+	__apply(current);
+	enabled=(__control_path || limits.read || limits.write || limits.inflate);
+	return true;
+}
+
+void poll() {
+	if (!__control_path) {
+		return;
+	}
+	uint64_t now=Stats::now();
+	if ((!__atomic_load_n(&__hangup, __ATOMIC_RELAXED) && now<__atomic_load_n(&__next_check, __ATOMIC_RELAXED))
+		|| pthread_mutex_trylock(&__reload_lock)!=0) {
+		return;
+	}
+	bool hangup=__atomic_exchange_n(&__hangup, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&__next_check, now+THROTTLE_CHECK_INTERVAL, __ATOMIC_RELAXED);
+	struct stat st;
+	if (stat(__control_path, &st)==0
+		&& (hangup || st.st_mtim.tv_sec!=__mtime.tv_sec || st.st_mtim.tv_nsec!=__mtime.tv_nsec)) {
+		__mtime=st.st_mtim;
+		// a bad file keeps the current limits
+		ThrottleLimits limits;
+		if (__load(limits)) {
+			__apply(limits);
+			fprintf(stderr, "# throttle: read:%lu write:%lu inflate:%u\n", (unsigned long)limits.read, (unsigned long)limits.write, limits.inflate);
+		}
+	}
+	pthread_mutex_unlock(&__reload_lock);
+}
+
+} // namespace Throttle
+
+} // namespace PK2Unpack
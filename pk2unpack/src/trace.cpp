@@ -0,0 +1,75 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "trace.hpp"
+
+namespace PK2Unpack {
+
+namespace Trace {
+
+bool enabled=false;
+
+static __thread ThreadTrace* __local=NULL;
+static ThreadTrace* __all=NULL;
+static pthread_mutex_t __all_lock=PTHREAD_MUTEX_INITIALIZER;
+
+ThreadTrace* local() {
+	if (!__local) {
+		// never freed; written out at exit by write()
+		ThreadTrace* t=(ThreadTrace*)malloc(sizeof(ThreadTrace));
+		t->count=0;
+		t->tid=(unsigned int)syscall(SYS_gettid);
+		pthread_mutex_lock(&__all_lock);
+		t->next=__all;
+		__all=t;
+		pthread_mutex_unlock(&__all_lock);
+		__local=t;
+	}
+	return __local;
+}
+
+bool write(const char* path) {
+	FILE* out=fopen(path, "w");
+	if (!out) {
+		printf("ERROR: Failed to open trace output: %s\n", path);
+		return false;
+	}
+	uint64_t base=~0ull;
+	pthread_mutex_lock(&__all_lock);
+	for (ThreadTrace* t=__all; t; t=t->next) {
+		uint64_t first=(t->count>TRACE_RING_SIZE) ? t->count-TRACE_RING_SIZE : 0;
+		for (uint64_t i=first; i<t->count; ++i) {
+			uint64_t start=t->events[i&(TRACE_RING_SIZE-1)].start;
+			base=(start<base) ? start : base;
+		}
+	}
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first_event=true;
+	pid_t pid=getpid();
+	for (ThreadTrace* t=__all; t; t=t->next) {
+		fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"pk2unpack-%u\"}}", (first_event) ? "" : ",\n", (int)pid, t->tid, t->tid);
+		first_event=false;
+		uint64_t first=(t->count>TRACE_RING_SIZE) ? t->count-TRACE_RING_SIZE : 0;
+		for (uint64_t i=first; i<t->count; ++i) {
+			const TraceEvent& e=t->events[i&(TRACE_RING_SIZE-1)];
+			fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"pk2unpack\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":%lu}}",
+				e.name, (int)pid, t->tid, (double)(e.start-base)/1000.0, (double)e.duration/1000.0, (unsigned long)e.arg);
+		}
+	}
+	pthread_mutex_unlock(&__all_lock);
+	fprintf(out, "\n]}\n");
+	fclose(out);
+	return true;
+}
+
+} // namespace Trace
+
+} // namespace PK2Unpack
@@ -0,0 +1,257 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include "update.hpp"
+
+namespace PK2Unpack {
+
+#define UPDATE_COPY_SIZE 0x100000
+
+// class ArchiveUpdate implementation
+
+ArchiveUpdate::ArchiveUpdate(SDPK2& pak, int level) : _pak(pak), _encoder(level), _fd(-1), _end(0), _appended(0), _relocated(0) {
+}
+
+ArchiveUpdate::~ArchiveUpdate() {
+	close();
+}
+
+bool ArchiveUpdate::open() {
+	if (_fd<0) {
+		_fd=::open(_pak.getPath(), O_RDWR);
+		if (_fd<0) {
+			printf("ERROR: Failed to open SDPK2 file for writing: %s\n", _pak.getPath());
+			return false;
+		}
+		off_t end=lseek(_fd, 0, SEEK_END);
+		_end=(end>0) ? end : 0;
+	}
+	return true;
+}
+
+void ArchiveUpdate::close() {
+	if (_fd>=0) {
+		::close(_fd);
+		_fd=-1;
+	}
+}
+
+bool ArchiveUpdate::append(const char* data, size_t size) {
+	while (size>0) {
+		ssize_t n=pwrite(_fd, data, size, _end);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<=0) {
+			printf("ERROR: Failed to write to %s\n", _pak.getPath());
+			return false;
+		}
+		data+=n;
+		size-=n;
+		_end+=n;
+		_appended+=n;
+	}
+	return true;
+}
+
+bool ArchiveUpdate::copyToEnd(uint64_t offset, uint64_t size) {
+	_buffer.resize(UPDATE_COPY_SIZE);
+	while (size>0) {
+		size_t chunk=(size<UPDATE_COPY_SIZE) ? size : UPDATE_COPY_SIZE;
+		ssize_t n=pread(_fd, &_buffer[0], chunk, offset);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<=0) {
+			printf("ERROR: Failed to read from %s\n", _pak.getPath());
+			return false;
+		}
+		if (!append(&_buffer[0], n)) {
+			return false;
+		}
+		offset+=n;
+		size-=n;
+	}
+	return true;
+}
+
+bool ArchiveUpdate::setEntry(const MD5Hash& hash, const char* data, uint64_t size) {
+	if (!open()) {
+		return false;
+	}
+	Pending* p=NULL;
+	for (size_t i=0; i<_pending.size(); ++i) {
+		if (_pending[i].entry.hash().compare(hash)==0) {
+			p=&_pending[i];
+			break;
+		}
+	}
+	if (!p) {
+		_pending.push_back(Pending());
+		p=&_pending.back();
+	}
+	p->entry=Entry(hash, 0, size, _end);
+	p->table.clear();
+	_buffer.clear();
+	_encoder.encodeBlocks(data, size, _pak.getBlockSize(), p->table, _buffer);
+	return _buffer.empty() || append(&_buffer[0], _buffer.size());
+}
+
+struct __UpdateOffsetLess {
+	const EntryVec* entries;
+	bool operator()(size_t x, size_t y) const {
+		return (*entries)[x].getOffset()<(*entries)[y].getOffset();
+	};
+};
+
+bool ArchiveUpdate::commit() {
+	if (!open()) {
+		return false;
+	}
+	const EntryVec& old_entries=_pak.getEntries();
+	const BlockSizeTable& old_table=_pak.getBlockSizeTable();
+	size_t block_size=_pak.getBlockSize();
+	if (block_size==0) {
+		printf("ERROR: block size is 0\n");
+		return false;
+	}
+	// new entries in the old order, then the added ones; the block table is rebuilt without unused elements
+	EntryVec entries;
+	BlockSizeTable table;
+	std::vector<bool> used(_pending.size(), false);
+	entries.reserve(old_entries.size()+_pending.size());
+	for (size_t i=0; i<old_entries.size()+_pending.size(); ++i) {
+		Entry entry;
+		const size_t* slice;
+		size_t count;
+		if (i<old_entries.size()) {
+			entry=old_entries[i];
+			size_t k=0;
+			for (; k<_pending.size() && _pending[k].entry.hash().compare(entry.hash())!=0; ++k) {
+			}
+			if (k<_pending.size()) {
+				used[k]=true;
+				entry=_pending[k].entry;
+				slice=_pending[k].table.empty() ? NULL : &_pending[k].table[0];
+				count=_pending[k].table.size();
+			} else {
+				count=(entry.getSize()+block_size-1)/block_size;
+				if (entry.getBlockSizeIndex()>old_table.size() || count>old_table.size()-entry.getBlockSizeIndex()) {
+					char hash_str[32];
+					entry.hash().getExisting(hash_str, false);
+					printf("ERROR: entry [%.*s] runs past comp_block_sizes; not updating\n", 32, hash_str);
+					return false;
+				}
+				slice=(count>0) ? &old_table[entry.getBlockSizeIndex()] : NULL;
+			}
+		} else if (!used[i-old_entries.size()]) {
+			const Pending& p=_pending[i-old_entries.size()];
+			entry=p.entry;
+			slice=p.table.empty() ? NULL : &p.table[0];
+			count=p.table.size();
+		} else {
+			continue;
+		}
+		entry.setBlockSizeIndex(table.size());
+		table.insert(table.end(), slice, slice+count);
+		entries.push_back(entry);
+	}
+	size_t required=32+30*entries.size()+2*table.size();
+	size_t old_header_size=_pak.getHeaderSize();
+	// entries in data order, for finding the first data byte and for relocation
+	std::vector<size_t> order;
+	for (size_t i=0; i<entries.size(); ++i) {
+		if (entries[i].getSize()>0) {
+			order.push_back(i);
+		}
+	}
+	__UpdateOffsetLess offset_less={&entries};
+	std::sort(order.begin(), order.end(), offset_less);
+	uint64_t data_start=(order.empty()) ? _end : entries[order[0]].getOffset();
+	// slack kept for later updates when the header has to grow
+	uint64_t target=required+(required>>3)+0x1000;
+	if (data_start<required) {
+		// move the entries in the way to the end; entries sharing data stay shared
+		size_t i=0;
+		while (i<order.size() && entries[order[i]].getOffset()<target) {
+			// a run of entries at the same offset; the largest compressed extent covers the others
+			uint64_t old_offset=entries[order[i]].getOffset(), c_size=0;
+			size_t end=i;
+			for (; end<order.size() && entries[order[end]].getOffset()==old_offset; ++end) {
+				const Entry& entry=entries[order[end]];
+				uint64_t size=0;
+				for (size_t k=0; k<(entry.getSize()+block_size-1)/block_size; ++k) {
+					size_t v=table[entry.getBlockSizeIndex()+k];
+					size+=(v==0) ? block_size : v;
+				}
+				if (size>c_size) {
+					c_size=size;
+				}
+			}
+			uint64_t new_offset=_end;
+			if (!copyToEnd(old_offset, c_size)) {
+				return false;
+			}
+			for (; i<end; ++i) {
+				entries[order[i]].setOffset(new_offset);
+			}
+			++_relocated;
+		}
+		data_start=(i<order.size()) ? entries[order[i]].getOffset() : _end;
+		for (size_t k=0; k<i; ++k) {
+			if (entries[order[k]].getOffset()<data_start) {
+				data_start=entries[order[k]].getOffset();
+			}
+		}
+	}
+	// keep the slack there is, but don't make open() read a huge header
+	uint64_t header_size=std::max((uint64_t)old_header_size, target);
+	if (header_size>data_start) {
+		header_size=data_start;
+	}
+	if (header_size>0xFFFFFFFF) {
+		header_size=required;
+	}
+	// whole comp_block_sizes elements only, or readers see a stray byte
+	header_size&=~(uint64_t)1;
+	// the slack reads back as unused comp_block_sizes elements
+	table.resize((header_size-32-30*entries.size())/2, 0);
+	// data first, then the header which refers to it
+	if (fdatasync(_fd)!=0) {
+		printf("ERROR: Failed to sync %s\n", _pak.getPath());
+		return false;
+	}
+	SDPK2 updated(_pak.getPath());
+	updated.setBlockSize(block_size);
+	updated.setCompressionMethod(_pak.getCompressionMethod());
+	updated.getEntries().swap(entries);
+	updated.getBlockSizeTable().swap(table);
+	std::vector<unsigned char> header;
+	updated.serializeInfo(header, header_size);
+	for (size_t done=0; done<header.size(); ) {
+		ssize_t n=pwrite(_fd, &header[done], header.size()-done, done);
+		if (n<0 && errno==EINTR) {
+			continue;
+		} else if (n<=0) {
+			printf("ERROR: Failed to write the header of %s\n", _pak.getPath());
+			return false;
+		}
+		done+=n;
+	}
+	if (fsync(_fd)!=0) {
+		printf("ERROR: Failed to sync %s\n", _pak.getPath());
+		return false;
+	}
+	_pak.getEntries().swap(updated.getEntries());
+	_pak.getBlockSizeTable().swap(updated.getBlockSizeTable());
+	_pending.clear();
+	return true;
+}
+
+} // namespace PK2Unpack
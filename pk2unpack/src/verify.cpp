@@ -0,0 +1,106 @@
+/**
+@copyright MIT license; see @ref index or the accompanying LICENSE file.
+
+@file
+*/
+
+#include "parallel.hpp"
+#include "trace.hpp"
+#include "verify.hpp"
+
+namespace PK2Unpack {
+
+class VerifyHandler : public BlockHandler {
+public:
+	VerifyHandler(BlockFaultVec& faults) : _faults(faults), _bytes(0) {
+	};
+	bool block(unsigned int, const char*, size_t size) {
+		_bytes+=size;
+		return true;
+	};
+	bool error(unsigned int index, int err) {
+		BlockFault f={index, err};
+		_faults.push_back(f);
+		return true;
+	};
+	uint64_t getBytes() const {
+		return _bytes;
+	};
+	
+protected:
+	BlockFaultVec& _faults;
+	uint64_t _bytes;
+};
+
+class VerifyTask : public ParallelTask {
+public:
+	VerifyTask(const SDPK2& pak, unsigned int threads) : _pak(pak), _streams(threads, (Stream*)NULL), _decoders(threads, (BlockDecoder*)NULL), _bytes(threads, 0), _faults(pak.getEntries().size()) {
+	};
+	void begin(unsigned int thread) {
+		_streams[thread]=_pak.openDataStream();
+		_decoders[thread]=new BlockDecoder();
+	};
+	void run(size_t index, unsigned int thread) {
+		if (!_streams[thread]) {
+			BlockFault f={0, READERR_READ};
+			_faults[index].push_back(f);
+			return;
+		}
+		TraceScope entry_trace("entry", _pak.getEntries()[index].getSize());
+		StreamBlockSource source(_streams[thread]);
+		VerifyHandler handler(_faults[index]);
+		_pak.getEntries()[index].readBlocks(source, _pak, handler, *_decoders[thread]);
+		_bytes[thread]+=handler.getBytes();
+	};
+	void end(unsigned int thread) {
+		SDPK2::closeDataStream(_streams[thread]);
+		_streams[thread]=NULL;
+		delete _decoders[thread];
+		_decoders[thread]=NULL;
+	};
+	const std::vector<BlockFaultVec>& getFaults() const {
+		return _faults;
+	};
+	uint64_t getBytes() const {
+		uint64_t total=0;
+		for (size_t i=0; i<_bytes.size(); ++i) {
+			total+=_bytes[i];
+		}
+		return total;
+	};
+	
+protected:
+	const SDPK2& _pak;
+	std::vector<Stream*> _streams;
+	std::vector<BlockDecoder*> _decoders;
+	std::vector<uint64_t> _bytes;
+	std::vector<BlockFaultVec> _faults;
+};
+
+size_t verifyArchive(const SDPK2& pak, unsigned int threads, FILE* out) {
+	if (threads==0) {
+		threads=getHardwareThreads();
+	}
+	const EntryVec& entries=pak.getEntries();
+	VerifyTask task(pak, threads);
+	parallelFor(entries.size(), threads, task);
+	const std::vector<BlockFaultVec>& faults=task.getFaults();
+	size_t bad_entries=0, bad_blocks=0;
+	char hash_str[32];
+	for (size_t i=0; i<faults.size(); ++i) {
+		const BlockFaultVec& fv=faults[i];
+		if (fv.empty()) {
+			continue;
+		}
+		++bad_entries;
+		bad_blocks+=fv.size();
+		entries[i].hash().getExisting(hash_str, false);
+		for (size_t k=0; k<fv.size(); ++k) {
+			fprintf(out, "%.*s %u %s\n", 32, hash_str, fv[k].block, getReadErrorName(fv[k].err));
+		}
+	}
+	fprintf(out, "# entries:%lu bad_entries:%lu bad_blocks:%lu bytes:%lu\n", (unsigned long)entries.size(), (unsigned long)bad_entries, (unsigned long)bad_blocks, (unsigned long)task.getBytes());
+	return bad_entries;
+}
+
+} // namespace PK2Unpack